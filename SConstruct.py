@@ -25,7 +25,7 @@ Help(
 		"""BareOS build targets
 
 Usage:
-  scons [target] [debug]
+  scons [target] [debug] [sstc=1] [smp=N] [fpu=1] [lockstat=1]
   scons -c
   scons -h
 
@@ -36,6 +36,13 @@ Targets:
 
 Options:
   -c, --clean  Remove SCons state and all build outputs.
+  sstc=1       Start QEMU with the Sstc extension so timer ticks are taken
+               directly in Supervisor mode (default: sstc=0, M-mode relay).
+  smp=N        Number of harts QEMU starts, 1 through 4 (default: smp=1).
+  fpu=1        Save and restore FP registers for user threads so programs
+               built with `scons build <program> fpu=1` can use rv64gc.
+  lockstat=1   Count acquisitions, contention and wait times of every lock,
+               semaphore and wait queue, read back with the lockstat program.
 """
 )
 
@@ -120,6 +127,14 @@ if GetOption("clean"):
 	_perform_clean(BUILD_DIR)
 
 PORT = 6999
+SSTC = ARGUMENTS.get("sstc", "0") == "1"
+MAX_HARTS = 4  # NHARTS in kernel/include/system/smp.h
+SMP = ARGUMENTS.get("smp", "1")
+if not SMP.isdigit() or not 1 <= int(SMP) <= MAX_HARTS:
+	print(f"[Error] smp must be between 1 and {MAX_HARTS}")
+	Exit(1)
+FPU = ARGUMENTS.get("fpu", "0") == "1"
+LOCKSTAT = ARGUMENTS.get("lockstat", "0") == "1"
 CFLAGS = " ".join(
 	[
 		"-std=gnu2x",
@@ -138,7 +153,7 @@ CFLAGS = " ".join(
 LFLAGS = f"-nostdlib -Map {MAP_FILE} -T {LD_FILE}"
 AFLAGS = "-march=rv64imac_zicsr -mabi=lp64 -g"
 QFLAGS = (
-	"-M virt -bios none -cpu rv64,sstc=false -m 128M "
+	f"-M virt -bios none -cpu rv64,sstc={'true' if SSTC else 'false'} -smp {SMP} -m 128M "
 	"-chardev stdio,id=uart0 -serial chardev:uart0 -display none"
 )
 
@@ -161,6 +176,12 @@ env = Environment(
 	),
 )
 env.Append(ENV={"PATH": os.environ["PATH"]}, CFLAGS=CFLAGS, ASFLAGS=AFLAGS)
+if FPU:
+	# The kernel stays soft-float, this only adds the lazy FP switching (see kernel/thread/fpu.c)
+	env.Append(CPPDEFINES=["BAREOS_FPU"])
+if LOCKSTAT:
+	# Instruments the lock paths in kernel/sync/, compiled out otherwise (see kernel/sync/lockstat.c)
+	env.Append(CPPDEFINES=["BAREOS_LOCKSTAT"])
 
 script = env.SConscript(
 	"SConscript.py",
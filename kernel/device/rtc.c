@@ -2,6 +2,7 @@
 #include <device/rtc.h>
 #include <mm/vm.h>
 #include <mm/malloc.h>
+#include <device/timer.h>
 #include <fs/fs.h>
 #include <util/string.h>
 
@@ -41,6 +42,24 @@ uint64_t rtc_read_seconds(void) {
 	return nano / NSEC_PER_SEC;
 }
 
+/* Republishes the clock base and the timezone on the time page.  Updates are serialized  *
+ * by the kernel lock, the 'seq' bumps around them let user readers spot a torn copy.    */
+void update_time_page(void) {
+	vdso_time_t* page = (vdso_time_t*)PPN_TO_KVA(vdso_ppn);
+	uint32_t lo = rtc_getoff(TIME_LOW);
+	uint32_t hi = rtc_getoff(TIME_HIGH);
+	uint64_t ticks = r_time();
+
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+	asm volatile("fence w, w" ::: "memory");
+	page->base_ns = ((uint64_t)hi << 32) | lo;
+	page->base_ticks = ticks;
+	page->timebase_hz = RDTIME_HZ;
+	page->tz = localtime;
+	asm volatile("fence w, w" ::: "memory");
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+}
+
 datetime rtc_read_datetime(void) {
 	return seconds_to_dt(rtc_read_seconds());
 }
@@ -128,20 +147,21 @@ uint8_t change_localtime(const char* tz) {
 	if (resolve_dir("/etc/tzinfo", boot_fsd->super.root_dirent, &tzinfo) != 0) return 1;
 
 	/* Open and read the file */
-	FILE f;
+	file_t* f;
 	if (open(tz, &f, tzinfo) != 0) return 1;
-	byte* buffer = malloc(f.inode.size + 1);
+	uint32_t size = f->inode.size;
+	byte* buffer = malloc(size + 1);
 	if (buffer == NULL) {
-		close(&f);
+		close(f);
 		return 1;
 	}
-	read(&f, buffer, f.inode.size);
-	close(&f);
-	if (f.inode.size == 0) {
+	read(f, buffer, size);
+	close(f);
+	if (size == 0) {
 		free(buffer);
 		return 1;
 	}
-	buffer[f.inode.size] = '\0';
+	buffer[size] = '\0';
 
 	tzrule rule;
 	memset(&rule, 0, sizeof(tzrule));
@@ -192,5 +212,6 @@ uint8_t change_localtime(const char* tz) {
 
 	free(buffer);
 	localtime = rule;
+	update_time_page();
 	return 0;
 }
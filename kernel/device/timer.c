@@ -14,29 +14,73 @@
 
 #define TRAP_TIMER_ENABLE 0x80 | 0xa0
 #define CLINT_MTIME 0x0200BFF8
+#define MENVCFG_STCE   (1UL << 63)  /*  Enables the Sstc 'stimecmp' register                */
+#define MCOUNTEREN_TM  0x2          /*  Lets Supervisor mode read 'time' (and 'stimecmp')   */
+#define MIDELEG_STIP   0x20         /*  Delegates the Supervisor timer interrupt            */
 const uint64_t timer_interval = 100000;
 const uint64_t clint_timer_addr = 0x2004000;
+bool sstc_enabled = false;
+
+static inline uint64_t r_stimecmp(void) { uint64_t x; asm volatile("csrr %0, 0x14d":"=r"(x)); return x; }
+static inline void w_stimecmp(uint64_t x) { asm volatile("csrw 0x14d, %0" :: "r"(x)); }
+
+/*
+ *  'menvcfg.STCE' is WARL, so it reads back as zero when the hart does not
+ *  implement Sstc (e.g. QEMU's '-cpu rv64,sstc=false').
+ */
+static bool probe_sstc(void) {
+	uint64_t envcfg;
+	asm volatile("csrs 0x30a, %0" :: "r"(MENVCFG_STCE));
+	asm volatile("csrr %0, 0x30a" : "=r"(envcfg));
+	return (envcfg & MENVCFG_STCE) != 0;
+}
 
 /*
  * This function is called as part of the bootstrapping sequence
- * to enable the timer. (see bootstrap.s)
+ * to enable the timer on each hart. (see bootstrap.s)
+ *
+ * With Sstc the Supervisor timer is programmed directly through 'stimecmp'
+ * and STIP is delegated, so ticks never enter Machine mode.  Otherwise the
+ * Machine timer is used and 'delegate_clk' forwards each tick as an SSIP.
  */
 void init_clk(void) {
+	asm volatile("csrs mcounteren, %0" :: "r"(MCOUNTEREN_TM));
+	sstc_enabled = probe_sstc();
+	if (sstc_enabled) {
+		asm volatile("csrs mideleg, %0" :: "r"(MIDELEG_STIP));
+		w_stimecmp(r_time() + timer_interval);
+		return;
+	}
+
+	uint64_t hartid;
+	asm volatile("csrr %0, mhartid" : "=r"(hartid));
 	volatile uint64_t* mtime = (uint64_t*)CLINT_MTIME;
-	volatile uint64_t* mtimecmp = (uint64_t*)clint_timer_addr;
+	volatile uint64_t* mtimecmp = (uint64_t*)(clint_timer_addr + 8 * hartid);
 	*mtimecmp = *mtime + timer_interval;
 	set_m_interrupt(TRAP_TIMER_ENABLE);
 }
+
+/*
+ *  Called from 'trap_sti' on a Supervisor timer interrupt (Sstc only).
+ *  Writing 'stimecmp' is what clears STIP.  The deadline advances from the
+ *  previous one so ticks do not drift by the trap latency.
+ */
+void handle_stimer(void) {
+	w_stimecmp(r_stimecmp() + timer_interval);
+	handle_clk();
+}
 #include <lib/bareio.h>
 void handle_clk(void) {
 	//krprintf("timer\n");
-	if (sleep_list.qnext != &sleep_list) {
+	/* Every hart takes ticks, but only hart 0 advances the sleep list and timers */
+	if (this_hart()->id == 0) expire_timers();
+	if (this_hart()->id == 0 && sleep_list.qnext != &sleep_list) {
 		if (sleep_list.qnext->key == 0) {
 			panic("The next thread in the sleep list had a timer of zero but was not dequeued.\n");
 		}
 		sleep_list.qnext->key -= 10;
 		if (sleep_list.qnext->key < 0) {
-			panic("Sleep-list invariant violated: next->key (%d) not a non-negative multiple of 10.\n", sleep_list.qnext->key);
+			panic("Sleep-list invariant violated: next->key (%d) not a non-negative multiple of 10.\n", (int32_t)sleep_list.qnext->key);
 		}
 		while (sleep_list.qnext->key == 0) {
 			uint32_t tid = dequeue_thread(&sleep_list);
@@ -45,5 +89,6 @@ void handle_clk(void) {
 		}
 	}
 	
+	balance_load();
 	pend_resched(RESCHED);
 }
@@ -1,61 +1,122 @@
-#include <system/semaphore.h>
+#include <system/waitqueue.h>
 #include <system/interrupts.h>
+#include <system/lockstat.h>
+#include <system/semaphore.h>
+#include <system/panic.h>
 #include <device/tty.h>
+#include <util/string.h>
 #include <barelib.h>
 
+/*
+ *  'tty_in' is filled by the UART interrupt and emptied by 'tty_getc', 'tty_out'
+ *  is filled by 'tty_write' and emptied by the interrupt.  Each ring has one
+ *  producer and one consumer, so the indices are published with release stores
+ *  and read with acquire loads instead of being guarded by a lock.  Threads
+ *  sharing the thread side of a ring take turns through its 'owner' semaphore and
+ *  sleep on its wait queue only while the ring is empty (tty_in) or full (tty_out).
+ */
+
 ring_buffer_t tty_in;
 ring_buffer_t tty_out;
+static char tty_in_buffer[TTY_IN_LEN];
+static char tty_out_buffer[TTY_OUT_LEN];
+
+static void init_ring(ring_buffer_t* ring, char* buffer, uint32_t size, const char* name) {
+	if (size == 0 || (size & (size - 1)) != 0)
+		panic("TTY ring '%s' needs a power of two size, got %d\n", name, size);
+	ring->buffer = buffer;
+	ring->size = size;
+	ring->head = ring->tail = 0;
+	ring->owner = create_sem(1);
+	init_wait_queue(&ring->wq);
+	lockstat_name(&ring->wq, LS_WAITQ, name);
+	lockstat_name(&ring->owner, LS_SEM, name);
+}
 
-/*  Initialize the `tty_in_sem` and `tty_out_sem` semaphores  *
- *  for later TTY calls.                                      */
+/*  Initialize the `tty_in` and `tty_out` buffers and  *
+ *  their wait queues for later TTY calls.              */
 void init_tty(void) {
-	tty_in.head = 0;
-	tty_in.count = 0;
-	tty_in.sem = create_sem(0);
-	tty_out.head = 0;
-	tty_out.count = 0;
-	tty_out.sem = create_sem(TTY_BUFFLEN);
+	init_ring(&tty_in, tty_in_buffer, TTY_IN_LEN, "tty_in");
+	init_ring(&tty_out, tty_out_buffer, TTY_OUT_LEN, "tty_out");
 }
 
 /*  Get a character  from the `tty_in`  buffer and remove  *
- *  it from the circular buffer.  If the buffer is empty,  * 
- *  wait on  the semaphore  for data to be  placed in the  *
- *  buffer by the UART.                                    */
+ *  it from the circular buffer.  If the buffer is empty,  *
+ *  wait on  the queue  for data to be  placed in the      *
+ *  buffer by the UART.  Re-enables UART RX if it had      *
+ *  stopped for a full buffer.                             */
 char tty_getc(void) {
-	wait_sem(&tty_in.sem);
-	char c = tty_in.buffer[tty_in.head];
-	tty_in.head  = (tty_in.head + 1) % TTY_BUFFLEN;
-	--tty_in.count;
+	wait_sem(&tty_in.owner);
+	wait_event(&tty_in.wq, ring_count(&tty_in) > 0);
+	char c = *ring_at(&tty_in, tty_in.head);
+	ring_consume(&tty_in, 1);
+
+	/* The UART stops RX interrupts while 'tty_in' is full, see 'uart_drain_rx'.  *
+	 * The fence orders the consume before the check of its flag.                 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	uart_wake_rx();
+	post_sem(&tty_in.owner);
 	return c;
 }
 
-/* Helper function bc I'm tired of rewriting this so many times. */
-uint8_t put_to_tail(char ch) {
-	wait_sem(&tty_out.sem);
-	uint8_t needs_wake = (tty_out.count == 0);
-	uint32_t tail = (tty_out.head + tty_out.count) % TTY_BUFFLEN;
-	tty_out.buffer[tail] = ch;
-	++tty_out.count;
-	return needs_wake;
+/*  Copies as much of 'buf' as fits into the free space of `tty_out`, turning each  *
+ *  '\n' into "\r\n", and publishes it to the UART in one store.  Returns how many   *
+ *  bytes of 'buf' were taken and sets 'added' to the bytes put in the ring.          */
+static uint32_t tty_out_fill(const char* buf, uint32_t len, uint32_t* added) {
+	uint32_t room = ring_room(&tty_out);
+	uint32_t taken = 0, put = 0;
+	while (taken < len && put < room) {
+		if (buf[taken] == '\n') {
+			if (room - put < 2) break;
+			*ring_at(&tty_out, tty_out.tail + put++) = '\r';
+			*ring_at(&tty_out, tty_out.tail + put++) = '\n';
+			++taken;
+			continue;
+		}
+		uint32_t run = 0;                                  /*  Bytes up to the next newline  */
+		while (put + run < room && taken + run < len && buf[taken + run] != '\n') ++run;
+		uint32_t at = (tty_out.tail + put) & (tty_out.size - 1);
+		uint32_t first = run < tty_out.size - at ? run : tty_out.size - at;
+		memcpy(&tty_out.buffer[at], &buf[taken], first);           /*  Second copy only if   */
+		memcpy(tty_out.buffer, &buf[taken + first], run - first);  /*  the ring wrapped      */
+		put += run;
+		taken += run;
+	}
+	ring_publish(&tty_out, put);
+	*added = put;
+	return taken;
+}
+
+/*  Place 'len' characters into the `tty_out` buffer and  *
+ *  enable uart interrupts.  Each pass copies as much as  *
+ *  fits and wakes the UART at most once.  Only when the  *
+ *  buffer is full does it wait on the queue until the    *
+ *  UART has made room.                                   */
+void tty_write(const char* buf, uint32_t len) {
+	wait_sem(&tty_out.owner);
+	while (len > 0) {
+		wait_event(&tty_out.wq, ring_room(&tty_out) >= 2);  /*  Room for a "\r\n"  */
+		uint32_t added;
+		uint32_t taken = tty_out_fill(buf, len, &added);
+		buf += taken;
+		len -= taken;
+
+		/* If nothing older is left in the ring the UART may have turned its TX      *
+		 * interrupt off, see 'uart_fill_tx'.  The fence orders the publish before  *
+		 * the load, the interrupt side does the same the other way round.          */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (tty_out.tail - __atomic_load_n(&tty_out.head, __ATOMIC_ACQUIRE) <= added) uart_wake_tx();
+	}
+	post_sem(&tty_out.owner);
 }
 
-/*  Place a character into the `tty_out` buffer and enable  *
- *  uart interrupts.   If the buffer is  full, wait on the  *
- *  semaphore  until notified  that there  space has  been  *
- *  made in the  buffer by the UART. */
+/*  Place a character into the `tty_out` buffer, see `tty_write`  */
 void tty_putc(char ch) {
-	uint8_t needs_wake = 0;
-	if (ch == '\n') needs_wake |= put_to_tail('\r');
-	needs_wake |= put_to_tail(ch);
-	if (needs_wake) uart_wake_tx();
+	tty_write(&ch, 1);
 }
 
 /* Enqueue the backspace erase sequence into the tty while only *
  * waking the UART once for the whole sequence. Reducing lag.  */
 void tty_bkspc(void) {
-	uint8_t needs_wake = 0;
-	needs_wake |= put_to_tail('\b');
-	needs_wake |= put_to_tail(' ');
-	needs_wake |= put_to_tail('\b');
-	if (needs_wake) uart_wake_tx();
+	tty_write("\b \b", 3);
 }
@@ -2,6 +2,8 @@
 #include <system/interrupts.h>
 #include <device/tty.h>
 #include <device/uart.h>
+#include <system/workqueue.h>
+#include <system/spinlock.h>
 #include <mm/vm.h>
 #include <barelib.h>
 
@@ -11,12 +13,15 @@
 
 #define UART0_BAUD 115200                  /* Configuration parameters for the UART.  BAUD and  */
 #define UART0_FREQ 1843200                 /* FREQ are factors for the rate to send characters  */
+#define UART_RX_TRIGGER 8                  /* Bytes in the RX FIFO before it interrupts: 1/4/8/14 */
+#define UART_FIFO_SIZE  16                 /* Depth of each of the NS16550A FIFOs               */
 
 #define UART0_CFG_REG 0x10000000UL         /*  This addresses are for the NS16550  UART module  */
 #define UART0_RW_REG   0x0                 /*  Each device on the PLIC has dedicated addresses  */
 #define UART0_INTR_REG 0x1                 /*  tied to hardware registers.  These are the ones  */
 #define UART0_RW_H_REG 0x2                 /*  used by the UART.                                */
 #define UART0_INT_STAT 0x2                 /*                                                   */
+#define UART0_FIFO_REG 0x2                 /*  (write only, shares the address of INT_STAT)     */
 #define UART0_CTRL_REG 0x3                 /*                                                   */
 #define UART0_MODEM    0x4                 /*  For  example, RW_REG  reads and  writes a  byte  */
 #define UART0_STAT_REG 0x5                 /*  to/from the UART.                                */
@@ -28,18 +33,75 @@
 #define UART_8BIT     0x03                 /*                                                   */
 #define UART_PARITY   0x08                 /*                                                   */
 #define UART_IDLE     0x20                 /*                                                   */
+#define UART_RX_READY 0x01                 /*                                                   */
 										   
 #define UART_RX_INTR  0x4                  /*  UART interrupt code for "received data ready"    */
 #define UART_TX_INTR  0x2                  /*  UART interrupt code for "transmit reg empty"     */
+#define UART_TO_INTR  0xC                  /*  UART interrupt code for "RX FIFO idle, not empty" */
+#define UART_NO_INTR  0x1                  /*  Set in INT_STAT while nothing is pending         */
 #define UART_INT_MASK 0xE                  /*  Mask for extracting interrupt data from reg      */
 
+#define UART_FIFO_ON  0x01                 /*  FIFO_REG  bits.  The  FIFOs  are enabled  and  */
+#define UART_FIFO_CLR 0x06                 /*  cleared  at  init, RX  interrupts fire once  */
+#if UART_RX_TRIGGER == 1                   /*  'UART_RX_TRIGGER' bytes are waiting or the   */
+#define UART_FIFO_TRIG 0x00                /*  line has been quiet for a few characters.    */
+#elif UART_RX_TRIGGER == 4
+#define UART_FIFO_TRIG 0x40
+#elif UART_RX_TRIGGER == 8
+#define UART_FIFO_TRIG 0x80
+#elif UART_RX_TRIGGER == 14
+#define UART_FIFO_TRIG 0xC0
+#else
+#error "UART_RX_TRIGGER must be 1, 4, 8 or 14"
+#endif
+
 volatile byte* uart;
+static volatile bool rx_ready;             /*  Set by the interrupt handler when it added data to  */
+static volatile bool tx_room;              /*  'tty_in' or made room in 'tty_out'                  */
+static bool rx_stopped;                    /*  RX interrupts are off until 'tty_in' has room again */
+static spinlock_t ier_lock = SPINLOCK_INIT;  /*  Orders read-modify-writes of the interrupt enables  */
+
+/*  Wakes the readers and writers that the last interrupts made room or data for,  *
+ *  once for however many bytes moved since the last run.                           */
+static void uart_bottom_half(work_t* work) {
+	if (rx_ready) {
+		rx_ready = false;
+		wake_up_all(&tty_in.wq);
+	}
+	if (tx_room) {
+		tx_room = false;
+		wake_up_all(&tty_out.wq);
+	}
+}
+
+static work_t uart_bh = WORK_INIT(&uart_bottom_half);
+
+/*  Sets or clears one interrupt enable bit.  The handler and threads on any hart  *
+ *  both change the register, so each update is done under 'ier_lock'.            */
+static void uart_ier(uint8_t bit, bool on) {
+	uint64_t sie = spin_lock_irqsave(&ier_lock);
+	uint8_t state = uart[UART0_INTR_REG];
+	uart[UART0_INTR_REG] = on ? (state | bit) : (state & ~bit);
+	spin_unlock_irqrestore(&ier_lock, sie);
+}
 
 /* public wrapper, don't do this */
 void uart_wake_tx(void) {
 	set_uart_interrupt(1);
 }
 
+/*  Turns RX interrupts back on if 'uart_drain_rx' stopped them for a full 'tty_in'.  *
+ *  Called by the reader after it made room, see 'tty_getc'.                         */
+void uart_wake_rx(void) {
+	if (!__atomic_load_n(&rx_stopped, __ATOMIC_ACQUIRE)) return;
+	uint64_t sie = spin_lock_irqsave(&ier_lock);
+	if (rx_stopped) {
+		__atomic_store_n(&rx_stopped, false, __ATOMIC_RELEASE);
+		uart[UART0_INTR_REG] |= UART_RX_ON;
+	}
+	spin_unlock_irqrestore(&ier_lock, sie);
+}
+
 void uart_write(const char* s) {
 	while(*s) putc(*s++);
 }
@@ -58,37 +120,68 @@ char getc(void) {
  *  not - for instance - disable timer interrupts, only UART TX interrupts          */
 void set_uart_interrupt(uint8_t enabled) {
 	uart = (volatile byte*)PA_TO_KVA(UART0_CFG_REG); 
-	uint8_t state = uart[UART0_INTR_REG];
-	uart[UART0_INTR_REG] = (enabled ? (state | UART_TX_ON) : (state & ~UART_TX_ON));  /*  Set the "write ready" interrupt on the UART  */
+	uart_ier(UART_TX_ON, enabled);  /*  Set the "write ready" interrupt on the UART  */
+}
+
+/*  Empties the RX FIFO into 'tty_in', publishing the whole batch at once.  When   *
+ *  'tty_in' fills up the rest is left in the FIFO and RX interrupts are turned   *
+ *  off, or the FIFO would keep raising them, until 'tty_getc' makes room.         */
+static void uart_drain_rx(void) {
+	uint32_t room = ring_room(&tty_in);
+	uint32_t added = 0;
+	while (added < room && (uart[UART0_STAT_REG] & UART_RX_READY))
+		*ring_at(&tty_in, tty_in.tail + added++) = uart[UART0_RW_REG];
+	ring_publish(&tty_in, added);
+	rx_ready = true;
+
+	if (added == room && (uart[UART0_STAT_REG] & UART_RX_READY)) {
+		/* A reader that consumed after 'room' was read either sees 'rx_stopped'  *
+		 * and turns RX back on itself, or its room is seen here.                 */
+		uint64_t sie = spin_lock_irqsave(&ier_lock);
+		__atomic_store_n(&rx_stopped, true, __ATOMIC_RELEASE);
+		uart[UART0_INTR_REG] &= ~UART_RX_ON;
+		spin_unlock_irqrestore(&ier_lock, sie);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_room(&tty_in) > 0) uart_wake_rx();
+	}
+}
+
+/*  Refills the TX FIFO from 'tty_out'.  THRE means the whole FIFO is empty, so up  *
+ *  to 'UART_FIFO_SIZE' bytes are written without polling the line status.          */
+static void uart_fill_tx(void) {
+	uint32_t count = ring_count(&tty_out);
+	if (count > 0 && (uart[UART0_STAT_REG] & UART_IDLE)) {
+		uint32_t n = count < UART_FIFO_SIZE ? count : UART_FIFO_SIZE;
+		for (uint32_t i = 0; i < n; ++i)
+			uart[UART0_RW_REG] = *ring_at(&tty_out, tty_out.head + i);
+		ring_consume(&tty_out, n);
+		tx_room = true;
+		count -= n;
+	}
+	if (count == 0) {
+		/* A writer that published after the count was read either sees the ring  *
+		 * empty of older bytes and turns TX back on itself, or is seen here.      */
+		set_uart_interrupt(0);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_count(&tty_out) > 0) set_uart_interrupt(1);
+	}
 }
 
 /*
  *  This function is automatically called in response to an external interrupt on the PLIC
- *     (see '__traps' in bootstrap.s)
+ *     (see '__traps' in bootstrap.s).  It handles every cause the UART has pending and
+ *     only moves bytes between the UART and the TTY buffers, waking threads is left to
+ *     'uart_bottom_half', which runs once for the whole batch.
  */
 void uart_handler(void) {
-	uint8_t code = uart[UART0_INT_STAT] & UART_INT_MASK;
-	if(code == UART_RX_INTR) {  /*  If interrupt was caused by a keypress */
-	  char c = uart[UART0_RW_REG];
-
-	  uint32_t tail = (tty_in.head + tty_in.count) % TTY_BUFFLEN;
-	  if (tty_in.count < TTY_BUFFLEN) {
-		  tty_in.buffer[tail] = c;
-		  tty_in.count++;
-		  post_sem(&tty_in.sem);             /* Notify readers a char is available */
-	  }
-	} else if(code == UART_TX_INTR) { /*  If interrupt was caused by UART awaiting char */
-		if (tty_out.count > 0) {
-			while (tty_out.count > 0 && (uart[UART0_STAT_REG] & UART_IDLE)) {
-				char c = tty_out.buffer[tty_out.head];
-				tty_out.head = (tty_out.head + 1) % TTY_BUFFLEN;
-				uart[UART0_RW_REG] = c;
-				post_sem(&tty_out.sem);
-				--tty_out.count;
-			}
-			if (tty_out.count == 0) set_uart_interrupt(0);
-		} else { set_uart_interrupt(0); }
+	uint8_t stat;
+	while (!((stat = uart[UART0_INT_STAT]) & UART_NO_INTR)) {
+		uint8_t code = stat & UART_INT_MASK;
+		if (code == UART_RX_INTR || code == UART_TO_INTR) uart_drain_rx();  /*  Keypresses or a paste  */
+		else if (code == UART_TX_INTR) uart_fill_tx();                       /*  UART awaiting chars    */
+		else break;
 	}
+	if (rx_ready || tx_room) queue_bottom_half(&uart_bh);
 }
 
 /*
@@ -106,7 +199,8 @@ void init_uart(void) {
   uart[UART0_CTRL_REG] = UART_CFG_ON;                  /*  Switch  UART  to  configuration   mode     */
   uart[UART0_RW_REG]   = divisor & 0xff;               /*  Set the UART speed to the high and low     */
   uart[UART0_RW_H_REG] = (divisor >> 8) & 0xff;        /*  registers.                                 */
-  uart[UART0_CTRL_REG] = UART_PARITY | UART_8BIT;      /*  Enable parity and 8-bit mode and start     */
+  uart[UART0_CTRL_REG] = UART_PARITY | UART_8BIT;      /*  Enable parity and 8-bit mode, turn on the  */
+  uart[UART0_FIFO_REG] = UART_FIFO_ON | UART_FIFO_CLR | UART_FIFO_TRIG;  /*  FIFOs and start             */
   uart[UART0_INTR_REG] = UART_RX_ON;                   /*  listening for characters.                  */
   uart[UART0_MODEM]   |= UART_TRIGGER;                 /*                                             */
 }
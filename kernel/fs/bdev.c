@@ -53,10 +53,12 @@ uint32_t write_super(void) {
 
 /* Helper function allocates a block for the caller */
 int32_t allocate_block(void) {
+	fs_alloc_lock();
 	int32_t blk = bm_findfree();
-	if (blk == -1) return FAT_BAD;
+	if (blk == -1) { fs_alloc_unlock(); return FAT_BAD; }
 	bm_set(blk);
 	fat_set(blk, FAT_END);
+	fs_alloc_unlock();
 	bdev_zero_blocks(blk, 1);
 	return blk;
 }
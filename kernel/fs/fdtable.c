@@ -0,0 +1,71 @@
+#include <fs/fs.h>
+#include <mm/malloc.h>
+#include <system/workqueue.h>
+#include <system/panic.h>
+#include <util/string.h>
+
+/*
+ *  Per-process file descriptor tables.  An fd is an index into a table and
+ *  each slot holds a reference on a 'file_t' (see file.c), so a file stays
+ *  open until every fd for it is closed, in this process or in the children
+ *  that inherited it.
+ */
+
+/* Allocates an fd table.  If 'parent' is given the new one gets the same files at the *
+ * same fds.  Returns NULL if out of memory.                                           */
+fdtable_t* fdtable_create(const fdtable_t* parent) {
+	fdtable_t* table = (fdtable_t*)malloc(sizeof(fdtable_t));
+	if (table == NULL) return NULL;
+	table->refs = 1;
+	for (uint32_t i = 0; i < NFDS; ++i)
+		table->files[i] = parent != NULL ? file_get(parent->files[i]) : NULL;
+	return table;
+}
+
+static void fdtable_close_all(fdtable_t* table) {
+	for (uint32_t i = 0; i < NFDS; ++i)
+		if (table->files[i] != NULL) close(table->files[i]);
+	free(table);
+}
+
+void fdtable_put(fdtable_t* table) {
+	if (table == NULL || --table->refs > 0) return;
+	fdtable_close_all(table);
+}
+
+static void fdtable_reap(work_t* work) {
+	fdtable_close_all((fdtable_t*)((byte*)work - offsetof(fdtable_t, reap)));
+}
+
+/* 'close' may sleep on the inode locks, which 'kill_thread' must not do: it runs in    *
+ * whichever thread 'finish_switch' switched to, often a hart's idle thread.  The last  *
+ * reference hands the closing to a kernel worker instead.                              */
+void fdtable_put_deferred(fdtable_t* table) {
+	if (table == NULL || --table->refs > 0) return;
+	init_work(&table->reap, &fdtable_reap);
+	if (!queue_work(&system_wq, &table->reap))
+		panic("A process exited before 'system_wq' was started and its files could not be closed.\n");
+}
+
+/* Takes over the caller's reference to 'f'.  Returns the fd, or -1 if the table is full. */
+int32_t fd_install(fdtable_t* table, file_t* f) {
+	for (int32_t fd = 0; fd < NFDS; ++fd) {
+		if (table->files[fd] == NULL) {
+			table->files[fd] = f;
+			return fd;
+		}
+	}
+	return -1;
+}
+
+file_t* fd_get(const fdtable_t* table, int32_t fd) {
+	if (table == NULL || fd < 0 || fd >= NFDS) return NULL;
+	return table->files[fd];
+}
+
+int32_t fd_close(fdtable_t* table, int32_t fd) {
+	file_t* f = fd_get(table, fd);
+	if (f == NULL) return -1;
+	table->files[fd] = NULL;
+	return close(f);
+}
@@ -2,6 +2,11 @@
 #include <mm/malloc.h>
 #include <util/string.h>
 
+static int32_t create_locked(dirent_t, const char*);
+static int8_t mk_dir_locked(dirent_t, const char*, dirent_t*);
+static int32_t rm_dir_locked(dirent_t, dirent_t);
+static int32_t unlink_locked(dirent_t, const char*);
+
 /* Resolve the directory from the provided filepath, if invalid or the file  *
  * already exists at that path, return an error. Otherwise create a new      *
  * dirent for that directory for this file, create an inode, and assign the  *
@@ -18,7 +23,15 @@ int32_t create(const char* path, dirent_t cwd) {
 	res = path_to_name(path, filename);
 	if (res != 2) return -2; /* Invalid filename, todo: differentiate between fail reasons */
 
-	if (dir_child_exists(parent, filename, NULL)) return -3; /* File exists */
+	in_wlock(parent.inode);
+	int32_t status = create_locked(parent, filename);
+	in_wunlock(parent.inode);
+	return status;
+}
+
+/* 'create' once the parent directory is write locked */
+static int32_t create_locked(dirent_t parent, const char* filename) {
+	if (dir_lookup(parent, filename, NULL)) return -3; /* File exists */
 
 	/* Create entry */
 	dirent_t entry;
@@ -54,11 +67,26 @@ int32_t create(const char* path, dirent_t cwd) {
 	return 0;
 }
 
+/* The open bits are changed under a shared directory lock or none at all, so they are atomic */
+static inline bool in_is_open(uint16_t index) {
+	return (__atomic_load_n(&boot_fsd->in_open[index / 64], __ATOMIC_ACQUIRE) >> (index % 64)) & 0x1;
+}
+
+/* Marks an inode open, false if it already was */
+static inline bool in_claim_open(uint16_t index) {
+	uint64_t bit = 1UL << (index % 64);
+	return !(__atomic_fetch_or(&boot_fsd->in_open[index / 64], bit, __ATOMIC_ACQ_REL) & bit);
+}
+
+static inline void in_release_open(uint16_t index) {
+	__atomic_fetch_and(&boot_fsd->in_open[index / 64], ~(1UL << (index % 64)), __ATOMIC_RELEASE);
+}
+
 /* Resolve the directory from the provided filepath, if invalid or the  *
  * file does not exist in the target directory, return an error.        *
- * otherwise find a free slot in the fsd's open file table and init for *
- * further operations on the file. Return an fd (index to oft)          */
-int32_t open(const char* path, FILE* f, dirent_t cwd) {
+ * otherwise allocate a 'file_t' holding one reference for further      *
+ * operations on the file and return it through 'out'.                  */
+int32_t open(const char* path, file_t** out, dirent_t cwd) {
 	if (path == NULL) return -1;
 	
 	dirent_t parent;
@@ -70,53 +98,52 @@ int32_t open(const char* path, FILE* f, dirent_t cwd) {
 	res = path_to_name(path, filename);
 	if (res != 2) return -2; /* Invalid filename, todo: differentiate between fail reasons */
 
+	/* The parent stays locked until the file is marked open, so 'unlink' can't remove it in between */
 	dirent_t file;
-	if (!dir_child_exists(parent, filename, &file)) return -3; /* File doesn't exist */
-	if (file.type == EN_DIR) return -4; /* File is a directory */
-
-	for (uint8_t i = 0; i < OFT_MAX; ++i) {
-		if (boot_fsd->oft[i].state == OPEN && boot_fsd->oft[i].in_index == file.inode) return -5; /* File in use by other process */
+	in_rlock(parent.inode);
+	int32_t status = 0;
+	if (!dir_lookup(parent, filename, &file)) status = -3; /* File doesn't exist */
+	else if (file.type == EN_DIR) status = -4; /* File is a directory */
+	else if (!in_claim_open(file.inode)) status = -5; /* File in use by other process */
+	in_runlock(parent.inode);
+	if (status != 0) return status;
+
+	file_t* entry = (file_t*)malloc(sizeof(file_t));
+	if (entry == NULL) {
+		in_release_open(file.inode);
+		return -5; /* Out of memory for open files */
 	}
 
-	uint8_t fd = (uint8_t)-1;
-	for (uint8_t i = 0; i < OFT_MAX; ++i) {
-		if (boot_fsd->oft[i].state == CLOSED) fd = i;
-	}
-	if (fd == (uint8_t)-1) return -5; /* oft error */
-
-	filetable_t* entry = &boot_fsd->oft[fd];
-	
-	entry->state = OPEN;
+	entry->refs = 1;
 	entry->mode = RDWR; /* TODO: open options */
 	entry->in_index = file.inode;
 	entry->in_dirty = false;
 	entry->curr_index = 0;
+	entry->inode = get_inode(file.inode);
 
-	f->inode = get_inode(file.inode);
-	f->fd = fd;
-	entry->inode = &f->inode;
-
+	*out = entry;
 	return 0;
 }
 
-/* Takes an index into the oft and closes the file in the table. *
- * Finishes up by writing the inode back to the inode table and  *
- * any other cleanup work required.                              */
-int32_t close(FILE* f) {
-	if (f->fd < 0 || f->fd >= OFT_MAX) return -1;
+/* Takes another reference to an open file, for a duplicated or inherited fd */
+file_t* file_get(file_t* f) {
+	if (f != NULL) ++f->refs;
+	return f;
+}
 
-	filetable_t* entry = &boot_fsd->oft[f->fd];
-	if (entry->state != OPEN) return -1;
+/* Drops a reference to an open file.  The last one closes it, writing *
+ * the inode back to the inode table and freeing the 'file_t'.         */
+int32_t close(file_t* f) {
+	if (f == NULL || f->refs == 0) return -1;
+	if (--f->refs > 0) return 0;
 
-	if (entry->in_dirty) {
-		write_inode(*entry->inode, entry->in_index);
+	if (f->in_dirty) {
+		in_wlock(f->in_index);
+		write_inode(f->inode, f->in_index);
+		in_wunlock(f->in_index);
 	}
-
-	entry->state = CLOSED;
-	entry->mode = RD_ONLY;
-	entry->in_dirty = false;
-	entry->curr_index = 0;
-	entry->inode = NULL;
+	in_release_open(f->in_index);
+	free(f);
 
 	return 0;
 }
@@ -144,6 +171,17 @@ int8_t mk_dir(const char* path, dirent_t cwd, dirent_t* out) {
 	if (res != 1 && res != 2) return -2; /* Invalid directory name */
 	if (!strcmp(dir_name, parent.name)) return -3; /* Directory exists, resolve_dir resolved the preexisting target dir */
 
+	in_wlock(parent.inode);
+	int8_t status = mk_dir_locked(parent, dir_name, out);
+	in_wunlock(parent.inode);
+	return status;
+}
+
+/* 'mk_dir' once the parent directory is write locked. The new directory *
+ * isn't reachable until its entry is written, so it needs no lock.      */
+static int8_t mk_dir_locked(dirent_t parent, const char* dir_name, dirent_t* out) {
+	if (dir_lookup(parent, dir_name, NULL)) return -3; /* Made since 'resolve_dir' looked */
+
 	out->type = EN_DIR;
 	out->inode = in_find_free();
 	if (out->inode == IN_ERR) return -4; /* Error creating entry */
@@ -230,6 +268,7 @@ static int8_t dir_remove_entry(dirent_t parent, dirent_t target) {
  * inode table entry as free so the inode can be reused later. */
 static void inode_release(uint16_t inode_idx) {
 	inode_t inode = get_inode(inode_idx);
+	fs_alloc_lock();
 	int16_t block = inode.head;
 	while (block >= 0) {
 		int16_t next = fat_get(block);
@@ -244,6 +283,7 @@ static void inode_release(uint16_t inode_idx) {
 	inode.head = IN_ERR;
 	inode.parent = IN_ERR;
 	write_inode(inode, inode_idx);
+	fs_alloc_unlock();
 }
 
 /* Delete an empty directory */
@@ -280,6 +320,20 @@ int32_t rm_dir(const char* path, dirent_t cwd) {
 	if (target.type != EN_DIR) return -5; /* Target is not a directory */
 	if (!strcmp(target.name, ".") || !strcmp(target.name, "..")) return -2; /* Reject dot entries */
 
+	/* Both are locked so nothing can be added to the target while it is checked and removed */
+	in_wlock_pair(parent.inode, target.inode);
+	int32_t res = rm_dir_locked(parent, target);
+	in_wunlock_pair(parent.inode, target.inode);
+	return res;
+}
+
+/* 'rm_dir' with the parent and target locked. The target was looked up *
+ * before they were, so make sure it is still there first.              */
+static int32_t rm_dir_locked(dirent_t parent, dirent_t target) {
+	dirent_t current;
+	if (!dir_lookup(parent, target.name, &current) || current.inode != target.inode) return -4; /* Directory missing */
+	if (current.type != EN_DIR) return -5; /* Target is not a directory */
+
 	dir_iter_t it;
 	if (dir_open(target.inode, &it) != 0) return -7; /* Unable to read directory */
 
@@ -309,16 +363,23 @@ int32_t unlink(const char* path, dirent_t cwd) {
 	status = path_to_name(path, filename);
 	if (status != 2) return -2; /* Invalid filename */
 
+	in_wlock(parent.inode);
+	int32_t res = unlink_locked(parent, filename);
+	in_wunlock(parent.inode);
+	return res;
+}
+
+/* 'unlink' once the parent directory is write locked. 'open' marks a file  *
+ * open while holding the parent, so the check below can't race with it.   */
+static int32_t unlink_locked(dirent_t parent, const char* filename) {
 	dirent_t target;
-	if (!dir_child_exists(parent, filename, &target)) {
+	if (!dir_lookup(parent, filename, &target)) {
 		if (parent.type == EN_DIR && !strcmp(parent.name, filename)) return -4; /* Directory targeted */
 		return -3; /* Target missing */
 	}
 	if (target.type != EN_FILE) return -4; /* Target not a file */
 
-	for (uint8_t i = 0; i < OFT_MAX; ++i) {
-		if (boot_fsd->oft[i].state == OPEN && boot_fsd->oft[i].in_index == target.inode) return -5; /* File is open */
-	}
+	if (in_is_open(target.inode)) return -5; /* File is open */
 
 	if (dir_remove_entry(parent, target) != 0) return -6; /* Could not update parent */
 
@@ -330,11 +391,11 @@ int32_t unlink(const char* path, dirent_t cwd) {
 uint8_t create_write(const char* filename, const char* str, dirent_t cwd) {
 	if (filename == NULL || str == NULL) return 1;
 	if (create(filename, cwd) != 0) return 1;
-	FILE f;
+	file_t* f;
 	if (open(filename, &f, cwd) != 0) return 1;
 	uint32_t len = strlen(str);
-	uint32_t written = write(&f, (byte*)str, len);
-	close(&f);
+	uint32_t written = write(f, (byte*)str, len);
+	close(f);
 	if (written != len) return 1;
 	return 0;
 }
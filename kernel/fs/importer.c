@@ -77,10 +77,11 @@ uint8_t generic_importer(byte* ptr) {
 			status = -1;
 			break;
 		}
-		FILE f;
-		open(name, &f, cwd);
-		write(&f, ptr, size);
-		close(&f);
+		file_t* f;
+		if (open(name, &f, cwd) == 0) {
+			write(f, ptr, size);
+			close(f);
+		}
 		ksprintf(status_ptr, "Importer wrote %s (%u bytes).\n", name, size);
 		status_ptr = run_to_nc(status_ptr);
 		ptr += size;
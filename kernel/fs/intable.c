@@ -7,10 +7,10 @@ static inline byte* get_block(uint16_t index) {
 	return boot_fsd->device->ramdisk + (index * boot_fsd->device->block_size);
 }
 
-/* 'in_find_free' walks the inode table through its secret FAT path known to *
- * the fsd super. If it finds a free entry, returns the index. Otherwise it  *
- * will try to allocate a new block for the table and then returns an index  */
-uint16_t in_find_free(void) {
+/* 'in_claim_free' walks the inode table through its secret FAT path known to *
+ * the fsd super. If it finds a free entry, returns the index. Otherwise it   *
+ * will try to allocate a new block for the table and then returns an index   */
+static uint16_t in_claim_free(void) {
 	for (uint8_t blk_idx = 0; blk_idx < boot_fsd->super.intable_numblks; ++blk_idx) {
 		inode_t* block = (inode_t*)get_block(boot_fsd->super.intable_blocks[blk_idx]);
 		for (uint8_t in = 0; in < IN_PER_BLOCK; ++in) {
@@ -38,6 +38,14 @@ uint16_t in_find_free(void) {
 	return IN_ERR; /* Hit max intable blocks. */
 }
 
+/* Claims a free inode under the allocation lock, see 'in_claim_free' */
+uint16_t in_find_free(void) {
+	fs_alloc_lock();
+	uint16_t index = in_claim_free();
+	fs_alloc_unlock();
+	return index;
+}
+
 /* Writes an in-memory inode to the inode table at index. Currently assumes valid index. */
 uint8_t write_inode(inode_t inode, uint16_t index) {
 	uint16_t tbl_idx = index / IN_PER_BLOCK;
@@ -0,0 +1,51 @@
+#include <fs/fs.h>
+
+/*
+ *  Locking for the filesystem.  Kernel code can be preempted and several
+ *  harts take turns in the kernel, so two fs calls can interleave anywhere.
+ *
+ *  'alloc_lock' covers what is shared by the whole fs: the bitmap, FAT
+ *  entries of free blocks and the inode table slots.  It is only held for
+ *  the allocation or release itself and no other lock is taken under it.
+ *
+ *  Every inode has a reader-writer lock, striped over 'in_locks'.  A
+ *  directory's lock covers its entries and a file's covers its data, size
+ *  and the FAT chain of its blocks.  Lookups and reads take it shared, so
+ *  many threads can resolve paths at once.  Only one inode lock is held at
+ *  a time, except in 'rm_dir' which takes two through 'in_wlock_pair'.
+ */
+
+static inline rwlock_t* in_lock(uint16_t index) {
+	return &boot_fsd->in_locks[index % IN_LOCKS];
+}
+
+void fs_lock_init(fsystem_t* fsd) {
+	fsd->alloc_lock = create_sem(1);
+	for (uint32_t i = 0; i < IN_LOCKS; ++i)
+		rw_init(&fsd->in_locks[i]);
+}
+
+void fs_alloc_lock(void) { wait_sem(&boot_fsd->alloc_lock); }
+void fs_alloc_unlock(void) { post_sem(&boot_fsd->alloc_lock); }
+
+void in_rlock(uint16_t index) { rw_read_lock(in_lock(index)); }
+void in_runlock(uint16_t index) { rw_read_unlock(in_lock(index)); }
+void in_wlock(uint16_t index) { rw_write_lock(in_lock(index)); }
+void in_wunlock(uint16_t index) { rw_write_unlock(in_lock(index)); }
+
+/* Write locks two inodes, lowest stripe first so two callers can't deadlock. *
+ * Inodes that share a stripe only take it once.                             */
+void in_wlock_pair(uint16_t a, uint16_t b) {
+	rwlock_t* first = in_lock(a);
+	rwlock_t* second = in_lock(b);
+	if (first > second) { rwlock_t* t = first; first = second; second = t; }
+	rw_write_lock(first);
+	if (second != first) rw_write_lock(second);
+}
+
+void in_wunlock_pair(uint16_t a, uint16_t b) {
+	rwlock_t* first = in_lock(a);
+	rwlock_t* second = in_lock(b);
+	if (second != first) rw_write_unlock(second);
+	rw_write_unlock(first);
+}
@@ -1,6 +1,6 @@
 #include <fs/fs.h>
 
-/* fs_read - Takes a file descriptor index into the 'oft', a  pointer to a  *
+/* fs_read - Takes an open file, a  pointer to a                           *
  *           buffer that the function writes data to and a number of bytes  *
  *           to read.                                                       *
  *                                                                          *
@@ -11,19 +11,19 @@
  * returns - 'fs_read' should return the number of bytes read (either 'len' *
  *           or the  number of bytes  remaining in the file,  whichever is  *
  *           smaller).                                                      */
-uint32_t read(FILE* f, byte* buff, uint32_t len) {
-	if (f->fd >= OFT_MAX) return 0;
-	filetable_t* entry = &boot_fsd->oft[f->fd];
-	if (entry->state != OPEN || len == 0) return 0;
+uint32_t read(file_t* f, byte* buff, uint32_t len) {
+	if (f == NULL || f->refs == 0 || len == 0) return 0;
 
-	if (entry->curr_index >= entry->inode->size) return 0;
-	uint32_t bytes_read = iread(*entry->inode, buff, entry->curr_index, len);
-	entry->curr_index += bytes_read; /* Updates curr_index so subsequent reads get more of the file */
+	in_rlock(f->in_index);
+	uint32_t bytes_read = 0;
+	if (f->curr_index < f->inode.size) bytes_read = iread(f->inode, buff, f->curr_index, len);
+	f->curr_index += bytes_read; /* Updates curr_index so subsequent reads get more of the file */
+	in_runlock(f->in_index);
 
 	return bytes_read;
 }
 
-/* fs_write - Takes a file descriptor index into the 'oft', a  pointer to a  *
+/* fs_write - Takes an open file, a  pointer to a                            *
  *            buffer  that the  function reads data  from and the number of  *
  *            bytes to copy from the buffer to the file.                     *
  *                                                                           *
@@ -34,13 +34,13 @@ uint32_t read(FILE* f, byte* buff, uint32_t len) {
  *                                                                           *
  *  returns - 'fs_write' should return the number of bytes written to the    *
  *            file.                                                          */
-uint32_t write(FILE* f, byte* buff, uint32_t len) {
-	if (f->fd >= OFT_MAX) return 0;
-	filetable_t* entry = &boot_fsd->oft[f->fd];
-	if (entry->state != OPEN || len == 0) return 0;
-	uint32_t written = iwrite(entry->inode, buff, 0, len);
-	//entry->curr_index += written;
-	entry->in_dirty = true;
+uint32_t write(file_t* f, byte* buff, uint32_t len) {
+	if (f == NULL || f->refs == 0 || len == 0) return 0;
+	in_wlock(f->in_index);
+	uint32_t written = iwrite(&f->inode, buff, 0, len);
+	//f->curr_index += written;
+	f->in_dirty = true;
+	in_wunlock(f->in_index);
 	return written;
 }
 
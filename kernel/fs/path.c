@@ -26,18 +26,21 @@ static bool canonicalize_dirent(dirent_t* entry) {
 
 	/* Search parent for this entry's canon dirent_t */
 	dir_iter_t iter;
-	if (dir_open(ino.parent, &iter) != 0) return false;
+	in_rlock(ino.parent);
+	if (dir_open(ino.parent, &iter) != 0) { in_runlock(ino.parent); return false; }
 	dirent_t candidate;
+	bool found = false;
 	while (dir_next(&iter, &candidate) == 1) {
 		if (!strcmp(candidate.name, ".") || !strcmp(candidate.name, "..")) continue;
 		if (candidate.inode == target) {
 			memcpy(entry, &candidate, sizeof(dirent_t));
-			dir_close(&iter);
-			return true;
+			found = true;
+			break;
 		}
 	}
 	dir_close(&iter);
-	return false;
+	in_runlock(ino.parent);
+	return found;
 }
 
 
@@ -64,7 +67,8 @@ char* dirent_path_expand(dirent_t this, char* buffer) {
 	while (this.inode != boot_fsd->super.root_dirent.inode) {
 		inode_t child = get_inode(this.inode);
 		dir_iter_t iter;
-		if(dir_open(child.parent, &iter) != 0) return NULL;
+		in_rlock(child.parent);
+		if(dir_open(child.parent, &iter) != 0) { in_runlock(child.parent); return NULL; }
 		dirent_t other;
 		bool found = false;
 
@@ -73,6 +77,7 @@ char* dirent_path_expand(dirent_t this, char* buffer) {
 			if (!strcmp(other.name, ".") || !strcmp(other.name, "..")) continue;
 			if (this.inode == other.inode) { found = true; break; }
 		}
+		in_runlock(child.parent);
 		if (!found) {
 			char* msg = "Filesystem corruption detected. No handler exists to recover from this.\n"
 				"Reason: couldn't find a child dirent in its parent's inode blocks.\n"
@@ -94,10 +99,21 @@ char* dirent_path_expand(dirent_t this, char* buffer) {
  * Pass in an optional dirent_t pointer to get a reference *
  * to the child if exists                                  */
 bool dir_child_exists(dirent_t parent, const char* name, dirent_t* out) {
+	if (name == NULL) return false;
+	if (parent.type != EN_DIR) return false;
+	in_rlock(parent.inode);
+	bool found = dir_lookup(parent, name, out);
+	in_runlock(parent.inode);
+	return found;
+}
+
+/* Same as 'dir_child_exists' for callers that already hold the *
+ * directory's lock, shared or exclusive                        */
+bool dir_lookup(dirent_t parent, const char* name, dirent_t* out) {
 	if (name == NULL) return false;
 	if (parent.type != EN_DIR) return false;
 	dir_iter_t it;
-	dir_open(parent.inode, &it);
+	if (dir_open(parent.inode, &it) != 0) return false;
 	dirent_t child;
 	while (dir_next(&it, &child) == 1) {
 		if (!strcmp(child.name, name)) {
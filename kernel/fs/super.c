@@ -1,6 +1,7 @@
 #include <fs/fs.h>
 #include <mm/malloc.h>
 #include <util/string.h>
+#include <system/lockstat.h>
 
 #include <lib/bareio.h>
 /* TODO: put these somewhere better */
@@ -23,6 +24,7 @@ uint8_t mkfs(uint32_t blocksize, uint32_t numblocks) {
 	temp_fsd.super.intable_blocks[0] = IN_BIT;
 	temp_fsd.super.intable_numblks = 1;
 	temp_fsd.device = malloc(sizeof(bdev_t));
+	fs_lock_init(&temp_fsd);
 	if (mk_ramdisk(blocksize, numblocks, &temp_fsd) == -1) {
 		// todo: handle error based on whether it's critical or not
 		// critical = there's no other fs on the system and we're trying to create a blank one to run on
@@ -157,15 +159,10 @@ uint32_t mount_fs(drive_t* drive, const char* mount_point) {
 
 	boot_fsd = old_fsd;
 
-	/* Init oft */
-	for (uint8_t i = 0; i < OFT_MAX; ++i) {
-		drive->fsd->oft[i].state = CLOSED;
-		drive->fsd->oft[i].mode = RD_ONLY;
-		drive->fsd->oft[i].curr_index = 0;
-		drive->fsd->oft[i].in_index = IN_ERR;
-		drive->fsd->oft[i].in_dirty = false;
-		memset(&drive->fsd->oft[i].inode, 0, sizeof(inode_t));
-	}
+	/* Nothing is open yet */
+	memset(drive->fsd->in_open, 0, sizeof(drive->fsd->in_open));
+	fs_lock_init(drive->fsd);
+	lockstat_name(&drive->fsd->alloc_lock, LS_SEM, "fs_alloc");
 
 	/* Add to mounted list */
 	/* malloc space for the entry*/
@@ -8,6 +8,7 @@ void init_rtc(void);
 uint64_t rtc_read_seconds(void);
 datetime rtc_read_datetime(void);
 uint8_t change_localtime(const char*);
+void update_time_page(void);
 
 extern tzrule localtime;
 
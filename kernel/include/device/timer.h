@@ -2,11 +2,18 @@
 #define H_TIMER
 
 #include <barelib.h>
+#include <dev/time.h>
 
 extern const uint64_t clint_timer_addr;
 extern const uint64_t timer_interval;
+extern bool sstc_enabled;          /*  Set by 'init_clk' when ticks come from 'stimecmp'  */
+
+#define TICKS_PER_MS (RDTIME_HZ / 1000)   /*  The 'time' CSR runs at RDTIME_HZ (see dev/time.h)  */
+
+static inline uint64_t r_time(void) { uint64_t x; asm volatile("csrr %0, time":"=r"(x)); return x; }
 
 void init_clk(void);
 void handle_clk(void);
+void handle_stimer(void);
 
 #endif
@@ -1,23 +1,54 @@
 #ifndef H_TTY
 #define H_TTY
 
+#include <system/waitqueue.h>
 #include <system/semaphore.h>
 
-#define TTY_BUFFLEN 512
+#define TTY_IN_LEN  1024     /* Ring sizes handed to 'init_ring', each must be a power of two  */
+#define TTY_OUT_LEN 1024
 
+/*  A single producer, single consumer ring shared between the UART interrupt and the  *
+ *  threads using the TTY.  'head' is only written by the consumer and 'tail' only by  *
+ *  the producer, so neither side takes a lock (see device/tty.c).  Both count up      *
+ *  forever and are masked to index 'buffer', 'tail - head' is the number of bytes.    */
 typedef struct {
-  semaphore_t sem;           /* Semaphore used to lock the ring buffer while waiting for data */
-  char buffer[TTY_BUFFLEN];  /* Circular buffer for storing characters                        */
-  uint32_t head;               /* Index of the first character available in the ring buffer     */
-  uint32_t count;              /* Number of characters in the ring buffer                       */
+  wait_queue_t wq;           /* Threads waiting for data (tty_in) or for room (tty_out)       */
+  semaphore_t owner;         /* Held by the thread side, keeping it a single producer/consumer */
+  char* buffer;              /* Storage for the ring, 'size' bytes                            */
+  uint32_t size;             /* Set by 'init_ring', a power of two                            */
+  uint32_t head;             /* Index of the next character to take                           */
+  uint32_t tail;             /* Index the next character is placed at                         */
 } ring_buffer_t;
 
 extern ring_buffer_t tty_in;   /* Ring Buffer used for characters recieved from the UART device */
 extern ring_buffer_t tty_out;  /* Ring Buffer used for characters sent to the UART device */
 
+/*  Producer side: free space, then 'ring_publish' once the new bytes are written  */
+static inline uint32_t ring_room(ring_buffer_t* ring) {
+  return ring->size - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+}
+
+static inline void ring_publish(ring_buffer_t* ring, uint32_t n) {
+  __atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+}
+
+/*  Consumer side: bytes available, then 'ring_consume' once they have been read  */
+static inline uint32_t ring_count(ring_buffer_t* ring) {
+  return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - ring->head;
+}
+
+static inline void ring_consume(ring_buffer_t* ring, uint32_t n) {
+  __atomic_store_n(&ring->head, ring->head + n, __ATOMIC_RELEASE);
+}
+
+static inline char* ring_at(ring_buffer_t* ring, uint32_t index) {
+  return &ring->buffer[index & (ring->size - 1)];
+}
+
 void init_tty(void);
 char tty_getc(void);
 void tty_putc(char);
+void tty_write(const char*, uint32_t);
 void tty_bkspc(void);
 
 void set_uart_interrupt(uint8_t);
@@ -3,6 +3,8 @@
 
 #include <barelib.h>
 #include <dev/io_iface.h>
+#include <system/semaphore.h>
+#include <system/rwlock.h>
 
 /* Contains kernel-only format definitions. See io_iface.h for shared format definitions. */
 
@@ -18,10 +20,10 @@
 #define IN_BIT (FT_BIT + FT_LEN) /* Alias for the index of the default first intable block index. */
 
 #define MAX_INTABLE_BLOCKS 128  /* Completely arbitrary. TODO: Replace array.       */
-#define OFT_MAX 32              /* Also arbitrary.                                  */
+#define MAX_INODES (MAX_INTABLE_BLOCKS * (BDEV_BLOCK_SIZE / sizeof(inode_t))) /* Inode table capacity */
 #define IN_ERR 0 /* Returned when a new inode cannot be created. */
+#define IN_LOCKS 64 /* Inode locks are striped, inode 'i' uses 'in_locks[i % IN_LOCKS]' */
 
-typedef enum { CLOSED, OPEN } FSTATE;
 typedef enum { RD_ONLY, WR_ONLY, RDWR, APPEND } FMODE;
 
 /* The file system contains a 'bdev_t' that stores information about the underlying block device   */
@@ -31,17 +33,17 @@ typedef struct {
 	byte* ramdisk;         /* A pointer to the head of the ramdisk block region                           */
 } bdev_t;
 
-/* The 'filetable_t' struct is used to store information about a currently open file. An array  *
- * of these makes up the oft in the fsd that represents all open files. Each entry is           *
- * associated with a file when it is opened and deassociated with it is closed.                 */
+/* A 'file_t' is the kernel's state for an open file.  It is allocated by 'open' and shared  *
+ * by every fd that refers to it, within a process or inherited by its children, and freed  *
+ * when the last of them is closed.  The inode is only written back at that point.          */
 typedef struct {
-	FSTATE state;        /* The current state of the entry, either FSTATE OPEN or CLOSED        */
-	FMODE mode;          /* The current ops mode. Read, write, read/write, or append            */
-	uint32_t curr_index; /* Current offset within the file                                      */
-	inode_t* inode;       /* Pointer to an in-memory copy of the inode, real one in FILE        */
-	uint16_t in_index;   /* Index of file's inode                                               */
-	bool in_dirty;       /* A flag saying whether the inode copy has to be written back         */
-} filetable_t;
+	uint32_t refs;       /* Number of fds (or kernel users) holding the file                */
+	FMODE mode;          /* The current ops mode. Read, write, read/write, or append        */
+	uint32_t curr_index; /* Current offset within the file                                  */
+	uint16_t in_index;   /* Index of file's inode                                           */
+	bool in_dirty;       /* A flag saying whether the inode copy has to be written back     */
+	inode_t inode;       /* In-memory copy of the inode                                     */
+} file_t;
 
 /* 'fsuper_t' represents serializable data stored in the super block, it contains key   *
  * data required to remake the fs after a remount. Many of its values are necessary for *
@@ -59,12 +61,15 @@ typedef struct {
 } fsuper_t;
 
 /* 'fsystem_t' is the combined overarching master record of all the information about a *
- * ramdisk fs. It contains a pointer to the block device, a cached super, and an open   *
- * file table                                                                           */
+ * ramdisk fs. It contains a pointer to the block device, a cached super, a bitmask of  *
+ * the inodes that have an open 'file_t', and the locks that keep the fs consistent     *
+ * (see fs/lock.c).                                                                     */
 typedef struct {
 	bdev_t* device;
 	fsuper_t super;
-	filetable_t oft[OFT_MAX];
+	uint64_t in_open[MAX_INODES / 64];
+	semaphore_t alloc_lock;        /* Bitmap, free FAT entries and inode table slots */
+	rwlock_t in_locks[IN_LOCKS];   /* Directory entries and file data, per inode     */
 } fsystem_t;
 
 /* 'drive_t' is the master authority of a block device. If unmounted, it frees fsd resource while keeping *
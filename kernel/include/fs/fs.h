@@ -2,6 +2,7 @@
 #define H_FS
 
 #include <fs/format.h>
+#include <system/workqueue.h>
 #include <barelib.h>
 
 #define EMPTY -1        /* Used in FS whenever a field's state is undefined or unused */
@@ -14,6 +15,16 @@ typedef enum { FAT_FREE = 0, FAT_END = -1, FAT_RSVD = -2, FAT_BAD = -3 } FAT_FLA
 
 typedef struct { inode_t inode; uint32_t offset; uint32_t in_idx; uint32_t sz; } dir_iter_t;
 
+#define NFDS 16         /* Files a process can have open at once */
+
+/* Each process has an fd table, shared by its threads and copied for the children it *
+ * spawns.  An fd indexes 'files', which points at a reference on the open file.      */
+typedef struct {
+	uint32_t refs;          /* Threads using the table */
+	file_t* files[NFDS];
+	work_t reap;            /* Closes the files on 'system_wq' for 'fdtable_put_deferred' */
+} fdtable_t;
+
 /* Function prototypes used in the file system */
 uint32_t mk_ramdisk(uint32_t, uint32_t, fsystem_t*);      /* Build the block device                      */
 uint32_t free_ramdisk(void);                              /* Free resources associated with block device */
@@ -41,12 +52,13 @@ uint8_t write_inode(inode_t, uint16_t); /* Write an in-memory inode to the table
 inode_t get_inode(uint16_t);        /* Get a live copy of the inode at index */
 
 int32_t create(const char*, dirent_t);                    /* Create a file and save it to the block device */
-int32_t open(const char*, FILE*, dirent_t);                      /* Open a file                                   */
-int32_t close(FILE*);                   /* Close a file                                  */
+int32_t open(const char*, file_t**, dirent_t);                   /* Open a file                                   */
+file_t* file_get(file_t*);              /* Take another reference to an open file        */
+int32_t close(file_t*);                 /* Drop a reference to a file, closing it        */
 uint32_t iread(inode_t, byte*, uint32_t, uint32_t);
 uint32_t iwrite(inode_t*, byte*, uint32_t, uint32_t); /* Write to an inode's blocks         */
-uint32_t write(FILE*, byte*, uint32_t); /* Write to a file                               */
-uint32_t read(FILE*, byte*, uint32_t);    /* Read from file                                */
+uint32_t write(file_t*, byte*, uint32_t); /* Write to a file                             */
+uint32_t read(file_t*, byte*, uint32_t);  /* Read from file                                */
 int32_t unlink(const char*, dirent_t); /* Delete a file */
 int8_t mk_dir(const char*, dirent_t, dirent_t*);         /* Create an empty directory                     */
 int32_t rm_dir(const char*, dirent_t);
@@ -58,10 +70,28 @@ uint8_t dir_open(uint16_t, dir_iter_t*);
 void dir_close(dir_iter_t*);
 char* dirent_path_expand(dirent_t, char*);
 bool dir_child_exists(dirent_t, const char*, dirent_t*);
+bool dir_lookup(dirent_t, const char*, dirent_t*);       /* 'dir_child_exists' with the directory already locked */
 uint8_t dir_write_entry(dirent_t, dirent_t);
 dirent_t get_dot_entry(uint16_t, const char*);
 uint8_t create_write(const char*, const char*, dirent_t);
 
+void fs_lock_init(fsystem_t*);      /* Set up the locks of a new fsd              */
+void fs_alloc_lock(void);           /* Take the bitmap, FAT and inode table lock  */
+void fs_alloc_unlock(void);
+void in_rlock(uint16_t);            /* Share an inode for lookups and reads       */
+void in_runlock(uint16_t);
+void in_wlock(uint16_t);            /* Own an inode to change its entries or data */
+void in_wunlock(uint16_t);
+void in_wlock_pair(uint16_t, uint16_t);
+void in_wunlock_pair(uint16_t, uint16_t);
+
+fdtable_t* fdtable_create(const fdtable_t*); /* New fd table, inheriting the open files of another  */
+void fdtable_put(fdtable_t*);                /* Drop a thread's use of a table, the last closes all */
+void fdtable_put_deferred(fdtable_t*);       /* Same, closing on a worker for callers that can't block */
+int32_t fd_install(fdtable_t*, file_t*);     /* Give an open file the lowest free fd                */
+file_t* fd_get(const fdtable_t*, int32_t);   /* Open file behind an fd, NULL if not open            */
+int32_t fd_close(fdtable_t*, int32_t);       /* Free an fd and drop its reference                   */
+
 extern fsystem_t* boot_fsd;
 extern drv_reg* reg_drives;
 extern mount_t* mounted;
@@ -38,13 +38,18 @@ _Static_assert(sizeof(pte_t) == 8, "pte_t must be 8 bytes");
 
 void init_pages(void);
 uint64_t alloc_page(uint32_t);
+uint64_t alloc_user_page(uint32_t);
+int32_t alloc_kstack(uint32_t);
+void warm_aspace_cache(void);
 void free_pages(uint64_t);
 void free_process_pages(uint32_t);
+int32_t map_user_page(uint64_t, uint64_t);
 void* translate_user_address(uint64_t, uint64_t);
 int32_t copy_to_user(uint64_t, uint64_t, const void*, uint64_t);
 int32_t zero_user(uint64_t, uint64_t, uint64_t);
 
 extern uint64_t kernel_root_ppn;
+extern uint64_t vdso_ppn;
 extern byte* s_trap_top;
 
 #endif
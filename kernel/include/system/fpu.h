@@ -0,0 +1,26 @@
+#ifndef H_FPU
+#define H_FPU
+
+#include <barelib.h>
+
+/*  Floating point support is a build mode (scons fpu=1), which defines BAREOS_FPU and lets  *
+ *  user programs be built for rv64gc.  The kernel itself never uses the FP registers, so    *
+ *  they are only saved and restored for user threads, and only lazily (see thread/fpu.c).  */
+
+#define SSTATUS_FS  (3UL << 13)   /*  sstatus.FS, the state of the FP register file         */
+#define FS_OFF      (0UL << 13)   /*  FP instructions trap, the thread has never used them  */
+#define FS_INITIAL  (1UL << 13)
+#define FS_CLEAN    (2UL << 13)   /*  Registers match the thread's saved 'fpu_t'            */
+#define FS_DIRTY    (3UL << 13)   /*  Registers were written since they were last saved     */
+
+/*  The FP register file of a thread, saved and restored by ctxsw.s  */
+typedef struct {
+	uint64_t f[32];
+	uint64_t fcsr;
+} fpu_t;
+
+/*  FPU related prototypes  */
+extern void fpu_save(fpu_t*);
+extern void fpu_restore(fpu_t*);
+
+#endif
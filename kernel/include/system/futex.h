@@ -0,0 +1,21 @@
+#ifndef H_FUTEX
+#define H_FUTEX
+
+#include <system/semaphore.h>
+#include <barelib.h>
+
+#define FUTEX_SLOTS 32   /*  Distinct addresses that can have waiters at once, more than NTHREADS  */
+
+/*  Each user address with waiters has a 'futex_t' in the futex table (see sync/futex.c).  *
+ *  It is keyed by physical address so that threads sharing memory find the same entry.   */
+typedef struct {
+  uint64_t pa;           /*  Physical address of the futex word (0 when the entry is free)  */
+  uint32_t waiters;      /*  Number of threads waiting on 'sem'                             */
+  semaphore_t sem;       /*  Waiters block here until a wake posts it                       */
+} futex_t;
+
+/*  Futex related prototypes  */
+int32_t futex_wait(uint64_t, uint32_t);
+int32_t futex_wake(uint64_t, uint32_t);
+
+#endif
@@ -10,6 +10,6 @@ uint32_t disable_interrupts(void);   /*  Turn off all interrupts
 void restore_interrupts(uint32_t);   /*  Return the interrupts to a given state      */
 void acknowledge_interrupt(uint64_t mask);  /*  Reset a triggered interrupt                 */
 void uart_wake_tx(void);
-extern volatile uint64_t signum;
+void uart_wake_rx(void);
 
 #endif
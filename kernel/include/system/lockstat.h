@@ -0,0 +1,30 @@
+#ifndef H_LOCKSTAT
+#define H_LOCKSTAT
+
+#include <dev/ecall.h>
+#include <barelib.h>
+
+/*  Lock contention statistics are a build mode (scons lockstat=1), which defines     *
+ *  BAREOS_LOCKSTAT.  The lock and semaphore code reports every acquisition here and  *
+ *  ECALL_LOCKSTAT copies the table out (see sync/lockstat.c).  Without the mode the  *
+ *  hooks below compile to nothing.                                                   */
+
+#define LS_SPIN  0   /*  Ticket spinlock                                          */
+#define LS_MCS   1   /*  MCS queue lock                                           */
+#define LS_SEM   2   /*  Semaphore, waiters sleep                                 */
+#define LS_WAITQ 3   /*  Wait queue, waiters sleep.  Kinds fit in the low 2 bits  */
+
+#ifdef BAREOS_LOCKSTAT
+#define LOCKSTAT_SITE __builtin_return_address(0)  /*  Caller of the lock function  */
+static inline uint64_t lockstat_now(void) { uint64_t x; asm volatile("csrr %0, time" : "=r"(x)); return x; }
+void lockstat_acquire(const void*, uint32_t, const void*, bool, uint64_t);
+void lockstat_name(const void*, uint32_t, const char*);
+uint32_t lockstat_copy(lock_stat_t*, uint32_t, bool);
+#else
+#define LOCKSTAT_SITE NULL
+#define lockstat_now() 0
+#define lockstat_acquire(lock, kind, site, contended, start) ((void)(lock), (void)(site), (void)(contended), (void)(start))
+#define lockstat_name(lock, kind, name) ((void)(lock))
+#endif
+
+#endif
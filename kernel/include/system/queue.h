@@ -2,6 +2,8 @@
 #define H_QUEUE
 
 #include <barelib.h>
+#include <system/smp.h>
+#include <system/spinlock.h>
 
 /*  Certain  OS  features  require  threads  to  be  queued.  *
  *  Because each  thread can  only belong  to one queue at a  *
@@ -9,14 +11,24 @@
  *  list (see system/queue.c) which uses indices to point to  *
  *  the next and previous element in a given queue.           */
 typedef struct _queue {
-  int32_t key;             /*  An arbitrary key value for the thread, meaning depends on which queue it is in  */
+  int64_t key;             /*  An arbitrary key value for the thread, meaning depends on which queue it is in  */
   struct _queue* qprev;  /*  The next element in the queue                                                   */
   struct _queue* qnext;  /*  The previous element in the queue                                               */
 } queue_t;
 
+/*  Every hart schedules from its own 'runqueue_t'.  A thread sits in the queue of  *
+ *  the hart recorded in its 'hart' field, ordered by vruntime.  The lock is held    *
+ *  while the queue is changed so that other harts can steal from it.               */
+typedef struct {
+  queue_t ready;           /*  Root of the hart's ready queue                                 */
+  uint32_t nr_ready;       /*  Number of threads in 'ready'                                   */
+  spinlock_t lock;         /*  Taken with interrupts off, lower hart first when taking two    */
+  uint32_t ticks;          /*  Ticks since this hart last tried to balance its load           */
+  uint64_t min_vruntime;   /*  Monotonic floor of the vruntimes on this hart                  */
+} runqueue_t;
+
 extern queue_t queue_table[];
-extern queue_t ready_list;
-extern queue_t reap_list;
+extern runqueue_t runqueues[];
 
 /*  thread related prototypes  */
 int32_t enqueue_thread(queue_t*, uint32_t);
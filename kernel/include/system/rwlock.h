@@ -0,0 +1,27 @@
+#ifndef H_RWLOCK
+#define H_RWLOCK
+
+#include <system/semaphore.h>
+#include <system/spinlock.h>
+#include <barelib.h>
+
+/*  Sleeping reader-writer lock (see sync/rwlock.c).  Any number of readers or a  *
+ *  single writer may hold it.  Waiters sleep on a semaphore instead of spinning,  *
+ *  so it may be held across code that blocks or is preempted.                     */
+typedef struct {
+  spinlock_t lock;          /*  Guards the counters below, taken with interrupts off    */
+  int32_t readers;          /*  Readers holding the lock, -1 while a writer holds it    */
+  uint32_t read_waiters;    /*  Readers asleep on 'read_sem'                            */
+  uint32_t write_waiters;   /*  Writers asleep on 'write_sem'                           */
+  semaphore_t read_sem;     /*  Posted once per reader let in by a departing writer     */
+  semaphore_t write_sem;    /*  Posted to hand the lock straight to a waiting writer    */
+} rwlock_t;
+
+/*  Reader-writer lock related prototypes  */
+void rw_init(rwlock_t*);
+void rw_read_lock(rwlock_t*);
+void rw_read_unlock(rwlock_t*);
+void rw_write_lock(rwlock_t*);
+void rw_write_unlock(rwlock_t*);
+
+#endif
@@ -2,6 +2,7 @@
 #define H_SEM
 
 #include <system/queue.h>
+#include <system/spinlock.h>
 
 #define S_FREE 0  /*  Macros for indicating if a semaphore entry is  */
 #define S_USED 1  /*  free or currently in use.                      */
@@ -10,6 +11,7 @@
  *    (see system/semaphore.c)                                                            */
 typedef struct _sem {
   uint8_t state;        /*  The current state of the semaphore (S_FREE or S_USED)  */
+  spinlock_t lock;      /*  Guards 'state' and 'queue', taken with interrupts off  */
   queue_t queue;        /*  Queue containing all thread awaiting this semaphore    */
 } semaphore_t;
 
@@ -19,8 +21,4 @@ int32_t free_sem(semaphore_t*);
 int32_t wait_sem(semaphore_t*);
 int32_t post_sem(semaphore_t*);
 
-void create_mutex(uint32_t*);
-void lock_mutex(uint32_t*);
-void release_mutex(uint32_t*);
-
 #endif
@@ -0,0 +1,43 @@
+#ifndef H_SMP
+#define H_SMP
+
+#include <barelib.h>
+
+#define NHARTS     4    /*  Maximum number of harts brought up, extra harts stay parked  */
+#define HART_SIZE  64   /*  sizeof(hart_t), offsets are duplicated in the .s files       */
+#define HART_SHIFT 6
+
+/*  Each hart has a 'hart_t' record in the 'harts' table (see system/smp.c).  While in   *
+ *  Supervisor mode 'tp' always points at the record of the hart the code is running on,  *
+ *  and 'sscratch' holds the same pointer so the trap handler can find it from user mode. *
+ *  The layout is shared with interrupts.s, ctxsw.s and bootstrap.s.                      */
+typedef struct {
+	uint64_t scratch[2];       /*  0: Trap entry spills t0/t1 here before it has a stack          */
+	byte* kstack;              /* 16: Top of the trap area of the thread running on this hart     */
+	volatile uint64_t signum;  /* 24: Low level system function requested through SSIP           */
+	uint32_t id;               /* 32: The 'mhartid' of this hart                                  */
+	uint32_t current;          /* 36: Index into the 'thread_table' of the running thread         */
+	uint32_t idle_thread;      /* 40: Thread run when the run queue is empty (NTHREADS if none)   */
+	volatile uint32_t present; /* 44: Set by bootstrap.s when the hart comes out of reset         */
+	volatile uint32_t online;  /* 48: Set once the hart has loaded its first thread               */
+	uint32_t holds_bkl;        /* 52: Whether this hart currently owns the big kernel lock        */
+	uint32_t zombie;           /* 56: Zombie to free after the next switch (NTHREADS if none)     */
+	uint32_t fpu_owner;        /* 60: Thread whose FP state is in this hart's registers (fpu=1)   */
+} hart_t;
+
+_Static_assert(sizeof(hart_t) == HART_SIZE, "hart_t must match HART_SIZE");
+
+extern hart_t harts[];
+extern volatile uint32_t hart_release;   /*  Secondary harts leave bootstrap.s once this is set  */
+
+static inline hart_t* this_hart(void) { hart_t* h; asm volatile("mv %0, tp" : "=r"(h)); return h; }
+
+/*  SMP related prototypes  */
+void smp_boot(void);
+void secondary_start(uint32_t);
+void send_ipi(uint32_t);
+void kick_hart(uint32_t);
+void kernel_enter(uint64_t*);
+void kernel_exit(uint64_t*);
+
+#endif
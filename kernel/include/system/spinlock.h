@@ -0,0 +1,44 @@
+#ifndef H_SPINLOCK
+#define H_SPINLOCK
+
+#include <barelib.h>
+
+#define SSTATUS_SIE_BIT (1UL << 1)
+
+/*  Ticket lock.  Each hart takes the next ticket and spins until 'owner' reaches it,  *
+ *  so the lock is handed out in the order it was asked for.                           */
+typedef struct {
+  uint32_t next;    /*  Next ticket to hand out           */
+  uint32_t owner;   /*  Ticket that currently holds it    */
+} spinlock_t;
+
+#define SPINLOCK_INIT { .next = 0, .owner = 0 }
+
+/*  MCS queue lock.  Each waiter brings its own 'mcs_node_t' and spins on its own  *
+ *  'locked' flag, so a handoff only touches the cache line of the next waiter.    *
+ *  The node must stay valid until the matching unlock.                            */
+typedef struct _mcs_node {
+  struct _mcs_node* volatile next;  /*  Waiter queued behind this one         */
+  volatile uint32_t locked;         /*  Cleared by the holder on handoff      */
+} mcs_node_t;
+
+typedef struct {
+  mcs_node_t* tail;                 /*  Last waiter, NULL if the lock is free  */
+} mcs_lock_t;
+
+/*  Masks Supervisor interrupts on this hart and returns whether they were enabled  */
+static inline uint64_t irq_save(void) { uint64_t x; asm volatile("csrrc %0, sstatus, %1" : "=r"(x) : "r"(SSTATUS_SIE_BIT) : "memory"); return x & SSTATUS_SIE_BIT; }
+static inline void irq_restore(uint64_t sie) { asm volatile("csrs sstatus, %0" :: "r"(sie) : "memory"); }
+
+/*  Lock related prototypes  */
+void spin_init(spinlock_t*);
+void spin_lock(spinlock_t*);
+void spin_unlock(spinlock_t*);
+uint64_t spin_lock_irqsave(spinlock_t*);
+void spin_unlock_irqrestore(spinlock_t*, uint64_t);
+void mcs_lock(mcs_lock_t*, mcs_node_t*);
+void mcs_unlock(mcs_lock_t*, mcs_node_t*);
+uint64_t mcs_lock_irqsave(mcs_lock_t*, mcs_node_t*);
+void mcs_unlock_irqrestore(mcs_lock_t*, mcs_node_t*, uint64_t);
+
+#endif
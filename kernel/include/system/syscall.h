@@ -2,12 +2,45 @@
 #define H_SYSCALL
 
 #include <barelib.h>
+#include <system/workqueue.h>
 #include <dev/ecall.h>
 
 typedef enum { RESCHED, TICK } syscall_signum;
 
+#define FAST_ECALL_FIRST 113   /*  Ecall numbers 'fast_ecall_table' covers, duplicated in interrupts.s  */
+#define FAST_ECALL_COUNT 64
+
+/*  Fast ecalls are taken straight from the trap entry without a trapframe or the kernel lock  */
+typedef uint64_t (*fast_ecall_t)(uint64_t);
+extern fast_ecall_t const fast_ecall_table[];
+
 int32_t raise_syscall(uint64_t);          /*  Ask the operating system to run a low level system function  */
 extern void pend_resched(uint64_t);
-uint32_t handle_device_ecall(ecall_number, uint32_t, byte*);
+
+#define NR_ECALLS 427   /*  One past the highest ecall number in 'ecall_number'  */
+
+/*  Ecall handlers take up to six arguments from a0..a5 (see 'ecall_table' in syscall.c)  */
+typedef uint64_t (*ecall_fn_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+#define ECALL_WORKERS 2          /*  Threads serving 'ecall_wq', so one sleeping on the console doesn't stall the rest  */
+extern workqueue_t ecall_wq;     /*  Runs exec and the filesystem ecalls outside of the trap (see syscall.c)           */
+
+/*  File, console and RTC ecalls (see system/device.c)  */
+uint64_t handle_ecall_tty_write(uint64_t, uint64_t);
+uint64_t handle_ecall_tty_read(uint64_t, uint64_t);
+uint64_t handle_ecall_create(uint64_t);
+uint64_t handle_ecall_open(uint64_t);
+uint64_t handle_ecall_close(uint64_t);
+uint64_t handle_ecall_read(uint64_t, uint64_t, uint64_t);
+uint64_t handle_ecall_write(uint64_t, uint64_t, uint64_t);
+uint64_t handle_ecall_fstat(uint64_t, uint64_t);
+uint64_t handle_ecall_unlink(uint64_t);
+uint64_t handle_ecall_mkdir(uint64_t, uint64_t);
+uint64_t handle_ecall_rmdir(uint64_t);
+uint64_t handle_ecall_readdir(uint64_t, uint64_t, uint64_t);
+uint64_t handle_ecall_getdir(uint64_t, uint64_t, uint64_t);
+uint64_t handle_ecall_rtc_read(void);
+uint64_t handle_ecall_gettz(uint64_t);
+uint64_t handle_ecall_settz(uint64_t);
 
 #endif
@@ -2,6 +2,10 @@
 #define H_THREAD
 
 #include <system/semaphore.h>
+#include <system/waitqueue.h>
+#include <system/smp.h>
+#include <system/workqueue.h>
+#include <system/fpu.h>
 #include <fs/fs.h>
 #include <barelib.h>
 
@@ -12,6 +16,17 @@ typedef enum {
 
 #define NTHREADS 20    /*  Maximum number of running threads  */
 
+#define PRIO_HIGHEST  0    /*  Priorities index the scheduler's weight table (see thread/sched.c).  */
+#define PRIO_DEFAULT  20   /*  A thread at PRIO_DEFAULT has weight NICE_0_WEIGHT; each step away    */
+#define PRIO_LOWEST   39   /*  from it changes the share of CPU time it receives by roughly 10%.   */
+#define NICE_0_WEIGHT 1024
+
+#define THREAD_NAME_LEN 16   /*  Including the null terminator, longer names are cut short  */
+
+#define USTACK_SIZE   0x10000UL      /*  Stack of each thread 'clone_thread' adds to an address space      */
+#define USTACK_SLOTS  8              /*  Slot 0 is the main stack at the top of the second user megapage,  */
+#define USTACK_CLONE_BASE 0x410000UL /*  the others are mapped from here up (see 'clone_stack_top')        */
+
 #define THM_RUNNABLE  0x1  /*  These macros are not intended for  direct use.  Instead they  */
 #define THM_QUEUED    0x2  /*  represent features a thread  may have and are combined below  */
 #define THM_PAUSED    0x4  /*  to represent full states a thread  may be in.  They may also  */
@@ -46,46 +61,88 @@ typedef struct {
 	uint64_t sepc, sstatus;
 } trapframe;
 
+/*  CPU accounting kept for every thread.  Times are in 'time' ticks (see RDTIME_HZ).    */
+typedef struct {
+	uint64_t utime;      /* Time spent running in user mode                              */
+	uint64_t stime;      /* Time spent running in supervisor mode, traps included         */
+	uint64_t wait_time;  /* Time spent blocked on semaphores                              */
+	uint64_t mark;       /* When the thread was last charged while running                */
+	uint64_t wait_start; /* When the thread last blocked on a semaphore                   */
+	uint32_t nvcsw;      /* Switches away because the thread blocked, slept or exited     */
+	uint32_t nivcsw;     /* Switches away because the thread was preempted                */
+	uint32_t faults;     /* Page faults taken                                             */
+} acct_t;
+
 /*  Each thread has a corresponding 'thread_t' record in the 'thread_table' (see system/create.c)  */
 /*  These entries contain information about the thread                                             */
 typedef struct {
 	uint64_t* stackptr; /* A pointer to the highest stack address for the thread                   */
 	uint64_t root_ppn;  /* Physical page number of this thread's root page                         */
-	uint32_t priority;  /* Thread priority (0=highest MAX_UINT32=lowest)                           */
+	uint32_t priority;  /* Thread priority (PRIO_HIGHEST=0 through PRIO_LOWEST=39)                 */
+	uint64_t vruntime;  /* Weighted CPU time consumed, in timer ticks. Run queues are keyed on this */
+	uint64_t exec_start;/* Value of 'time' when the thread was last switched in                    */
 	uint32_t parent;    /* The index into the 'thread_table' of the thread's parent                */
+	uint32_t hart;      /* The hart whose run queue the thread belongs to                          */
 	uint16_t asid;      /* Address space identifier for this thread. For now, it's just the ID     */
 	uint8_t state;      /* The current state of the thread                                         */
 	uint8_t retval;     /* The return value of the function (only valid when state == TH_DEFUNCT)  */
-	semaphore_t sem;    /* Semaphore for the current thread                                        */
+	wait_queue_t exit_wq;  /* Threads in 'join_thread' waiting for this one to finish              */
+	wait_queue_t child_wq; /* Woken each time one of the thread's children finishes                */
 	byte* kstack_base;  /* Kernel VA, bottom of stack                                              */
 	byte* kstack_top;   /* Kernel VA, top of stack                                                 */
 	trapframe* tf;      /* Pointer to trapframe living in kstack                                   */
 	context* ctx;       /* Pointer to context living in kstack                                     */
 	thread_mode mode;   /* Determines whether a thread is running in supervisor or user mode       */
+	uint8_t ustack;     /* User stack slot in its address space, 0 is the process' main stack     */
+	wait_queue_t* wq;   /* Wait queue the thread is on, NULL if none (see sync/waitqueue.c)        */
+	uint64_t wq_seq;    /* Arrival order on 'wq'                                                   */
+	uint64_t wake_at;   /* 'time' at which the timer ends the thread's wait, 0 if not timed        */
+	semaphore_t wq_sem; /* What the thread sleeps on while on a wait queue                         */
+	acct_t acct;        /* CPU accounting, updated at traps and switches                           */
+	char name[THREAD_NAME_LEN]; /* Program name for user threads, a short label for kernel ones    */
+#ifdef BAREOS_FPU
+	fpu_t fpu;          /* FP registers, only up to date while the thread is switched out          */
+#endif
 	dirent_t cwd;       /* Holds the process current working directory                             */
+	fdtable_t* files;   /* Open files of the process, shared by its threads (NULL until needed)    */
+	uint32_t acting_for; /* Thread whose ecall an 'ecall_wq' worker is serving, otherwise itself    */
 } thread_t;
 
 extern thread_t thread_table[];
-extern uint32_t current_thread;    /*  The currently running thread  */
+#define current_thread (this_hart()->current)  /*  The thread running on this hart  */
+#define caller_thread  (thread_table[current_thread].acting_for)  /*  The thread the running code works for  */
 extern queue_t sleep_list;
-extern semaphore_t reaper_sem; /* Global reaper sem zombie threads can post to */
 
 /*  Thread related prototypes  */
 void init_threads(void);
 int32_t create_thread(void*, thread_mode);
+int32_t clone_thread(uint64_t, uint64_t, uint64_t);
 int32_t join_thread(uint32_t);
+int32_t wait_child(int32_t, uint8_t*, bool);
 int32_t kill_thread(uint32_t);
 int32_t suspend_thread(uint32_t);
 int32_t resume_thread(uint32_t);
 int32_t sleep_thread(uint32_t, uint32_t);
 int32_t unsleep_thread(uint32_t);
+int32_t set_priority(uint32_t, uint32_t);
+void set_thread_name(uint32_t, const char*);
+void sleep_current(uint32_t);
+void expire_timers(void);
+void charge_time(thread_t*, bool);
+uint32_t select_hart(uint32_t);
+void balance_load(void);
 void user_thread_exit(trapframe* tf);
 
 void resched(void*);
-void reaper(void);
+void finish_switch(void);
 
 void context_switch(thread_t*, thread_t*);
+#ifdef BAREOS_FPU
+void fpu_switch(thread_t*, thread_t*);
+bool fpu_first_use(trapframe*);
+#endif
 void context_load(thread_t*, uint32_t);
+void use_address_space(uint64_t, uint16_t);
 extern void trapret(trapframe*);
 extern void ctxsw(context*, context*, uint64_t, uint64_t);
 extern void ctxload(uint64_t, uint64_t);
@@ -0,0 +1,53 @@
+#ifndef H_WAITQUEUE
+#define H_WAITQUEUE
+
+#include <system/spinlock.h>
+#include <barelib.h>
+
+/*  A 'wait_queue_t' holds the threads waiting for some condition to become true (see  *
+ *  sync/waitqueue.c).  Waiters are kept as a bitmask of thread ids and woken in the   *
+ *  order they arrived.  An all zero queue is empty and ready to use.                  */
+typedef struct {
+  spinlock_t lock;      /*  Taken with interrupts off, queues are woken from trap context  */
+  uint32_t waiters;     /*  Bit 'i' is set while thread 'i' is on the queue                 */
+  uint64_t seq;         /*  Arrival counter, orders the waiters for 'wake_up_one'           */
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { .lock = SPINLOCK_INIT, .waiters = 0, .seq = 0 }
+
+/*  Sleeps until 'cond' is true.  The thread is queued before 'cond' is checked again,  *
+ *  so a wake between the check and the sleep is never lost.  'cond' may be evaluated   *
+ *  any number of times and wakes can be spurious, so it must not have side effects.   */
+#define wait_event(wq, cond) do {      \
+  while (!(cond)) {                    \
+    prepare_wait((wq), 0);             \
+    if (!(cond)) wait_sleep();         \
+    finish_wait(wq);                   \
+  }                                    \
+} while (0)
+
+/*  Like 'wait_event', giving up once 'ms' milliseconds have passed.  Evaluates to  *
+ *  'cond', so a false result means the wait timed out.                            */
+#define wait_event_timeout(wq, cond, ms) ({                       \
+  uint64_t wq_deadline_ = wait_deadline(ms);                      \
+  while (!(cond) && !wait_expired(wq_deadline_)) {                \
+    prepare_wait((wq), wq_deadline_);                             \
+    if (!(cond)) wait_sleep();                                    \
+    finish_wait(wq);                                              \
+  }                                                               \
+  (cond);                                                         \
+})
+
+/*  Wait queue related prototypes  */
+void init_wait_queue(wait_queue_t*);
+void prepare_wait(wait_queue_t*, uint64_t);
+void wait_sleep(void);
+void finish_wait(wait_queue_t*);
+uint32_t wake_up_one(wait_queue_t*);
+uint32_t wake_up_all(wait_queue_t*);
+void wait_expire(uint32_t);
+void wait_remove(uint32_t);
+uint64_t wait_deadline(uint32_t);
+bool wait_expired(uint64_t);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef H_WORKQUEUE
+#define H_WORKQUEUE
+
+#include <system/semaphore.h>
+#include <barelib.h>
+
+/*  A 'work_t' is a deferred function call.  It is embedded in whatever structure  *
+ *  owns the work and handed to 'queue_work' or 'queue_bottom_half'.  The same item  *
+ *  is never queued twice: queueing it again while it is pending does nothing.      */
+typedef struct _work {
+  void (*func)(struct _work*);  /*  Called with the item itself once the work is run         */
+  struct _work* next;           /*  Link in the workqueue or bottom half list                */
+  volatile uint32_t pending;    /*  Set while queued, cleared just before 'func' is called   */
+} work_t;
+
+/*  Work queued on a 'workqueue_t' is run in order by its worker threads, which  *
+ *  are ordinary kernel threads and so may block (see system/workqueue.c).       */
+typedef struct {
+  work_t* head;         /*  Next item to run                        */
+  work_t* tail;         /*  Last item queued                        */
+  spinlock_t lock;      /*  Protects the list                       */
+  semaphore_t sem;      /*  Counts the items waiting to be run      */
+} workqueue_t;
+
+#define WORK_INIT(fn) { .func = (fn), .next = NULL, .pending = 0 }
+
+extern workqueue_t system_wq;   /*  Shared queue for kernel housekeeping  */
+
+/*  Workqueue related prototypes  */
+void init_work(work_t*, void (*)(work_t*));
+void init_workqueue(workqueue_t*, uint32_t);
+bool queue_work(workqueue_t*, work_t*);
+bool queue_bottom_half(work_t*);
+void run_bottom_halves(void);
+
+#endif
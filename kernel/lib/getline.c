@@ -40,6 +40,7 @@ char* autocomplete(char* line) {
 	uint32_t plen = (uint32_t)strlen(partial);
 
 	dir_iter_t it;
+	in_rlock(parent.inode);
 	dir_open(parent.inode, &it);
 	dirent_t child;
 	while (dir_next(&it, &child) == 1) {
@@ -56,6 +57,7 @@ char* autocomplete(char* line) {
 			break;
 		}
 	}
+	in_runlock(parent.inode);
 	char* new_end = line;
 	while (*new_end) ++new_end;
 	return new_end;
@@ -2,8 +2,10 @@
 #include <mm/malloc.h>
 #include <system/thread.h>
 #include <system/panic.h>
+#include <system/spinlock.h>
 #include <system/memlayout.h>
 #include <util/string.h>
+#include <dev/time.h>
 #include <barelib.h>
 
 #define FREEMASK_RANGE ((uint64_t)ALIGN_UP_2M(&mem_end - &text_start))
@@ -11,6 +13,17 @@
 #define FREEMASK_SZ ((uint64_t)((FREEMASK_BITS + 7) / 8))
 #define PPN_TO_IDX(ppn) (ppn - ((uint64_t)&text_start >> PAGE_SHIFT))
 #define IDX_TO_PPN(idx) (idx + ((uint64_t)&text_start >> PAGE_SHIFT))
+#define MEGAPAGE_SIZE 0x200000UL
+#define ASPACE_CACHE 4               /*  Prebuilt user address spaces kept warm for spawning  */
+
+/*  Everything 'alloc_page' hands a thread: a root table with the kernel half attached,  *
+ *  the two user megapages mapped at 0x0 and 0x200000 and a two page kernel stack.       */
+typedef struct {
+	uint64_t root_ppn;
+	uint64_t leaf_ppn[2];
+	byte* kstack_base;
+	byte* kstack_top;
+} aspace_t;
 
 static inline uint64_t va_vpn2(uint64_t va) { return (va >> 30) & 0x1ff; }
 static inline uint64_t va_vpn1(uint64_t va) { return (va >> 21) & 0x1ff; }
@@ -18,9 +31,15 @@ static inline uint64_t va_vpn0(uint64_t va) { return (va >> 12) & 0x1ff; }
 
 byte* page_freemask;
 uint64_t kernel_root_ppn;
+uint64_t vdso_ppn;
 byte* s_trap_top;
 volatile uint8_t MMU_ENABLED;
 
+static aspace_t aspace_cache[ASPACE_CACHE];  /*  Zeroed address spaces ready for 'alloc_user_page'  */
+static uint32_t aspace_count;
+static void refill_aspaces(work_t*);
+static work_t aspace_work = WORK_INIT(&refill_aspaces);
+
 //
 // Bitmask operators
 //
@@ -30,12 +49,11 @@ static void pfm_set(uint64_t ppn) {
 	page_freemask[x / 8] |= 0x1 << (x % 8);
 }
 
-/* Unused for now, removed bc -Wall -Werror */
-// /* Returns whether a ppn is used (1) or free (0) */
-// static uint8_t pfm_get(uint64_t ppn) {
-// 	uint64_t x = PPN_TO_IDX(ppn);
-// 	return (page_freemask[x / 8] >> (x % 8)) & 0x1;
-// }
+/* Returns whether a ppn is used (1) or free (0) */
+static uint8_t pfm_get(uint64_t ppn) {
+	uint64_t x = PPN_TO_IDX(ppn);
+	return (page_freemask[x / 8] >> (x % 8)) & 0x1;
+}
 
 /* Sets a ppn as unused */
 static void pfm_clear(uint64_t ppn) {
@@ -57,6 +75,15 @@ static int64_t pfm_findfree_4k(void) {
 	return NULL;
 }
 
+/* Returns the first of two consecutive free pages, NULL if there are none */
+static int64_t pfm_findfree_4k_pair(void) {
+	for (uint64_t i = 0; i + 1 < FREEMASK_SZ * 8; ++i) {
+		if (!pfm_get(IDX_TO_PPN(i)) && !pfm_get(IDX_TO_PPN(i + 1)))
+			return IDX_TO_PPN(i);
+	}
+	return NULL;
+}
+
 /* Returns a free megapage ppn */
 static int64_t pfm_findfree_2m(void) {
 	uint8_t chunksz = 64;
@@ -146,21 +173,21 @@ static void map_2m(uint64_t root_l2_ppn, uint64_t virt_addr, uint64_t page_addr,
 	l1_page[idx] = make_leaf(PA_TO_PPN(page_addr), R, W, X, G, U);
 }
 
-///* Maps a regular 4K page assuming you already have it */
-//static void map_4k(uint64_t root_l2_ppn, uint64_t virt_addr, uint64_t page_addr,
-//	bool R, bool W, bool X, bool G, bool U) {
-//	pte_t* l1_page = ensure_l1(root_l2_ppn, virt_addr);
-//	uint64_t l1_idx = va_vpn1(virt_addr);
-//	if (!l1_page[l1_idx].v) {
-//		uint64_t l0_ppn = pfm_findfree_4k(); 
-//		pfm_set(l0_ppn); 
-//		clean_page(l0_ppn);
-//		l1_page[l1_idx] = make_nonleaf(l0_ppn);
-//	}
-//	pte_t* l0 = (pte_t*)PPN_TO_KVA(l1_page[l1_idx].ppn);
-//	uint64_t i0 = va_vpn0(virt_addr);
-//	l0[i0] = make_leaf(PA_TO_PPN(page_addr), R, W, X, G, U);
-//}
+/* Maps a regular 4K page assuming you already have it */
+static void map_4k(uint64_t root_l2_ppn, uint64_t virt_addr, uint64_t page_addr,
+	bool R, bool W, bool X, bool G, bool U) {
+	pte_t* l1_page = ensure_l1(root_l2_ppn, virt_addr);
+	uint64_t l1_idx = va_vpn1(virt_addr);
+	if (!l1_page[l1_idx].v) {
+		uint64_t l0_ppn = pfm_findfree_4k();
+		pfm_set(l0_ppn);
+		clean_page(l0_ppn);
+		l1_page[l1_idx] = make_nonleaf(l0_ppn);
+	}
+	pte_t* l0 = (pte_t*)PPN_TO_KVA(l1_page[l1_idx].ppn);
+	uint64_t i0 = va_vpn0(virt_addr);
+	l0[i0] = make_leaf(PA_TO_PPN(page_addr), R, W, X, G, U);
+}
 
 static void clone_page_tables(uint64_t dst_ppn, uint64_t src_ppn, uint8_t level) {
 	byte* dst = (byte*)PPN_TO_KVA(dst_ppn);
@@ -199,6 +226,7 @@ static void free_l0(uint64_t l0_ppn) {
 		if (l0[i].g && (l0[i].r || l0[i].w || l0[i].x)) {
 			continue;
 		}
+		if (l0[i].ppn == vdso_ppn) continue; /* The time page is shared by every process */
 		pfm_clear(l0[i].ppn);
 	}
 	pfm_clear(l0_ppn);
@@ -268,6 +296,14 @@ void init_pages(void) {
 	clean_page(s_trap_ppn);
 	s_trap_top = (byte*)(PPN_TO_PA(s_trap_ppn) + PAGE_SIZE); /* For use by the trap handler */
 
+	/* Get the time page every address space maps read-only (see 'build_aspace') */
+	vdso_ppn = pfm_findfree_4k();
+	if (vdso_ppn == NULL) {
+		panic("Couldn't find a free page for the time page, cannot init pages.\n");
+	}
+	pfm_set(vdso_ppn);
+	clean_page(vdso_ppn);
+
 	/* Map kernel-heap to kernel root */
 	for (uint64_t i = 0; i < 8; ++i) {
 		uint64_t hva = k_virt_addr + 0x200000UL * (i + 1);
@@ -285,44 +321,123 @@ void init_pages(void) {
 	l2[va_vpn2(mmio_va1)] = make_leaf(PA_TO_PPN(0x40000000UL), /*R*/1,/*W*/1,/*X*/0,/*G*/1,/*U*/0);
 }
 
-/* Rudimentary page allocator, allocates a static number of pages and returns  *
- * the root ppn of the newly allocated pages.                                  *
+/* Gets two consecutive zeroed pages for a kernel stack.  Returns false if no two free  *
+ * pages are next to each other.                                                       */
+static bool build_kstack(byte** base, byte** top) {
+	int64_t kleaf = pfm_findfree_4k_pair();
+	if (kleaf == NULL) return false;
+	int64_t kleaf2 = kleaf + 1;
+	pfm_set(kleaf);
+	pfm_set(kleaf2);
+	clean_page(kleaf);
+	clean_page(kleaf2);
+	/* Manual instead of to-KVA func because this is called once before MMU enabled */
+	*base = (byte*)PPN_TO_KVA(kleaf);
+	*top = (byte*)(PPN_TO_KVA(kleaf2) + PAGE_SIZE);
+	return true;
+}
+
+static void free_kstack(byte* base) {
+	pfm_clear(KVA_TO_PPN(base));
+	pfm_clear(KVA_TO_PPN(base + PAGE_SIZE));
+}
+
+/* Builds an address space without zeroing the user megapages.                *
  * Implicitly enforces alignment... for now. Need MVP, will worry later        *
  * Only allocs for processes which are given 4MiB of RAM to work with, for now */
-uint64_t alloc_page(uint32_t thread_id) {
-	if (thread_id > NTHREADS) return NULL;
-	int64_t leaf_ppn;
-	int64_t root_ppn = NULL;
+static void build_aspace(aspace_t* as) {
 	/* Get root */
-	root_ppn = pfm_findfree_4k();
+	int64_t root_ppn = pfm_findfree_4k();
 	pfm_set(root_ppn); clone_kernel_map(root_ppn);
 	/* Get leaves */
-	leaf_ppn = pfm_findfree_2m();
+	int64_t leaf_ppn = pfm_findfree_2m();
 	set_megapage(leaf_ppn);
 	int64_t leaf2_ppn = pfm_findfree_2m();
 	set_megapage(leaf2_ppn);
 	/* Map leaves to root */
 	map_2m(root_ppn, 0x0UL, (uint64_t)PPN_TO_PA(leaf_ppn), /*R*/1,/*W*/1,/*X*/1,/*G*/0,/*U*/1);
 	map_2m(root_ppn, 0x200000UL, (uint64_t)PPN_TO_PA(leaf2_ppn), /*R*/1,/*W*/1,/*X*/0,/*G*/0,/*U*/1);
-	/* Get kstack. Assures leaves are consecutive in lieu of atomic operations */
-	int64_t kleaf, kleaf2;
-	while (1) {
-		kleaf = pfm_findfree_4k();
-		pfm_set(kleaf);
-		kleaf2 = pfm_findfree_4k();
-		pfm_set(kleaf2);
-		if (PPN_TO_PA(kleaf) + PAGE_SIZE != PPN_TO_PA(kleaf2)) {
-			pfm_clear(kleaf);
-			pfm_clear(kleaf2);
+	/* The time page is shared, 'free_l0' knows not to free it with the process.  It is   *
+	 * not global: it sits at a user address, and global entries would outlive an ASID.  */
+	map_4k(root_ppn, VDSO_TIME_VA, PPN_TO_PA(vdso_ppn), /*R*/1,/*W*/0,/*X*/0,/*G*/0,/*U*/1);
+	if (!build_kstack(&as->kstack_base, &as->kstack_top))
+		panic("No two consecutive free pages left for a kernel stack.\n");
+	as->root_ppn = root_ppn;
+	as->leaf_ppn[0] = leaf_ppn;
+	as->leaf_ppn[1] = leaf2_ppn;
+}
+
+static void zero_aspace(const aspace_t* as) {
+	memset(PPN_TO_KVA(as->leaf_ppn[0]), 0, MEGAPAGE_SIZE);
+	memset(PPN_TO_KVA(as->leaf_ppn[1]), 0, MEGAPAGE_SIZE);
+}
+
+static uint64_t give_aspace(uint32_t thread_id, const aspace_t* as) {
+	thread_table[thread_id].kstack_base = as->kstack_base;
+	thread_table[thread_id].kstack_top = as->kstack_top;
+	return as->root_ppn;
+}
+
+/* Rudimentary page allocator, allocates a static number of pages and returns  *
+ * the root ppn of the newly allocated pages.  The user pages are not zeroed,  *
+ * use 'alloc_user_page' for processes.                                        */
+uint64_t alloc_page(uint32_t thread_id) {
+	if (thread_id > NTHREADS) return NULL;
+	aspace_t as;
+	build_aspace(&as);
+	return give_aspace(thread_id, &as);
+}
+
+/* Like 'alloc_page', but the user pages are zeroed.  Takes a prebuilt address    *
+ * space from the cache when one is ready, which keeps building and zeroing 4MiB  *
+ * off the spawn path, and queues a refill on the 'system_wq'.                    */
+uint64_t alloc_user_page(uint32_t thread_id) {
+	if (thread_id > NTHREADS) return NULL;
+	aspace_t as;
+	uint64_t sie = irq_save();
+	bool cached = aspace_count > 0;
+	if (cached) as = aspace_cache[--aspace_count];
+	else build_aspace(&as);
+	irq_restore(sie);
+	if (!cached) zero_aspace(&as);
+	queue_work(&system_wq, &aspace_work);
+	return give_aspace(thread_id, &as);
+}
+
+/* Tops the address space cache back up.  Runs on the 'system_wq' with interrupts  *
+ * enabled, so only the page bookkeeping is done with them off.                    */
+static void refill_aspaces(work_t* work) {
+	while (aspace_count < ASPACE_CACHE) {
+		aspace_t as;
+		uint64_t sie = irq_save();
+		build_aspace(&as);
+		irq_restore(sie);
+		zero_aspace(&as);
+
+		sie = irq_save();
+		bool kept = aspace_count < ASPACE_CACHE;
+		if (kept) aspace_cache[aspace_count++] = as;
+		else { /* Filled by another worker in the meantime */
+			free_kstack(as.kstack_base);
+			free_pages(as.root_ppn);
 		}
-		else break;
+		irq_restore(sie);
+		if (!kept) break;
 	}
-	clean_page(kleaf);
-	clean_page(kleaf2);
-	/* Manual instead of to-KVA func because this is called once before MMU enabled */
-	thread_table[thread_id].kstack_base = (byte*)PPN_TO_KVA(kleaf); 
-	thread_table[thread_id].kstack_top = (byte*)(PPN_TO_KVA(kleaf2) + PAGE_SIZE);
-	return root_ppn;
+}
+
+/* Gives a thread that shares another's address space a kernel stack of its own.  *
+ * Returns -1 if there are no pages left for it.                                  */
+int32_t alloc_kstack(uint32_t thread_id) {
+	uint64_t sie = irq_save();
+	bool built = build_kstack(&thread_table[thread_id].kstack_base, &thread_table[thread_id].kstack_top);
+	irq_restore(sie);
+	return built ? 0 : -1;
+}
+
+/* Fills the address space cache in the background. Needs the 'system_wq' running. */
+void warm_aspace_cache(void) {
+	queue_work(&system_wq, &aspace_work);
 }
 
 /* Rudimentary page clearer. Should be able to free all children of a root page. */
@@ -342,12 +457,32 @@ void free_pages(uint64_t root_ppn) {
 	pfm_clear(root_ppn);
 }
 
+/* Frees a thread's kernel stack, and its address space unless another thread still shares it */
 void free_process_pages(uint32_t thread_id) {
-	uint64_t k1 = KVA_TO_PPN(thread_table[thread_id].kstack_base);
-	pfm_clear(k1);
-	uint64_t k2 = KVA_TO_PPN(thread_table[thread_id].kstack_base + PAGE_SIZE);
-	pfm_clear(k2);
-	free_pages(thread_table[thread_id].root_ppn);
+	free_kstack(thread_table[thread_id].kstack_base);
+	uint64_t root_ppn = thread_table[thread_id].root_ppn;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (i != thread_id && thread_table[i].root_ppn == root_ppn) return;
+	}
+	free_pages(root_ppn);
+}
+
+/* Maps a zeroed 4K page readable and writable by user mode at 'va', which must be   *
+ * page aligned and outside the two user megapages.  Freed with the address space.  */
+int32_t map_user_page(uint64_t root_ppn, uint64_t va) {
+	if (root_ppn == NULL || root_ppn == kernel_root_ppn) return -1;
+	uint64_t sie = irq_save();
+	int64_t ppn = pfm_findfree_4k();
+	if (ppn != NULL) pfm_set(ppn);
+	irq_restore(sie);
+	if (ppn == NULL) return -1;
+	clean_page(ppn);
+
+	sie = irq_save();
+	map_4k(root_ppn, va, PPN_TO_PA(ppn), /*R*/1,/*W*/1,/*X*/0,/*G*/0,/*U*/1);
+	irq_restore(sie);
+	asm volatile("sfence.vma %0, x0" :: "r"(va) : "memory");
+	return 0;
 }
 
 /* Helper function finds the KVA that correlates to a user virtual address */
@@ -0,0 +1,68 @@
+#include <system/futex.h>
+#include <system/thread.h>
+#include <mm/vm.h>
+#include <barelib.h>
+
+/*
+ *  Futexes let user programs sleep until a word of their memory changes.  The
+ *  program does its fast path with atomics on the word and only makes the
+ *  futex ecall when it has to wait or when someone may be waiting.
+ *
+ *  Both calls run in ecall context under the kernel lock, so checking the word
+ *  and queueing on its semaphore cannot race with a wake from another hart.
+ */
+
+static futex_t futex_table[FUTEX_SLOTS];
+
+/*  Finds the entry for a physical address, taking a free one if 'create' is set.  *
+ *  Every slot is probed since freed entries may sit in the middle of a chain.     */
+static futex_t* lookup(uint64_t pa, bool create) {
+	uint32_t start = (uint32_t)((pa >> 2) % FUTEX_SLOTS);
+	futex_t* free_entry = NULL;
+	for (uint32_t i = 0; i < FUTEX_SLOTS; ++i) {
+		futex_t* f = &futex_table[(start + i) % FUTEX_SLOTS];
+		if (f->pa == pa) return f;
+		if (f->pa == 0 && free_entry == NULL) free_entry = f;
+	}
+	if (!create || free_entry == NULL) return NULL;
+	free_entry->pa = pa;
+	free_entry->waiters = 0;
+	free_entry->sem = create_sem(0);
+	return free_entry;
+}
+
+/*  Resolves a user address of the current thread to its kernel alias.  Futex  *
+ *  words must be 4-byte aligned.                                               */
+static volatile uint32_t* futex_word(uint64_t uaddr) {
+	if (uaddr & 0x3) return NULL;
+	return (volatile uint32_t*)translate_user_address(thread_table[current_thread].root_ppn, uaddr);
+}
+
+/*  Sleeps if the word at 'uaddr' still holds 'expected'.  Returns 0 once woken,  *
+ *  or -1 straight away if the value had changed or the address is invalid.       */
+int32_t futex_wait(uint64_t uaddr, uint32_t expected) {
+	volatile uint32_t* word = futex_word(uaddr);
+	if (word == NULL || *word != expected) return -1;
+	futex_t* f = lookup((uint64_t)KVA_TO_PA(word), true);
+	if (f == NULL) return -1;
+	++f->waiters;
+	wait_sem(&f->sem);
+	return 0;
+}
+
+/*  Wakes up to 'count' threads waiting on the word at 'uaddr'.  Returns the  *
+ *  number woken, or -1 if the address is invalid.                            */
+int32_t futex_wake(uint64_t uaddr, uint32_t count) {
+	volatile uint32_t* word = futex_word(uaddr);
+	if (word == NULL) return -1;
+	futex_t* f = lookup((uint64_t)KVA_TO_PA(word), false);
+	if (f == NULL) return 0;
+	uint32_t woken = 0;
+	while (woken < count && f->waiters > 0) {
+		--f->waiters;
+		post_sem(&f->sem);
+		++woken;
+	}
+	if (f->waiters == 0) f->pa = 0;
+	return (int32_t)woken;
+}
@@ -0,0 +1,125 @@
+#include <system/lockstat.h>
+#include <system/thread.h>
+#include <util/string.h>
+#include <barelib.h>
+
+/*
+ *  Lock contention statistics, built with 'scons lockstat=1'.
+ *
+ *  Every spinlock, MCS lock, semaphore and wait queue gets an entry the first
+ *  time it is taken, keyed by its address and kind.  The entry counts how
+ *  often it was taken, how often that meant spinning or sleeping, and how long
+ *  each thread waited for it in 'time' ticks.
+ *
+ *  The hooks run inside the spinlocks themselves and from trap context, so
+ *  nothing here takes a lock: entries are claimed with a compare and swap and
+ *  the counters are updated with atomics.  Locks first taken after the table
+ *  is full are not counted.
+ */
+
+#ifdef BAREOS_LOCKSTAT
+
+#define LOCKSTAT_SLOTS 256
+
+typedef struct {
+	uint64_t key;                /*  Lock address with the kind in the low bits, 0 if free  */
+	const char* name;            /*  Set by 'lockstat_name', NULL until then                */
+	const void* site;            /*  Where the lock was first taken                         */
+	uint64_t acquired;
+	uint64_t contended;
+	uint64_t wait_total;
+	uint64_t wait_max;
+	uint64_t waited[NTHREADS];   /*  Time each thread spent waiting for it                  */
+} lockstat_t;
+
+static lockstat_t lockstat_table[LOCKSTAT_SLOTS];
+
+/*  Finds the entry of a lock, claiming a free slot for it on first use  */
+static lockstat_t* lookup(const void* lock, uint32_t kind) {
+	uint64_t key = (uint64_t)lock | kind;
+	uint32_t start = (uint32_t)((key >> 2) % LOCKSTAT_SLOTS);
+	for (uint32_t i = 0; i < LOCKSTAT_SLOTS; ++i) {
+		lockstat_t* e = &lockstat_table[(start + i) % LOCKSTAT_SLOTS];
+		uint64_t seen = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+		if (seen == key) return e;
+		if (seen != 0) continue;
+		if (__atomic_compare_exchange_n(&e->key, &seen, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return e;
+		if (seen == key) return e; /* Another hart claimed it for the same lock */
+	}
+	return NULL;
+}
+
+/*  Records one acquisition.  'start' is when the caller began to wait, only  *
+ *  used when 'contended' is set.                                             */
+void lockstat_acquire(const void* lock, uint32_t kind, const void* site, bool contended, uint64_t start) {
+	lockstat_t* e = lookup(lock, kind);
+	if (e == NULL) return;
+	if (e->site == NULL) e->site = site;
+	__atomic_fetch_add(&e->acquired, 1, __ATOMIC_RELAXED);
+	if (!contended) return;
+
+	uint64_t wait = lockstat_now() - start;
+	__atomic_fetch_add(&e->contended, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&e->wait_total, wait, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&e->wait_max, __ATOMIC_RELAXED);
+	while (wait > max && !__atomic_compare_exchange_n(&e->wait_max, &max, wait, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	uint32_t tid = current_thread;
+	if (tid < NTHREADS) __atomic_fetch_add(&e->waited[tid], wait, __ATOMIC_RELAXED);
+}
+
+/*  Gives a lock a name for the ECALL_LOCKSTAT output.  'name' must outlive the lock.  */
+void lockstat_name(const void* lock, uint32_t kind, const char* name) {
+	lockstat_t* e = lookup(lock, kind);
+	if (e != NULL) e->name = name;
+}
+
+/*  Reads a counter, zeroing it in the same step if 'reset' is set, so a hook  *
+ *  that adds to it meanwhile is either copied or kept, never lost.            */
+static uint64_t take(uint64_t* counter, bool reset) {
+	if (reset) return __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED);
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*  Copies up to 'max' entries into 'buf', zeroing their counters if 'reset' is  *
+ *  set, and returns how many were copied.                                      */
+uint32_t lockstat_copy(lock_stat_t* buf, uint32_t max, bool reset) {
+	static const char kinds[] = "SMWQ";
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < LOCKSTAT_SLOTS && count < max; ++i) {
+		lockstat_t* e = &lockstat_table[i];
+		uint64_t key = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+		if (key == 0) continue;
+
+		lock_stat_t* st = &buf[count++];
+		st->lock = key & ~0x3UL;
+		st->site = (uint64_t)e->site;
+		st->kind = kinds[key & 0x3];
+		memset(st->name, 0, LSTAT_NAME_LEN);
+		if (e->name != NULL) {
+			uint32_t len = strlen(e->name);
+			memcpy(st->name, e->name, len < LSTAT_NAME_LEN - 1 ? len : LSTAT_NAME_LEN - 1);
+		}
+		st->acquired = take(&e->acquired, reset);
+		st->contended = take(&e->contended, reset);
+		st->wait_total = take(&e->wait_total, reset);
+		st->wait_max = take(&e->wait_max, reset);
+		uint64_t waited[NTHREADS];
+		for (uint32_t j = 0; j < NTHREADS; ++j) waited[j] = take(&e->waited[j], reset);
+
+		/* Picks the longest waiters, selection is fine for this many threads */
+		bool taken[NTHREADS] = { 0 };
+		for (uint32_t t = 0; t < LSTAT_TOP; ++t) {
+			int32_t best = -1;
+			for (uint32_t j = 0; j < NTHREADS; ++j) {
+				if (taken[j] || waited[j] == 0) continue;
+				if (best < 0 || waited[j] > waited[best]) best = j;
+			}
+			st->top_tid[t] = best;
+			st->top_wait[t] = best < 0 ? 0 : waited[best];
+			if (best >= 0) taken[best] = true;
+		}
+	}
+	return count;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#include <system/rwlock.h>
+#include <barelib.h>
+
+/*
+ *  Reader-writer locks for kernel structures that are read far more often
+ *  than they are changed, like directories.
+ *
+ *  A thread that cannot get the lock sleeps on one of the lock's semaphores,
+ *  the only way the kernel lets a thread block.  The lock is never released
+ *  to be fought over: whoever unlocks it hands it to the waiters directly,
+ *  setting 'readers' for them before posting, so a woken thread already owns
+ *  it when 'wait_sem' returns.
+ *
+ *  New readers queue behind a waiting writer and a departing writer lets in
+ *  every reader that queued meanwhile, so neither side can starve the other.
+ */
+
+void rw_init(rwlock_t* rw) {
+	spin_init(&rw->lock);
+	rw->readers = 0;
+	rw->read_waiters = 0;
+	rw->write_waiters = 0;
+	rw->read_sem = create_sem(0);
+	rw->write_sem = create_sem(0);
+}
+
+void rw_read_lock(rwlock_t* rw) {
+	uint64_t sie = spin_lock_irqsave(&rw->lock);
+	if (rw->readers >= 0 && rw->write_waiters == 0) {
+		++rw->readers;
+		spin_unlock_irqrestore(&rw->lock, sie);
+		return;
+	}
+	++rw->read_waiters;
+	spin_unlock_irqrestore(&rw->lock, sie);
+	wait_sem(&rw->read_sem);
+}
+
+/*  The last reader out gives the lock to the first waiting writer  */
+void rw_read_unlock(rwlock_t* rw) {
+	uint64_t sie = spin_lock_irqsave(&rw->lock);
+	if (--rw->readers == 0 && rw->write_waiters > 0) {
+		--rw->write_waiters;
+		rw->readers = -1;
+		spin_unlock_irqrestore(&rw->lock, sie);
+		post_sem(&rw->write_sem);
+		return;
+	}
+	spin_unlock_irqrestore(&rw->lock, sie);
+}
+
+void rw_write_lock(rwlock_t* rw) {
+	uint64_t sie = spin_lock_irqsave(&rw->lock);
+	if (rw->readers == 0) {
+		rw->readers = -1;
+		spin_unlock_irqrestore(&rw->lock, sie);
+		return;
+	}
+	++rw->write_waiters;
+	spin_unlock_irqrestore(&rw->lock, sie);
+	wait_sem(&rw->write_sem);
+}
+
+/*  Waiting readers go first, then a waiting writer  */
+void rw_write_unlock(rwlock_t* rw) {
+	uint64_t sie = spin_lock_irqsave(&rw->lock);
+	uint32_t wake = rw->read_waiters;
+	if (wake > 0) {
+		rw->read_waiters = 0;
+		rw->readers = (int32_t)wake;
+	}
+	else if (rw->write_waiters > 0) {
+		--rw->write_waiters;
+		spin_unlock_irqrestore(&rw->lock, sie);
+		post_sem(&rw->write_sem);
+		return;
+	}
+	else {
+		rw->readers = 0;
+	}
+	spin_unlock_irqrestore(&rw->lock, sie);
+	while (wake-- > 0) post_sem(&rw->read_sem);
+}
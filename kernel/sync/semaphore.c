@@ -3,8 +3,8 @@
 #include <system/semaphore.h>
 #include <system/syscall.h>
 #include <system/thread.h>
-
-static uint32_t MUTEX_LOCK;
+#include <system/lockstat.h>
+#include <device/timer.h>
 
 /* This function is to avoid a possible pitfall involving
    threads with their own priorities being ordered wrongly
@@ -24,9 +24,14 @@ int32_t sem_enqueue(queue_t* queue, uint32_t threadid) {
 }
 
 /*
- *  All Semaphore operations should use a mutex to prevent another thread
- *  from modifying the  semaphore and corrupt the  struct due to a poorly 
- *  timed clock tick.
+ *  All Semaphore operations hold the semaphore's own lock to prevent another
+ *  hart or a poorly timed clock tick from modifying the semaphore and
+ *  corrupting the struct.  Semaphores are posted from trap context, so the
+ *  lock is taken with interrupts masked.
+ *
+ *  With lockstat=1 'wait_sem' reports whether it had to sleep and for how
+ *  long.  The semaphore a thread sleeps on inside a wait queue is skipped,
+ *  'wait_sleep' reports that wait against the queue instead.
  */
 
 /*  Creates a semaphore_t structure and  initializes it to base  *
@@ -34,6 +39,7 @@ int32_t sem_enqueue(queue_t* queue, uint32_t threadid) {
 semaphore_t create_sem(int32_t count) {
 	semaphore_t sem;
 	sem.state = S_USED;
+	spin_init(&sem.lock);
 	sem.queue.key = count;
 	sem.queue.qnext = sem.queue.qprev = NULL;
 	return sem;
@@ -41,9 +47,9 @@ semaphore_t create_sem(int32_t count) {
 
 /*  Marks a semaphore as free and release all waiting threads  */
 int32_t free_sem(semaphore_t* sem) {
-	lock_mutex(&MUTEX_LOCK);
+	uint64_t sie = spin_lock_irqsave(&sem->lock);
 	if(sem->state == S_FREE) {
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
 		return -1;
 	}
 	if(sem->queue.qnext != NULL) {
@@ -55,7 +61,7 @@ int32_t free_sem(semaphore_t* sem) {
 		}
 	}
 	sem->state = S_FREE;
-	release_mutex(&MUTEX_LOCK);
+	spin_unlock_irqrestore(&sem->lock, sie);
 	return 0;
 }
 
@@ -63,19 +69,23 @@ int32_t free_sem(semaphore_t* sem) {
  *  is less than 0, marks the thread as waiting and switches to another  *
  *  another thread.                                                      */
 int32_t wait_sem(semaphore_t* sem) {
-	lock_mutex(&MUTEX_LOCK);
+	uint64_t sie = spin_lock_irqsave(&sem->lock);
 	if(sem->state == S_FREE) {
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
 		return -1;
 	}
 	--sem->queue.key;
 	if(sem->queue.key >= 0) {
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
+#ifdef BAREOS_LOCKSTAT
+		if (sem != &thread_table[current_thread].wq_sem) lockstat_acquire(sem, LS_SEM, LOCKSTAT_SITE, false, 0);
+#endif
 		return 0;
 	}
 	thread_table[current_thread].state = TH_WAITING;
+	thread_table[current_thread].acct.wait_start = r_time();
 	sem_enqueue(&sem->queue, current_thread);
-	release_mutex(&MUTEX_LOCK);
+	spin_unlock_irqrestore(&sem->lock, sie);
 	//
 	// Policy violation call 
 	// Reason for violation: pend_resched causes thread execution to erroneously continue without waiting
@@ -87,24 +97,29 @@ int32_t wait_sem(semaphore_t* sem) {
 	//
 	//
 	//
+	thread_table[current_thread].acct.wait_time += r_time() - thread_table[current_thread].acct.wait_start;
+#ifdef BAREOS_LOCKSTAT
+	if (sem != &thread_table[current_thread].wq_sem)
+		lockstat_acquire(sem, LS_SEM, LOCKSTAT_SITE, true, thread_table[current_thread].acct.wait_start);
+#endif
 	return 0;
 }
 
 /*  Increments the given semaphore if it is in use.  Resume the next  *
  *  waiting thread (if any).                                          */
 int32_t post_sem(semaphore_t* sem) {
-	lock_mutex(&MUTEX_LOCK);
+	uint64_t sie = spin_lock_irqsave(&sem->lock);
 	if(sem->state == S_FREE) {
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
 		return -1;
 	}
 	++sem->queue.key;
 	if(sem->queue.key <= 0) {
 		int32_t threadid = dequeue_thread(&sem->queue);
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
 		resume_thread(threadid);
 	} else {
-		release_mutex(&MUTEX_LOCK);
+		spin_unlock_irqrestore(&sem->lock, sie);
 	}
 	return 0;
 }
@@ -0,0 +1,104 @@
+#include <system/spinlock.h>
+#include <system/lockstat.h>
+#include <barelib.h>
+
+/*
+ *  This file contains the kernel's spinning locks.
+ *
+ *  Ticket locks are the default.  They are a single word pair and hand the
+ *  lock out first come first served, so no hart can be starved by faster
+ *  ones.  MCS locks are for locks that many harts fight over: waiters queue
+ *  up and each spins on its own node instead of the shared lock word.
+ *
+ *  A lock that is also taken from trap context must be taken with one of the
+ *  '_irqsave' variants, otherwise an interrupt on the holder's hart can spin
+ *  on it forever.
+ *
+ *  With lockstat=1 every acquisition is reported to sync/lockstat.c along
+ *  with the spinning it took.
+ */
+
+/*  'pause' from Zihintpause.  It is encoded as a fence with no successors, which  *
+ *  harts without the extension treat as an ordinary (and cheap) fence.            */
+static inline void cpu_relax(void) {
+	asm volatile(".word 0x0100000f" ::: "memory");
+}
+
+void spin_init(spinlock_t* lock) {
+	lock->next = 0;
+	__atomic_store_n(&lock->owner, 0, __ATOMIC_RELEASE);
+}
+
+static inline void ticket_acquire(spinlock_t* lock, const void* site) {
+	uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) == ticket) {
+		lockstat_acquire(lock, LS_SPIN, site, false, 0);
+		return;
+	}
+	uint64_t start = lockstat_now();
+	while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+	lockstat_acquire(lock, LS_SPIN, site, true, start);
+}
+
+void spin_lock(spinlock_t* lock) {
+	ticket_acquire(lock, LOCKSTAT_SITE);
+}
+
+/*  Only the holder writes 'owner', so a plain increment is enough  */
+void spin_unlock(spinlock_t* lock) {
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t spin_lock_irqsave(spinlock_t* lock) {
+	uint64_t sie = irq_save();
+	ticket_acquire(lock, LOCKSTAT_SITE);
+	return sie;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, uint64_t sie) {
+	spin_unlock(lock);
+	irq_restore(sie);
+}
+
+static inline void mcs_acquire(mcs_lock_t* lock, mcs_node_t* node, const void* site) {
+	node->next = NULL;
+	node->locked = 1;
+	mcs_node_t* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+	if (prev == NULL) { /* The lock was free */
+		lockstat_acquire(lock, LS_MCS, site, false, 0);
+		return;
+	}
+	uint64_t start = lockstat_now();
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+		cpu_relax();
+	lockstat_acquire(lock, LS_MCS, site, true, start);
+}
+
+void mcs_lock(mcs_lock_t* lock, mcs_node_t* node) {
+	mcs_acquire(lock, node, LOCKSTAT_SITE);
+}
+
+void mcs_unlock(mcs_lock_t* lock, mcs_node_t* node) {
+	mcs_node_t* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	if (next == NULL) {
+		mcs_node_t* expected = node;
+		if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return; /* Nobody was waiting */
+		while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+			cpu_relax(); /* A waiter swapped itself in but hasn't linked up yet */
+	}
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t mcs_lock_irqsave(mcs_lock_t* lock, mcs_node_t* node) {
+	uint64_t sie = irq_save();
+	mcs_acquire(lock, node, LOCKSTAT_SITE);
+	return sie;
+}
+
+void mcs_unlock_irqrestore(mcs_lock_t* lock, mcs_node_t* node, uint64_t sie) {
+	mcs_unlock(lock, node);
+	irq_restore(sie);
+}
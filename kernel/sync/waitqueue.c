@@ -0,0 +1,139 @@
+#include <system/waitqueue.h>
+#include <system/semaphore.h>
+#include <system/thread.h>
+#include <system/lockstat.h>
+#include <device/timer.h>
+#include <barelib.h>
+
+/*
+ *  Wait queues let a thread sleep until a condition holds, instead of
+ *  turning every event into a semaphore count.  Use them through
+ *  'wait_event' and 'wait_event_timeout' (see system/waitqueue.h).
+ *
+ *  Each thread sleeps on its own 'wq_sem', the only way the kernel lets a
+ *  thread block.  A waker takes the thread off the queue and posts that
+ *  semaphore once, however many events it is reporting, so a driver can
+ *  wake its readers once per batch of data.  A post that arrives after the
+ *  waiter already saw its condition leaves a count behind, which only costs
+ *  the next wait one extra check of its condition.
+ *
+ *  A waiter with a deadline keeps it in 'wake_at', where 'expire_timers'
+ *  finds it on the tick and takes it off its queue with 'wait_expire'.
+ */
+
+_Static_assert(NTHREADS <= 32, "wait_queue_t.waiters has one bit per thread");
+
+void init_wait_queue(wait_queue_t* wq) {
+	spin_init(&wq->lock);
+	wq->waiters = 0;
+	wq->seq = 0;
+}
+
+/*  Puts the current thread on 'wq'.  'deadline' is a 'time' value after which the  *
+ *  timer wakes it anyway, 0 for none.                                               */
+void prepare_wait(wait_queue_t* wq, uint64_t deadline) {
+	thread_t* thread = &thread_table[current_thread];
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	thread->wq = wq;
+	thread->wq_seq = wq->seq++;
+	thread->wake_at = deadline;
+	wq->waiters |= 1U << current_thread;
+	spin_unlock_irqrestore(&wq->lock, sie);
+}
+
+/*  With lockstat=1 every sleep counts as a contended acquisition of the queue  */
+void wait_sleep(void) {
+	wait_queue_t* wq = thread_table[current_thread].wq; /* Cleared by whoever wakes us */
+	uint64_t start = lockstat_now();
+	wait_sem(&thread_table[current_thread].wq_sem);
+	if (wq != NULL) lockstat_acquire(wq, LS_WAITQ, LOCKSTAT_SITE, true, start);
+}
+
+/*  Takes the current thread off 'wq' if nothing woke it  */
+void finish_wait(wait_queue_t* wq) {
+	thread_t* thread = &thread_table[current_thread];
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	wq->waiters &= ~(1U << current_thread);
+	if (thread->wq == wq) thread->wq = NULL;
+	thread->wake_at = 0;
+	spin_unlock_irqrestore(&wq->lock, sie);
+}
+
+/*  Removes a waiter, the queue's lock must be held  */
+static void dequeue_waiter(wait_queue_t* wq, uint32_t threadid) {
+	wq->waiters &= ~(1U << threadid);
+	thread_table[threadid].wq = NULL;
+}
+
+/*  Wakes the longest waiting thread.  Returns the number of threads woken.  */
+uint32_t wake_up_one(wait_queue_t* wq) {
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	uint32_t first = NTHREADS;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (!(wq->waiters & (1U << i))) continue;
+		if (first == NTHREADS || thread_table[i].wq_seq < thread_table[first].wq_seq) first = i;
+	}
+	if (first == NTHREADS) {
+		spin_unlock_irqrestore(&wq->lock, sie);
+		return 0;
+	}
+	dequeue_waiter(wq, first);
+	spin_unlock_irqrestore(&wq->lock, sie);
+	post_sem(&thread_table[first].wq_sem);
+	return 1;
+}
+
+/*  Wakes every thread on 'wq'.  Returns the number of threads woken.  */
+uint32_t wake_up_all(wait_queue_t* wq) {
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	uint32_t woken = wq->waiters;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (woken & (1U << i)) dequeue_waiter(wq, i);
+	}
+	spin_unlock_irqrestore(&wq->lock, sie);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (!(woken & (1U << i))) continue;
+		post_sem(&thread_table[i].wq_sem);
+		++count;
+	}
+	return count;
+}
+
+/*  Called by 'expire_timers' once a waiter's deadline has passed.  The thread may  *
+ *  have been woken or moved to another queue since, so its queue is checked again  *
+ *  under that queue's lock.                                                        */
+void wait_expire(uint32_t threadid) {
+	wait_queue_t* wq = thread_table[threadid].wq;
+	if (wq == NULL) return;
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	if (thread_table[threadid].wq != wq || !(wq->waiters & (1U << threadid))) {
+		spin_unlock_irqrestore(&wq->lock, sie);
+		return;
+	}
+	dequeue_waiter(wq, threadid);
+	spin_unlock_irqrestore(&wq->lock, sie);
+	post_sem(&thread_table[threadid].wq_sem);
+}
+
+/*  Called by 'kill_thread'.  Takes a dying thread off whatever queue it is still on,  *
+ *  so its bit can't swallow a 'wake_up_one' meant for a live waiter or wake the next  *
+ *  thread to get its id.                                                              */
+void wait_remove(uint32_t threadid) {
+	thread_t* thread = &thread_table[threadid];
+	wait_queue_t* wq = thread->wq;
+	thread->wake_at = 0;
+	if (wq == NULL) return;
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	if (thread->wq == wq) dequeue_waiter(wq, threadid);
+	spin_unlock_irqrestore(&wq->lock, sie);
+}
+
+uint64_t wait_deadline(uint32_t ms) {
+	return r_time() + (uint64_t)ms * TICKS_PER_MS;
+}
+
+bool wait_expired(uint64_t deadline) {
+	return r_time() >= deadline;
+}
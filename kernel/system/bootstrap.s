@@ -7,55 +7,103 @@
 
 	.file "bootstrap.s"
 	.equ _mstatus_init,       0x880
+	.equ NHARTS,              4        # must match smp.h
+	.equ HART_SHIFT,          6        # must match smp.h
+	.equ HART_ID,             32       # must match smp.h
+	.equ HART_PRESENT,        44       # must match smp.h
+	.equ M_STACK_SIZE,        1024
+	.equ BOOT_STACK_SIZE,     4096
+	.equ CLINT_MSIP,          0x02000000
 
 .section .bss
 .align 7
 .globl m_trap_stack
 m_trap_stack:
-		.skip 1024
+		.skip M_STACK_SIZE * NHARTS    # One machine trap stack per hart
 .globl m_trap_stack_top
 m_trap_stack_top:
+.align 4
+hart_boot_stack:
+		.skip BOOT_STACK_SIZE * NHARTS # Stacks used by secondary harts until they load a thread
 
 .section .text.entry
 .globl _start
 _start:
 	csrr t0, mhartid             # -.
-	bne t0, x0, idle             # -'    Skip setup on all harts execpt hart 0
+	li t1, NHARTS                #  |    Harts beyond what the kernel supports never leave reset
+	bgeu t0, t1, idle            # -'
 
-	la t1, _mstatus_init         # --
-	or t0, t0, t1                #  |    Enable interrupts and set running state to Supervisor mode
-	csrw mstatus, t0             # --
-	li t0, 0x202
-	csrs mideleg, t0
+	li t1, _mstatus_init         # --
+	csrw mstatus, t1             # --    Interrupts return to Supervisor mode
+	li t1, 0x202
+	csrs mideleg, t1
 
-	la t0, __m_trap_vector       # --
-	addi t0, t0, 0x1             #  |    Set exception and interrupt vector to the '__traps' label
-	csrw mtvec, t0               # --
+	la t1, __m_trap_vector       # --
+	addi t1, t1, 0x1             #  |    Set exception and interrupt vector to the '__traps' label
+	csrw mtvec, t1               # --
 
-	li t0, 0xB300			     # -.
-	csrs medeleg, t0			 # -'    Delegate page faults and ecall to supervisor
+	li t1, 0xB300			     # -.
+	csrs medeleg, t1			 # -'    Delegate page faults and ecall to supervisor
 
 	la gp, _kmap_global_ptr      # --
-	la sp, _kmap_kstack_top      #  |    Set initial stack pointer, global pointer,
-	la t0, m_trap_stack_top      #  |    Provide stack space for machine-mode traps
-	csrw mscratch, t0            #  |    and system entry function
-	la t0, supervisor_start      #  |    
-	csrw mepc, t0                # --
+	la t1, m_trap_stack          #  |    Provide stack space for machine-mode traps
+	addi t2, t0, 1               #  |    (each hart gets the slice ending at (hartid+1)*M_STACK_SIZE)
+	li t3, M_STACK_SIZE          #  |
+	mul t2, t2, t3               #  |
+	add t1, t1, t2               #  |
+	csrw mscratch, t1            # --
+
+	la tp, harts                 # --
+	slli t1, t0, HART_SHIFT      #  |    Point tp at this hart's 'hart_t', Supervisor mode
+	add tp, tp, t1               #  |    keeps it there for the life of the kernel
+	sw t0, HART_ID(tp)           #  |
+	li t1, 1                     #  |
+	sw t1, HART_PRESENT(tp)      # --
+
+	li t1, 0x0f0f                # --
+	li t2, 0x20000000            #  |
+	li t3, 0x22000000            #  |    Set up memory protection so that Supervisor mode
+	csrw pmpcfg0, t1             #  |    can acccess all regions of memory
+	csrw pmpaddr0, t2            #  |
+	csrw pmpaddr1, t3            # --
+
+	bne t0, x0, secondary        # --    Only hart 0 boots the kernel
 
-	li t0, 0x0f0f                # --
-	li t1, 0x20000000            #  |
-	li t2, 0x22000000            #  |    Set up memory protection so that Supervisor mode
-	csrw pmpcfg0, t0             #  |    can acccess all regions of memory
-	csrw pmpaddr0, t1            #  |
-	csrw pmpaddr1, t2            # --
+	la sp, _kmap_kstack_top      # --    Set initial stack pointer and system entry function
+	la t0, supervisor_start      #  |
+	csrw mepc, t0                # --
 
-	csrsi mie, 0x2
+	csrsi mie, 0xA               # --    Supervisor and Machine software interrupts
 	call init_clk                # --    Initialize clock interrupts
 	call init_plic	             # --    Initialize external interrupts
 
 	la ra, idle                  # -.    Set the return point for the kernel to idle
 	mret                         # -'    Return to Supervisor mode at 'initialize'
 
+secondary:                       # --
+	la sp, hart_boot_stack       #  |    Secondary harts wait here until 'smp_boot' (see smp.c)
+	addi t1, t0, 1               #  |    sets 'hart_release' and raises their msip
+	li t2, BOOT_STACK_SIZE       #  |
+	mul t1, t1, t2               #  |
+	add sp, sp, t1               #  |
+	csrsi mie, 0xA               #  |
+1:                               #  |
+	wfi                          #  |
+	la t1, hart_release          #  |
+	lw t1, 0(t1)                 #  |
+	beqz t1, 1b                  # --
+
+	li t1, CLINT_MSIP            # --
+	slli t2, t0, 2               #  |    Clear the wakeup so it is not taken as an IPI later
+	add t1, t1, t2               #  |
+	sw zero, 0(t1)               # --
+
+	call init_clk                # --    Each hart has its own timer
+	csrr a0, mhartid             # --
+	la t0, secondary_start       #  |    Enter Supervisor mode at 'secondary_start(hartid)'
+	csrw mepc, t0                #  |
+	mret                         # --
+
 idle:                            # --
-	wfi                          #  | Loop forever if not hart0
+	wfi                          #  | Loop forever if the hart is not used
 	j idle                       # --
@@ -1,244 +1,223 @@
 #include <fs/fs.h>
-#include <mm/malloc.h>
 #include <lib/bareio.h>
 #include <system/thread.h>
+#include <system/syscall.h>
 #include <device/rtc.h>
+#include <device/tty.h>
 #include <dev/ecall.h>
 #include <dev/time.h>
+#include <dev/printf.h>
 #include <util/string.h>
 
-thread_t* proc;
+/*
+ *  This file contains the file, console and RTC ecalls.  Each one is its own
+ *  entry in 'ecall_table' (see syscall.c) and takes its arguments straight
+ *  from a0..a5, so nothing has to be unpacked from user memory first.
+ *
+ *  The file and directory ecalls are run by an 'ecall_wq' worker in the
+ *  caller's address space, so they look up the cwd and open files of
+ *  'caller_thread' rather than of the thread that is running.
+ */
 
 //
-// Open handlers
+// Console
 //
 
-/* Called by: 
-		fopen()
-		fcreate()
-		mkdir()
-		getdir()
-*/
-static uint32_t disk_dev_open(byte* options) {
-	disk_dev_opts* opts = (disk_dev_opts*)options;
-	switch (opts->mode) {
-		case FILE_OPEN:
-			return (uint32_t)open((const char*)opts->buff_in, opts->file, proc->cwd);
-		case FILE_CREATE:
-			return (uint32_t)create((const char*)opts->buff_in, proc->cwd);
-		case DIR_CREATE:
-			return (uint32_t)mk_dir((const char*)opts->buff_in, proc->cwd, (dirent_t*)opts->buff_out);
-		case DIR_OPEN: /* Poorly named alias for fetching a directory and possibly switching cwd to it */
-			directory_t* target = (directory_t*)opts->buff_out;
-			bool chdir = *(bool*)opts->buff_in;
-			const char* path = (const char*)opts->buff_in + sizeof(bool);
-			uint8_t status = resolve_dir(path, proc->cwd, &target->dir);
-			if (status != 0) return status;
-			if (target->dir.type != EN_DIR) return 3;
-			char dirname[FILENAME_LEN];
-			status = path_to_name(path, dirname);
-			if (status == 5) {
-				uint32_t len = strlen(target->dir.name);
-				memcpy(dirname, target->dir.name, len + 1);
-			}
-			else if (status == 3 || status == 4) {
-				target->dir = status == 3 ? boot_fsd->super.root_dirent : thread_table[current_thread].cwd;
-				const char* ref = status == 3 ? boot_fsd->super.root_dirent.name : thread_table[current_thread].cwd.name;
-				uint32_t len = strlen(ref);
-				memcpy(dirname, ref, len + 1);
-			}
-			if ((status == 1 || status == 2) && strcmp(dirname, target->dir.name)) {
-				dirent_t candidate;
-				if (!dir_child_exists(target->dir, dirname, &candidate)) return 2; /* Target missing */
-				if (candidate.type != EN_DIR) return 3; /* Target is not a directory */
-				target->dir = candidate;
-			}
-			if (status == 0) return 1;
-
-			/* Update process cwd when the resolved directory differs or when we need to seed the initial path */
-			bool dir_changed = proc->cwd.inode != target->dir.inode;
-			if ((dir_changed || *target->path == '\0') && chdir) {
-				char* pos = dirent_path_expand(target->dir, target->path);
-				uint32_t l = strlen(pos) + 1;
-				memcpy(target->path, pos, l);
-				proc->cwd = target->dir;
-			}
-			return 0;
-		default: break;
+#define TTY_WRITE_CHUNK 128  /* Bytes bounced through the kernel stack per 'tty_write' */
+
+/* Called by: printf()    the user's printf leaves its '&' color tokens for us to expand.  The   *
+ *                        text is copied into a kernel buffer first, so a bad user pointer faults *
+ *                        here and never while 'tty_write' holds the console.                    */
+uint64_t handle_ecall_tty_write(uint64_t buffer, uint64_t length) {
+	const char* buf = (const char*)buffer;
+	char chunk[TTY_WRITE_CHUNK];
+	uint32_t used = 0;
+	for (uint64_t i = 0; i < length; ++i) {
+		const char* piece = &buf[i];
+		uint32_t n = 1;
+		char* color = (buf[i] == '&' && i + 1 < length) ? get_color_str(buf[i + 1]) : NULL;
+		if (color != NULL) {
+			piece = color;
+			n = (uint32_t)strlen(color);
+			++i;
+		}
+		if (used + n > TTY_WRITE_CHUNK) {
+			tty_write(chunk, used);
+			used = 0;
+		}
+		memcpy(&chunk[used], piece, n);
+		used += n;
 	}
-	return (uint32_t)-1;
+	if (used > 0) tty_write(chunk, used);
+	return 0;
 }
 
-static uint32_t handle_ecall_open(uint32_t device, byte* options) {
-	switch (device) {
-		case UART_DEV_NUM: return (uint32_t)-1;
-		case DISK_DEV_NUM: return disk_dev_open(options);
-		default: break;
-	}
-	return 0;
+/* Called by: gets() */
+uint64_t handle_ecall_tty_read(uint64_t buffer, uint64_t length) {
+	if (buffer == 0 || length == 0) return 0;
+	return get_line((char*)buffer, (uint32_t)length);
 }
 
 //
-// Close handlers
+// Files
 //
 
-/* Called by:
-		fclose()
-*/
-static uint32_t disk_dev_close(byte* options) {
-	disk_dev_opts* opts = (disk_dev_opts*)options;
-	return close(opts->file);
-	return (uint32_t)-1;
+/* Called by: fcreate() */
+uint64_t handle_ecall_create(uint64_t path) {
+	return (uint32_t)create((const char*)path, thread_table[caller_thread].cwd);
 }
 
-static uint32_t handle_ecall_close(uint32_t device, byte* options) {
-	switch (device) {
-		case UART_DEV_NUM: return (uint32_t)-1;
-		case DISK_DEV_NUM: return disk_dev_close(options);
-		default: break;
-	}
-	return 0;
+/* The caller's fd table, made on first use by a thread that never had one */
+static fdtable_t* current_files(void) {
+	thread_t* proc = &thread_table[caller_thread];
+	if (proc->files == NULL) proc->files = fdtable_create(NULL);
+	return proc->files;
 }
 
-//
-// Read handlers
-//
-
-/* Called by:
-		fread()
-		readdir()
-		rtc_read()
-*/
-static uint32_t rtc_dev_read(byte* options) {
-	rtc_dev_opts* opts = (rtc_dev_opts*)options;
-	if (opts->type == GET_SEC) {
-		uint64_t* time = (uint64_t*)opts->buffer;
-		*time = rtc_read_seconds();
+/* Called by: fopen()      returns the new fd, or a negative error from 'open' (-6 if the fd table is full) */
+uint64_t handle_ecall_open(uint64_t path) {
+	fdtable_t* files = current_files();
+	if (files == NULL) return (uint64_t)-6;
+	file_t* f;
+	int32_t status = open((const char*)path, &f, thread_table[caller_thread].cwd);
+	if (status != 0) return (uint64_t)(int64_t)status;
+	int32_t fd = fd_install(files, f);
+	if (fd < 0) {
+		close(f);
+		return (uint64_t)-6;
 	}
-	else { /* GET_TZ */
-		tzrule* lt = (tzrule*)opts->buffer;
-		*lt = localtime;
-	}
-	return 0;
+	return (uint64_t)fd;
 }
 
-static uint32_t disk_dev_read(byte* options) {
-	disk_dev_opts* opts = (disk_dev_opts*)options;
-	switch (opts->mode) {
-		case FILE_READ: return read(opts->file, opts->buff_out, opts->length);
-		case DIR_READ:
-			if (opts->length == 0) return 0;
-			dirent_t parent;
-			uint8_t status = resolve_dir((const char*)opts->buff_in, proc->cwd, &parent);
-			if (status != 0) return status;
-			if (parent.type != EN_DIR) return 3;
-
-			char dirname[FILENAME_LEN];
-			status = path_to_name((const char*)opts->buff_in, dirname);
-			if (status == 0) return 1;
-			if (status == 3) parent = boot_fsd->super.root_dirent;
-			if (status == 4) parent = thread_table[current_thread].cwd;
-			if (status == 5) {
-				/* Parent already canonicalized by resolve_dir */
-				memcpy(dirname, parent.name, strlen(parent.name) + 1);
-			}
-			if ((status == 1 || status == 2) && strcmp(dirname, parent.name)) return 2;
-			
-			dir_iter_t iter;
-			dirent_t* children = (dirent_t*)opts->buff_out;
-			dir_open(parent.inode, &iter);
-			uint32_t count = 0;
-			for (; count < opts->length && dir_next(&iter, children) == 1; ++count, ++children);
-			return count;
-		default: break;
-	}
-	return (uint32_t)-1;
+/* Called by: fclose() */
+uint64_t handle_ecall_close(uint64_t fd) {
+	return (uint64_t)(int64_t)fd_close(thread_table[caller_thread].files, (int32_t)fd);
 }
 
-static uint32_t uart_dev_read(byte* options) {
-	uart_dev_opts* opts = (uart_dev_opts*)options;
-	if (opts->buffer == NULL || opts->length == 0) return 0;
-	return get_line((char*)opts->buffer, opts->length);
+/* Called by: fread() */
+uint64_t handle_ecall_read(uint64_t fd, uint64_t buffer, uint64_t length) {
+	return read(fd_get(thread_table[caller_thread].files, (int32_t)fd), (byte*)buffer, (uint32_t)length);
 }
 
-static uint32_t handle_ecall_read(uint32_t device, byte* options) {
-	switch (device) {
-		case UART_DEV_NUM: return uart_dev_read(options);
-		case DISK_DEV_NUM: return disk_dev_read(options);
-		case RTC_DEV_NUM: return rtc_dev_read(options);
-		default: break;
-	}
+/* Called by: fwrite() */
+uint64_t handle_ecall_write(uint64_t fd, uint64_t buffer, uint64_t length) {
+	return write(fd_get(thread_table[caller_thread].files, (int32_t)fd), (byte*)buffer, (uint32_t)length);
+}
+
+/* Called by: fopen()      copies out the open file's inode */
+uint64_t handle_ecall_fstat(uint64_t fd, uint64_t out) {
+	file_t* f = fd_get(thread_table[caller_thread].files, (int32_t)fd);
+	if (f == NULL || out == 0) return (uint64_t)-1;
+	*(inode_t*)out = f->inode;
 	return 0;
 }
 
+/* Called by: fdelete() */
+uint64_t handle_ecall_unlink(uint64_t path) {
+	return (uint32_t)unlink((const char*)path, thread_table[caller_thread].cwd);
+}
+
 //
-// Write handlers
+// Directories
 //
 
-/* Called by:
-		fwrite()
-		fdelete()
-		rmdir()
-		rtc_chtz()
-*/
-static uint32_t rtc_dev_write(byte* options) {
-	rtc_dev_opts* opts = (rtc_dev_opts*)options;
-	uint8_t code = change_localtime((const char*)opts->buffer);
-	return code;
-}
-
-static uint32_t disk_dev_write(byte* options) {
-	disk_dev_opts* opts = (disk_dev_opts*)options;
-	switch (opts->mode) {
-		case FILE_WRITE: return write(opts->file, opts->buff_in, opts->length);
-		case FILE_TRUNCATE:
-			if (opts->length == 0) { /* Delete the file */
-				return (uint32_t)unlink((const char*)opts->buff_in, proc->cwd);
-			}
-			// No method exists to properly truncate files, don't call this yet.
-			return 0;
-		case DIR_TRUNCATE:
-			if (opts->length == 0) { /* Delete the directory */
-				// dir can only be deleted if empty, no -f exists
-				return (uint32_t)rm_dir((const char*)opts->buff_in, proc->cwd);
-			}
-		default: break;
-	}
-	return (uint32_t)-1;
+/* Called by: mkdir() */
+uint64_t handle_ecall_mkdir(uint64_t path, uint64_t out) {
+	return (uint32_t)mk_dir((const char*)path, thread_table[caller_thread].cwd, (dirent_t*)out);
 }
 
-static uint32_t uart_dev_write(byte* options) {
-	uart_dev_opts* opts = (uart_dev_opts*)options;
-	byte* buff = malloc(opts->length + 1);
-	memcpy(buff, opts->buffer, opts->length);
-	buff[opts->length] = '\0';
-	kprintf((char*)buff);
-	free(buff);
-	return 0;
+/* Called by: rmdir()      dir can only be deleted if empty, no -f exists */
+uint64_t handle_ecall_rmdir(uint64_t path) {
+	return (uint32_t)rm_dir((const char*)path, thread_table[caller_thread].cwd);
 }
 
-static uint32_t handle_ecall_write(uint32_t device, byte* options) {
-	switch (device) {
-		case UART_DEV_NUM: return uart_dev_write(options);
-		case DISK_DEV_NUM: return disk_dev_write(options);
-		case RTC_DEV_NUM: return rtc_dev_write(options);
-		default: break;
+/* Called by: rddir() */
+uint64_t handle_ecall_readdir(uint64_t path_arg, uint64_t out, uint64_t length) {
+	const char* path = (const char*)path_arg;
+	thread_t* proc = &thread_table[caller_thread];
+	if (length == 0) return 0;
+	dirent_t parent;
+	uint8_t status = resolve_dir(path, proc->cwd, &parent);
+	if (status != 0) return status;
+	if (parent.type != EN_DIR) return 3;
+
+	char dirname[FILENAME_LEN];
+	status = path_to_name(path, dirname);
+	if (status == 0) return 1;
+	if (status == 3) parent = boot_fsd->super.root_dirent;
+	if (status == 4) parent = proc->cwd;
+	if (status == 5) {
+		/* Parent already canonicalized by resolve_dir */
+		memcpy(dirname, parent.name, strlen(parent.name) + 1);
 	}
-	return (uint32_t)-1;
+	if ((status == 1 || status == 2) && strcmp(dirname, parent.name)) return 2;
+
+	dir_iter_t iter;
+	dirent_t* children = (dirent_t*)out;
+	in_rlock(parent.inode);
+	dir_open(parent.inode, &iter);
+	uint32_t count = 0;
+	for (; count < length && dir_next(&iter, children) == 1; ++count, ++children);
+	in_runlock(parent.inode);
+	return count;
+}
+
+/* Called by: getdir()
+   Fetches a directory and possibly switches the cwd to it */
+uint64_t handle_ecall_getdir(uint64_t path_arg, uint64_t out, uint64_t chdir) {
+	const char* path = (const char*)path_arg;
+	directory_t* target = (directory_t*)out;
+	thread_t* proc = &thread_table[caller_thread];
+	uint8_t status = resolve_dir(path, proc->cwd, &target->dir);
+	if (status != 0) return status;
+	if (target->dir.type != EN_DIR) return 3;
+	char dirname[FILENAME_LEN];
+	status = path_to_name(path, dirname);
+	if (status == 5) {
+		uint32_t len = strlen(target->dir.name);
+		memcpy(dirname, target->dir.name, len + 1);
+	}
+	else if (status == 3 || status == 4) {
+		target->dir = status == 3 ? boot_fsd->super.root_dirent : proc->cwd;
+		const char* ref = status == 3 ? boot_fsd->super.root_dirent.name : proc->cwd.name;
+		uint32_t len = strlen(ref);
+		memcpy(dirname, ref, len + 1);
+	}
+	if ((status == 1 || status == 2) && strcmp(dirname, target->dir.name)) {
+		dirent_t candidate;
+		if (!dir_child_exists(target->dir, dirname, &candidate)) return 2; /* Target missing */
+		if (candidate.type != EN_DIR) return 3; /* Target is not a directory */
+		target->dir = candidate;
+	}
+	if (status == 0) return 1;
+
+	/* Update process cwd when the resolved directory differs or when we need to seed the initial path */
+	bool dir_changed = proc->cwd.inode != target->dir.inode;
+	if ((dir_changed || *target->path == '\0') && chdir) {
+		char* pos = dirent_path_expand(target->dir, target->path);
+		uint32_t l = strlen(pos) + 1;
+		memcpy(target->path, pos, l);
+		proc->cwd = target->dir;
+	}
+	return 0;
 }
 
 //
-// Entry point
+// RTC
 //
 
-uint32_t handle_device_ecall(ecall_number id, uint32_t device, byte* options) {
-	proc = &thread_table[current_thread];
-	switch (id) {
-		case ECALL_OPEN: return handle_ecall_open(device, options);
-		case ECALL_CLOSE: return handle_ecall_close(device, options);
-		case ECALL_READ: return handle_ecall_read(device, options);
-		case ECALL_WRITE: return handle_ecall_write(device, options);
-		default: break;
-	}
-	return (uint32_t)-1;
+/* Called by: rtc_read() */
+uint64_t handle_ecall_rtc_read(void) {
+	return rtc_read_seconds();
+}
+
+/* Called by: rtc_gettz() */
+uint64_t handle_ecall_gettz(uint64_t out) {
+	*(tzrule*)out = localtime;
+	return 0;
+}
+
+/* Called by: rtc_chtz() */
+uint64_t handle_ecall_settz(uint64_t rule) {
+	return change_localtime((const char*)rule);
 }
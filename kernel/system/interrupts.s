@@ -1,9 +1,15 @@
 # Supervisor mode interrupt management functions
 
+	.equ CLINT_MSIP,     0x02000000
 	.equ CLINT_MTIMECMP, 0x02004000
 	.equ STIP_BIT,       0x20
+	.equ SSIP_BIT,       0x2
+	.equ SSTATUS_SPP,    0x100
 	.equ TICK,           100000
 	.equ TF_SP,      8
+	.equ TF_TP,      24
+	.equ TF_T0,      32
+	.equ TF_T1,      40
 	.equ TF_A7,      240
 	.equ TF_SEPC,    248
 	.equ TF_SSTATUS, 256
@@ -11,20 +17,58 @@
 	.equ TF_SIZE,    (TF_QWORDS*8)   # 264
 	.equ SCAUSE_ECALL_U, 8 # ecall from U mode
 	.equ SCAUSE_ECALL_S, 9 # ecall from S mode
-
-# god save my fucking soul
-.globl handle_trap
-handle_trap:
-	mv    t0, sp
-	csrr  t1, sscratch
-	andi  t1, t1, -16
-	mv    sp, t1
-	addi  sp, sp, -TF_SIZE
+	.equ FAST_ECALL_FIRST, 113   # must match syscall.h
+	.equ FAST_ECALL_COUNT, 64
+
+#  Fast ecall frame, the registers a C call may clobber besides a0 (which returns the result)
+	.equ FF_RA,   0
+	.equ FF_SP,   8
+	.equ FF_T0,   16
+	.equ FF_T1,   24
+	.equ FF_T2,   32
+	.equ FF_T3,   40
+	.equ FF_T4,   48
+	.equ FF_T5,   56
+	.equ FF_T6,   64
+	.equ FF_A1,   72
+	.equ FF_A2,   80
+	.equ FF_A3,   88
+	.equ FF_A4,   96
+	.equ FF_A5,   104
+	.equ FF_A6,   112
+	.equ FF_A7,   120
+	.equ FF_SIZE, 128
+
+#  hart_t layout (must match smp.h)
+	.equ HART_SCRATCH0, 0
+	.equ HART_SCRATCH1, 8
+	.equ HART_KSTACK,   16
+	.equ HART_SIGNUM,   24
+	.equ HART_SHIFT,    6
+
+# Parks t0/t1 in this hart's 'hart_t' (sscratch holds it) so they survive
+# until the trapframe exists.  Every entry point starts with this.
+.macro TRAP_ENTER
+	csrrw tp, sscratch, tp
+	sd    t0, HART_SCRATCH0(tp)
+	sd    t1, HART_SCRATCH1(tp)
+.endm
+
+# Saves the full trapframe on the trap area of the running thread and takes
+# the kernel lock.  Leaves sp pointing at the trapframe.
+.macro SAVE_FRAME
+	mv    t0, sp                 # --
+	ld    t1, HART_KSTACK(tp)    #  |  Trap area of the thread running on this hart
+	andi  t1, t1, -16            #  |
+	addi  sp, t1, -TF_SIZE       # --
 
 	sd ra,   0(sp)
 	sd t0, TF_SP(sp)
 	sd gp,  16(sp)
-	sd tp,  24(sp)
+	csrrw t0, sscratch, tp       # -.  Interrupted tp, and put the hart pointer back
+	sd t0, TF_TP(sp)             # -'
+	ld t0, HART_SCRATCH0(tp)
+	ld t1, HART_SCRATCH1(tp)
 	sd t0,  32(sp);  sd t1, 40(sp);  sd t2, 48(sp)
 	sd t3,  56(sp);  sd t4, 64(sp);  sd t5, 72(sp);  sd t6, 80(sp)
 	sd s0,  88(sp);  sd s1, 96(sp);  sd s2, 104(sp); sd s3, 112(sp)
@@ -38,9 +82,58 @@ handle_trap:
 	sd     t1, TF_SSTATUS(sp)
 	sd     t2, TF_SEPC(sp)
 
-	csrr   t0, scause
-	bltz   t0, .L_irq
+	mv     a0, sp
+	jal    kernel_enter           # Take the big kernel lock unless this hart already owns it, charge the thread
+.endm
+
+# 'stvec' is in vectored mode.  Exceptions and ecalls land on entry 0, and
+# each interrupt lands on the entry of its cause so it needs no decoding.
+# Causes that are never enabled fall back to 'handle_trap', which panics.
+.align 8
+.globl s_trap_vector
+s_trap_vector:               # Vector | Cause
+.org s_trap_vector + 0*4     #--------+---------------------------------------
+	j handle_trap            #  0     | Exception (ecalls included)
+.org s_trap_vector + 1*4     #--------+---------------------------------------
+	j trap_ssi               #  1     | SOFTWARE interrupt [Supervisor]
+.org s_trap_vector + 2*4     #--------+---------------------------------------
+	j handle_trap            #  2     | ------ /reserved/
+.org s_trap_vector + 3*4     #--------+---------------------------------------
+	j handle_trap            #  3     | SOFTWARE interrupt [Machine]
+.org s_trap_vector + 4*4     #--------+---------------------------------------
+	j handle_trap            #  4     | ------ /reserved/
+.org s_trap_vector + 5*4     #--------+---------------------------------------
+	j trap_sti               #  5     | TIMER interrupt    [Supervisor] (Sstc)
+.org s_trap_vector + 6*4     #--------+---------------------------------------
+	j handle_trap            #  6     | ------ /reserved/
+.org s_trap_vector + 7*4     #--------+---------------------------------------
+	j handle_trap            #  7     | TIMER interrupt    [Machine]
+.org s_trap_vector + 8*4     #--------+---------------------------------------
+	j handle_trap            #  8     | ------ /reserved/
+.org s_trap_vector + 9*4     #--------+---------------------------------------
+	j trap_sei               #  9     | EXTERNAL interrupt [Supervisor]
+                             #--------+---------------------------------------
 
+# god save my fucking soul
+.globl handle_trap
+handle_trap:
+	TRAP_ENTER
+	csrr  t0, scause             # --
+	li    t1, SCAUSE_ECALL_U     #  |  User ecalls with a handler in 'fast_ecall_table'
+	bne   t0, t1, .L_full        #  |  (see syscall.c) skip the trapframe entirely
+	li    t1, FAST_ECALL_FIRST   #  |
+	sub   t0, a7, t1             #  |
+	li    t1, FAST_ECALL_COUNT   #  |  Unsigned, so numbers below the range fail too
+	bgeu  t0, t1, .L_full        #  |
+	la    t1, fast_ecall_table   #  |
+	slli  t0, t0, 3              #  |
+	add   t1, t1, t0             #  |
+	ld    t1, 0(t1)              #  |
+	bnez  t1, .L_fast            # --
+
+.L_full:
+	SAVE_FRAME
+	csrr   t0, scause
 	li     t1, SCAUSE_ECALL_U
 	beq    t0, t1, .L_ecall
 	li     t1, SCAUSE_ECALL_S
@@ -50,12 +143,24 @@ handle_trap:
 	jal    s_handle_exception
 	j      .L_exit
 
-.L_irq:
-	andi   t0, t0, 0x1FF
-	li     t1, 1                  # SSIP
-	beq    t0, t1, .L_sys
-
-	jal    handle_plic            # SEIP
+trap_ssi:                        # Ticks relayed from Machine mode, reschedules and IPIs
+	TRAP_ENTER
+	SAVE_FRAME
+	j      .L_sys
+
+trap_sti:
+	TRAP_ENTER
+	SAVE_FRAME
+	jal    handle_stimer          # --
+	csrr   t0, sip                #  |  'handle_clk' pends a reschedule through SSIP, take it
+	andi   t0, t0, SSIP_BIT       #  |  now rather than trapping a second time on 'sret'
+	bnez   t0, .L_sys             #  |
+	j      .L_exit                # --
+
+trap_sei:
+	TRAP_ENTER
+	SAVE_FRAME
+	jal    handle_plic
 	j      .L_exit
 
 .L_ecall:
@@ -71,8 +176,7 @@ handle_trap:
 
 .L_sys:
 	csrci  sip, 0x2
-	la    t2, signum
-	ld    t3, 0(t2)
+	ld    t3, HART_SIGNUM(tp)
 	li    t4, 1 # tick
 	beq   t3, t4, .L_clk
 
@@ -81,12 +185,21 @@ handle_trap:
 	j .L_exit
 
 .L_exit:
+	jal  run_bottom_halves       # Finish work deferred by interrupt handlers on this hart
 	csrci sstatus, 0x2           # clear SIE to avoid nesting while exiting
 
+	mv   a0, sp
+	jal  kernel_exit             # Drop the kernel lock if leaving for user mode or the idle thread
+
 	ld   t2, TF_SEPC(sp)
 	ld   t1, TF_SSTATUS(sp)
 	csrw sepc, t2
 
+	andi t3, t1, SSTATUS_SPP     # --
+	beqz t3, 1f                  #  |  Kernel threads may have moved harts while switched out,
+	sd   tp, TF_TP(sp)           #  |  so they resume with this hart's tp rather than the saved one
+1:                               # --
+
 	li   t3, ~0x2
 	and  t1, t1, t3              # keep SPIE and SPP, ensure SIE=0
 	csrw sstatus, t1
@@ -106,18 +219,51 @@ handle_trap:
 	mv sp, t0            # restore interrupted sp
 	sret
 
+# Fast ecall path.  t1 holds the handler.  Handlers run with interrupts off, without the
+# kernel lock and without a trapframe, so they may only touch this hart's state.  The
+# frame sits below the trapframe area so a fast ecall never disturbs the thread's 'tf'.
+.L_fast:
+	mv    t0, sp
+	ld    sp, HART_KSTACK(tp)
+	andi  sp, sp, -16
+	addi  sp, sp, -(TF_SIZE + FF_SIZE)
+	sd    t0, FF_SP(sp)
+	sd    ra, FF_RA(sp)
+	ld    t0, HART_SCRATCH0(tp);  sd t0, FF_T0(sp)
+	ld    t0, HART_SCRATCH1(tp);  sd t0, FF_T1(sp)
+	sd t2, FF_T2(sp);  sd t3, FF_T3(sp);  sd t4, FF_T4(sp)
+	sd t5, FF_T5(sp);  sd t6, FF_T6(sp)
+	sd a1, FF_A1(sp);  sd a2, FF_A2(sp);  sd a3, FF_A3(sp)
+	sd a4, FF_A4(sp);  sd a5, FF_A5(sp);  sd a6, FF_A6(sp);  sd a7, FF_A7(sp)
+
+	jalr  t1                     # a0 = handler(a0)
+
+	csrr  t0, sepc
+	addi  t0, t0, 4              # Step past the ecall
+	csrw  sepc, t0
+
+	ld ra, FF_RA(sp)
+	ld t0, FF_T0(sp);  ld t1, FF_T1(sp);  ld t2, FF_T2(sp)
+	ld t3, FF_T3(sp);  ld t4, FF_T4(sp);  ld t5, FF_T5(sp);  ld t6, FF_T6(sp)
+	ld a1, FF_A1(sp);  ld a2, FF_A2(sp);  ld a3, FF_A3(sp)
+	ld a4, FF_A4(sp);  ld a5, FF_A5(sp);  ld a6, FF_A6(sp);  ld a7, FF_A7(sp)
+	csrrw tp, sscratch, tp       # User tp back, hart pointer back into sscratch
+	ld sp, FF_SP(sp)
+	sret
+
 .globl init_interrupts
 init_interrupts:
-	la   t0, s_trap_top
-	ld   t0, 0(t0)
-	csrw sscratch, t0
+	csrw sscratch, tp            # 'hart_t' of this hart, its kstack must already be set
 
-	la   t1, handle_trap
-	csrw stvec, t1 
+	la   t1, s_trap_vector
+	ori  t1, t1, 1               # MODE = Vectored
+	csrw stvec, t1
 
 	li   t2, ((1<<1) | (1<<5) | (1<<9))   # SSIE | STIE | SEIE 
 	csrs sie, t2
 
+	csrsi scounteren, 0x2        # TM, lets user programs read 'time' for timing themselves
+
 	li   t3, 0x2
 	csrs sstatus, t3
 	ret
@@ -130,16 +276,14 @@ acknowledge_interrupt:        # --
 	
 .globl raise_syscall
 raise_syscall:
-	la t0, signum
-	sd a0, 0(t0)
+	sd a0, HART_SIGNUM(tp)
 	li t1, 0x2
 	csrs sip, t1
 	ret
 
 .globl pend_resched
 pend_resched:
-	la   t0, signum
-	sd   a0, 0(t0)        
+	sd   a0, HART_SIGNUM(tp)
 	li   t1, 0x2
 	csrs sip, t1
 	ret
@@ -166,8 +310,7 @@ __noop:	mret
 
 .global delegate_clk
 delegate_clk:
-	csrrw sp, mscratch, sp
-	la sp, m_trap_stack_top
+	csrrw sp, mscratch, sp       # mscratch holds the top of this hart's machine trap stack
 
 	addi sp, sp, -32
 	sd   t0,  0(sp)
@@ -175,15 +318,20 @@ delegate_clk:
 	sd   t2, 16(sp)
 	sd   t3, 24(sp)
 
+	csrr t2, mhartid
 	li   t0, CLINT_MTIMECMP
+	slli t3, t2, 3
+	add  t0, t0, t3
 	ld   t1, 0(t0)            
 	li   t3, TICK        
 	add  t1, t1, t3
 	sd   t1, 0(t0)
 
-	la t0, signum
-	la t1, 1 # TICK
-	sd t1, 0(t0)
+	la   t0, harts
+	slli t2, t2, HART_SHIFT
+	add  t0, t0, t2
+	li   t1, 1 # TICK
+	sd   t1, HART_SIGNUM(t0)
 	li   t2, 0x2
 	csrs sip, t2
 
@@ -196,6 +344,36 @@ delegate_clk:
 	csrrw sp, mscratch, sp
 	mret
 
+.global delegate_ipi
+delegate_ipi:                    # --
+	csrrw sp, mscratch, sp       #  |  Another hart wrote our msip (see 'send_ipi' in smp.c).
+	addi sp, sp, -16             #  |  Clear it and pass it on as a RESCHED software interrupt.
+	sd   t0, 0(sp)               #  |
+	sd   t1, 8(sp)               #  |
+                                 #  |
+	csrr t0, mhartid             #  |
+	li   t1, CLINT_MSIP          #  |
+	slli t0, t0, 2               #  |
+	add  t1, t1, t0              #  |
+	sw   zero, 0(t1)             #  |
+                                 #  |
+	csrr t0, sip                 #  |  A software interrupt that is already pending (e.g. a TICK)
+	andi t0, t0, 0x2             #  |  reschedules anyway, so leave its signum alone
+	bnez t0, 1f                  #  |
+	la   t1, harts               #  |
+	csrr t0, mhartid             #  |
+	slli t0, t0, HART_SHIFT      #  |
+	add  t1, t1, t0              #  |
+	sd   zero, HART_SIGNUM(t1)   #  |  RESCHED
+	li   t0, 0x2                 #  |
+	csrs sip, t0                 #  |
+1:                               #  |
+	ld   t1, 8(sp)               #  |
+	ld   t0, 0(sp)               #  |
+	addi sp, sp, 16              #  |
+	csrrw sp, mscratch, sp       #  |
+	mret                         # --
+
 .globl __m_trap_vector
 .align 8
 __m_trap_vector:             # Interrupt table index | Cause
@@ -206,7 +384,7 @@ __m_trap_vector:             # Interrupt table index | Cause
 .org __m_trap_vector + 2*4   #-----------------------+---------------------------------------
 	j __noop                 #  2                    | ------ /reserved/
 .org __m_trap_vector + 3*4   #-----------------------+---------------------------------------
-	j __noop                 #  3                    | SOFTWARE interrupt [Machine]
+	j delegate_ipi           #  3                    | SOFTWARE interrupt [Machine]
 .org __m_trap_vector + 4*4   #-----------------------+---------------------------------------
 	j __noop                 #  4                    | TIMER interrupt    [User]
 .org __m_trap_vector + 5*4   #-----------------------+---------------------------------------
@@ -228,7 +406,6 @@ __m_trap_vector:             # Interrupt table index | Cause
 .global m_exception_trampoline
 m_exception_trampoline:
 	csrrw sp, mscratch, sp
-	la sp, m_trap_stack_top
 
 	j m_handle_exception
 
@@ -0,0 +1,112 @@
+#include <system/smp.h>
+#include <system/thread.h>
+#include <system/interrupts.h>
+#include <system/semaphore.h>
+#include <system/panic.h>
+#include <system/lockstat.h>
+#include <mm/vm.h>
+#include <barelib.h>
+
+/*
+ *  This file contains the code for bringing up the secondary harts and the
+ *  big kernel lock that keeps them from running kernel code concurrently.
+ *
+ *  Every hart leaves reset in '_start' (see bootstrap.s).  Hart 0 boots the
+ *  kernel while the others mark themselves present and wait in Machine mode
+ *  until 'smp_boot' sets 'hart_release' and pokes their 'msip' register.
+ *  They then enter Supervisor mode at 'secondary_start' and load their idle
+ *  thread, after which each one schedules from its own run queue (see sched.c).
+ */
+
+#define CLINT_MSIP    0x02000000UL
+#define SSTATUS_SPP   (1UL << 8)
+#define SATP_SV39     (8UL << 60)
+
+hart_t harts[NHARTS] = { [0 ... NHARTS - 1] = { .idle_thread = NTHREADS, .zombie = NTHREADS, .fpu_owner = NTHREADS } };
+volatile uint32_t hart_release;
+static mcs_lock_t kernel_lock;
+static mcs_node_t kernel_lock_node[NHARTS];  /*  Each hart queues for the kernel lock on its own node  */
+
+/*  The big kernel lock is owned by a hart, not a thread.  A hart takes it when  *
+ *  it enters the kernel from user mode or from its idle thread and gives it up  *
+ *  when it returns to either of those.  Kernel threads run with it held, which  *
+ *  keeps every kernel structure single-hart without per-structure locking.      *
+ *  Every hart fights over it, so it is an MCS lock: harts queue up and are let  *
+ *  in in order, each spinning on its own node.                                  */
+void kernel_enter(uint64_t* frame) {
+	trapframe* tf = (trapframe*)frame;
+	hart_t* hart = this_hart();
+	if (!hart->holds_bkl) {
+		mcs_lock(&kernel_lock, &kernel_lock_node[hart - harts]);
+		hart->holds_bkl = 1;
+	}
+	if (tf != NULL && hart->online) /* Charge the interrupted thread for the time it ran */
+		charge_time(&thread_table[hart->current], !(tf->sstatus & SSTATUS_SPP));
+}
+
+void kernel_exit(uint64_t* frame) {
+	trapframe* tf = (trapframe*)frame;
+	hart_t* hart = this_hart();
+	if (!(tf->sstatus & SSTATUS_SPP)) /* Time in the kernel ends here */
+		charge_time(&thread_table[hart->current], false);
+	if (!hart->holds_bkl) return;
+	if ((tf->sstatus & SSTATUS_SPP) && hart->current != hart->idle_thread) return;
+	hart->holds_bkl = 0;
+	mcs_unlock(&kernel_lock, &kernel_lock_node[hart - harts]);
+}
+
+/*  Raises a Machine software interrupt on another hart.  Its Machine mode handler  *
+ *  turns that into a Supervisor software interrupt asking for a reschedule.        */
+void send_ipi(uint32_t hartid) {
+	if (hartid >= NHARTS) return;
+	*(volatile uint32_t*)PA_TO_KVA(CLINT_MSIP + 4 * hartid) = 1;
+}
+
+/*  Called after a thread is added to a hart's run queue.  If that hart is idling  *
+ *  it is interrupted so it picks the thread up instead of waiting for a tick.      */
+void kick_hart(uint32_t hartid) {
+	if (&harts[hartid] == this_hart() || !harts[hartid].online) return;
+	if (harts[hartid].current == harts[hartid].idle_thread)
+		send_ipi(hartid);
+}
+
+static uint8_t idle_loop(void) {
+	while (1) asm volatile("wfi");
+	return 0;
+}
+
+/*  Gives each present hart an idle thread, then releases the secondary harts.  *
+ *  Must be called from a thread once the MMU is on.                            */
+void smp_boot(void) {
+	lockstat_name(&kernel_lock, LS_MCS, "kernel_lock");
+	for (uint32_t i = 0; i < NHARTS; ++i) {
+		if (!harts[i].present) continue;
+		harts[i].idle_thread = create_thread(&idle_loop, MODE_S);
+		thread_table[harts[i].idle_thread].hart = i;
+		set_thread_name(harts[i].idle_thread, "idle");
+	}
+
+	hart_release = 1;
+	asm volatile("fence rw, rw" ::: "memory");
+	for (uint32_t i = 1; i < NHARTS; ++i) {
+		if (harts[i].present) send_ipi(i);
+	}
+}
+
+/*
+ *  First C function run by a secondary hart, entered from bootstrap.s in
+ *  Supervisor mode with the MMU off.  'tp' already points at its 'hart_t'.
+ */
+void secondary_start(uint32_t hartid) {
+	asm volatile("csrw satp, %0\n\tsfence.vma x0, x0" :: "r"(SATP_SV39 | kernel_root_ppn) : "memory");
+
+	hart_t* hart = this_hart();
+	if (hart->id != hartid || hart->idle_thread == NTHREADS) {
+		panic("Hart %u was released without an idle thread.\n", hartid);
+	}
+	kernel_enter(NULL);
+	hart->kstack = (byte*)PA_TO_KVA(s_trap_top); /* Shared boot trap page, serialized by the kernel lock */
+	init_interrupts();
+	context_load(&thread_table[hart->idle_thread], hart->idle_thread);
+	while (1);
+}
@@ -1,9 +1,11 @@
 #include <lib/bareio.h>
 #include <system/version.h>
 #include <system/thread.h>
+#include <system/smp.h>
 #include <system/interrupts.h>
 #include <system/queue.h>
 #include <system/panic.h>
+#include <system/syscall.h>
 #include <system/memlayout.h>
 #include <mm/malloc.h>
 #include <mm/vm.h>
@@ -44,6 +46,8 @@ static void initialize(void) {
 	free(imp); 
 	init_rtc();
 	init_pages();
+	update_time_page(); /* UTC until 'root_thread' loads the timezone */
+	this_hart()->kstack = s_trap_top; /* Trap stack until the first thread is loaded */
 	init_interrupts();
 }
 
@@ -80,17 +84,16 @@ static void display_welcome(bool dailyMsg) {
 		/* Query the importer log to determine whether the importer finished cleanly. */
 		const char sentinel[] = "Importer finished with no errors.";
 		const char* log_path = "/etc/importer.log";
-		FILE f = { 0 };
-		f.fd = (FD)-1;
+		file_t* f;
 		bool importer_ok = false;
 		bool log_available = open(log_path, &f, root) == 0;
 		if (log_available) {
-			char* buffer = (char*)malloc(f.inode.size + 1);
-			buffer[f.inode.size] = '\0';
-			read(&f, (byte*)buffer, f.inode.size);
+			char* buffer = (char*)malloc(f->inode.size + 1);
+			buffer[f->inode.size] = '\0';
+			read(f, (byte*)buffer, f->inode.size);
 			importer_ok = strstr(buffer, sentinel) != NULL; /* Janky way of detecting status */
 			free(buffer);
-			close(&f);
+			close(f);
 		}
 		const char* result = importer_ok
 			? "The importer finished successfully."
@@ -106,21 +109,20 @@ static void display_welcome(bool dailyMsg) {
 		unlink(fname, root);
 		create(fname, root);
 	}
-	FILE f;
-	open(fname, &f, root);
-	write(&f, file_buff, strlen((const char*)file_buff));
-	close(&f);
+	file_t* f;
+	if (open(fname, &f, root) == 0) {
+		write(f, file_buff, strlen((const char*)file_buff));
+		close(f);
+	}
 }
 
-static void sys_idle() { while (1); }
-
 static void root_thread(void) {
+	smp_boot(); /* Idle threads for every hart, then release the secondary harts */
 	change_localtime("est");
 	display_welcome(true);
-	uint32_t idle_tid = create_thread(&sys_idle, MODE_S);
-	resume_thread(idle_tid);
-	uint32_t reaper_tid = create_thread(&reaper, MODE_S);
-	resume_thread(reaper_tid);
+	init_workqueue(&system_wq, 1);
+	init_workqueue(&ecall_wq, ECALL_WORKERS);
+	warm_aspace_cache();
 
 	/* When true, echoes all keyboard input but strips nonprint 
 	   When false, filters and discards unhandled nonprint without echo
@@ -132,16 +134,15 @@ static void root_thread(void) {
 	if (!dir_child_exists(boot_fsd->super.root_dirent, "bin", &bin))
 		panic("Fatal: /bin missing, cannot start shell.\n");
 
-	FILE f;
-	f.fd = (FD)-1;
-	open("shell.elf", &f, bin);
-	if (f.fd == (FD)-1)
+	file_t* f;
+	if (open("shell.elf", &f, bin) != 0)
 		panic("Fatal: no shell to run on boot.\n");
-	close(&f);
+	close(f);
 	/* Spawning the shell will block execution of this thread until it finishes. 
 	   Then we just restart it. No logout mechanism exists.                      */
 	while (1) {
-		ecall_spawn("shell", NULL);
+		int32_t shell_tid = (int32_t)ecall_spawn("shell", NULL);
+		if (shell_tid > 0) ecall_waitpid(shell_tid, NULL, 0);
 		display_welcome(false);
 	}
 }
@@ -151,8 +152,10 @@ static void root_thread(void) {
  *  Used to initialize devices before starting steady state behavior
  */
 void supervisor_start(void) {
+	kernel_enter(NULL);
 	initialize();
 	uint32_t root_tid = create_thread(&root_thread, MODE_S);
+	set_thread_name(root_tid, "root");
 	context_load(&thread_table[root_tid], root_tid);
 	while(1);
 }
@@ -4,17 +4,20 @@
 #include <system/syscall.h>
 #include <system/queue.h>
 #include <system/panic.h>
+#include <system/futex.h>
+#include <system/lockstat.h>
 #include <mm/vm.h>
 #include <mm/malloc.h>
 #include <fs/fs.h>
+#include <device/timer.h>
 #include <util/string.h>
 #include <dev/ecall.h>
+#include <dev/ring.h>
 #include <barelib.h>
 
 #define SYSCON_ADDR 0x100000
 #define SYSCON_SHUTDOWN 0x5555
 #define SYSCON_REBOOT 0x7777
-volatile uint64_t signum;
 
 void (*syscall_table[])(void*) = {
   resched
@@ -23,20 +26,145 @@ void (*syscall_table[])(void*) = {
 void handle_syscall(uint64_t* frame) {
 	(void)frame;
 	int32_t table_size = sizeof(syscall_table) / sizeof(uint32_t(*)(void));
+	uint64_t signum = this_hart()->signum;
 	if (signum < table_size)
 		syscall_table[signum](&handle_syscall);
 }
 
-static uint8_t handle_ecall_spawn(char* name, char* arg) {
-	uint8_t ret = 0;
-	int32_t tid = exec(name, arg);
-	if (tid >= 0) {
-		resume_thread(tid);
-		ret = join_thread(tid);
+/* Fast ecalls, see '.L_fast' in interrupts.s.  They run on the caller's hart with interrupts  *
+ * off and without the kernel lock, so they must stay short and only touch per-hart state.    */
+static uint64_t fast_getpid(uint64_t arg) {
+	(void)arg;
+	return current_thread;
+}
+
+static uint64_t fast_clock(uint64_t arg) {
+	(void)arg;
+	return r_time();
+}
+
+/* The reschedule is pended and taken through the normal trap path as soon as the ecall   *
+ * returns to user mode.  A pending TICK reschedules too, so its signum is left alone.     */
+static uint64_t fast_yield(uint64_t arg) {
+	(void)arg;
+	uint64_t sip;
+	asm volatile("csrr %0, sip" : "=r"(sip));
+	if (!(sip & 0x2)) pend_resched(RESCHED);
+	return 0;
+}
+
+fast_ecall_t const fast_ecall_table[FAST_ECALL_COUNT] = {
+	[ECALL_CLOCK  - FAST_ECALL_FIRST] = fast_clock,
+	[ECALL_YIELD  - FAST_ECALL_FIRST] = fast_yield,
+	[ECALL_GETPID - FAST_ECALL_FIRST] = fast_getpid,
+};
+
+/* Starts a program as a child of the caller and returns its thread id without waiting *
+ * for it.  The caller collects its return value later with ECALL_WAITPID.             */
+static uint64_t handle_ecall_spawn(uint64_t name, uint64_t arg) {
+	int32_t tid = exec((char*)name, (char*)arg);
+	if (tid >= 0) { resume_thread(tid); }
+	else if (tid == -2) { kprintf("%s: command not found\n", (char*)name); }
+	return (uint64_t)tid;
+}
+
+/* Currently assumes a supervisor process didn't call this. They have their own exit strategy. *
+ * A user thread traps from user mode, so its trapframe is the one at the top of its kstack.   */
+static uint64_t handle_ecall_exit(uint64_t status) {
+	thread_t* thread = &thread_table[current_thread];
+	if (thread->mode != MODE_U) return (uint64_t)-1;
+	thread->tf->a0 = status;
+	user_thread_exit(thread->tf);
+	return status;
+}
+
+/* Starts a thread in the caller's address space. Collected like any other child with ECALL_WAITPID. */
+static uint64_t handle_ecall_clone(uint64_t entry, uint64_t arg0, uint64_t arg1) {
+	int32_t tid = clone_thread(entry, arg0, arg1);
+	if (tid >= 0) resume_thread(tid);
+	return (uint64_t)tid;
+}
+
+static uint64_t handle_ecall_futex(uint64_t uaddr, uint64_t op, uint64_t val) {
+	switch (op) {
+		case FUTEX_WAIT: return (uint64_t)futex_wait(uaddr, (uint32_t)val);
+		case FUTEX_WAKE: return (uint64_t)futex_wake(uaddr, (uint32_t)val);
+		default: return (uint64_t)-1;
 	}
-	else if (tid == -2) { kprintf("%s: command not found\n", name); }
-	else ret = 1;
-	return ret;
+}
+
+/* tid -1 waits for any child. The child's return value is stored through 'status' if it isn't NULL. */
+static uint64_t handle_ecall_waitpid(uint64_t tid, uint64_t status, uint64_t options) {
+	uint8_t retval = 0;
+	int32_t ret = wait_child((int32_t)tid, &retval, (options & WNOHANG) != 0);
+	if (ret > 0 && status != 0) *(uint8_t*)status = retval;
+	return (uint64_t)ret;
+}
+
+static uint64_t handle_ecall_sleep(uint64_t ms) {
+	sleep_current((uint32_t)ms);
+	return 0;
+}
+
+static char state_letter(uint32_t state) {
+	switch (state) {
+		case TH_RUNNING: return 'R';
+		case TH_READY:   return 'Q';
+		case TH_WAITING: return 'W';
+		case TH_SLEEP:   return 'S';
+		case TH_SUSPEND: return 'T';
+		default:         return 'Z';
+	}
+}
+
+/* Copies the accounting of every thread in use into 'buf' and returns the number of entries. */
+static uint64_t handle_ecall_tstat(uint64_t buffer, uint64_t max) {
+	thread_stat_t* buf = (thread_stat_t*)buffer;
+	if (buf == NULL) return (uint64_t)-1;
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < NTHREADS && count < max; ++i) {
+		thread_t* thread = &thread_table[i];
+		if (thread->state == TH_FREE) continue;
+		if (thread->state == TH_RUNNING) charge_time(thread, thread->mode == MODE_U && i != current_thread);
+		thread_stat_t* st = &buf[count++];
+		st->tid = i;
+		st->parent = thread->parent < NTHREADS ? (int32_t)thread->parent : -1;
+		st->state = state_letter(thread->state);
+		st->priority = thread->priority;
+		st->hart = thread->hart;
+		st->mode = thread->mode;
+		memset(st->name, 0, TSTAT_NAME_LEN);
+		memcpy(st->name, thread->name, THREAD_NAME_LEN < TSTAT_NAME_LEN ? THREAD_NAME_LEN : TSTAT_NAME_LEN);
+		st->name[TSTAT_NAME_LEN - 1] = '\0';
+		st->utime = thread->acct.utime;
+		st->stime = thread->acct.stime;
+		st->wait_time = thread->acct.wait_time;
+		st->nvcsw = thread->acct.nvcsw;
+		st->nivcsw = thread->acct.nivcsw;
+		st->faults = thread->acct.faults;
+	}
+	return count;
+}
+
+/* Copies the lock contention counters into 'buf' and returns the number of entries, *
+ * or -1 if the kernel was built without lockstat=1.                                 */
+static uint64_t handle_ecall_lockstat(uint64_t buffer, uint64_t max, uint64_t flags) {
+#ifdef BAREOS_LOCKSTAT
+	if (buffer == 0) return (uint64_t)-1;
+	return lockstat_copy((lock_stat_t*)buffer, (uint32_t)max, (flags & LSTAT_RESET) != 0);
+#else
+	(void)buffer; (void)max; (void)flags;
+	return (uint64_t)-1;
+#endif
+}
+
+/* A process may change its own priority (tid -1) or that of one of its children. */
+static uint64_t handle_ecall_setprio(uint64_t tid_arg, uint64_t prio) {
+	int32_t tid = (int32_t)tid_arg;
+	if (tid == -1) tid = current_thread;
+	if (tid < 0 || tid >= NTHREADS) return (uint64_t)-1;
+	if (tid != current_thread && thread_table[tid].parent != current_thread) return (uint64_t)-1;
+	return (uint64_t)set_priority(tid, (uint32_t)prio);
 }
 
 static void signal_syscon(uint16_t signal) {
@@ -46,12 +174,177 @@ static void signal_syscon(uint16_t signal) {
 	while (1);
 }
 
-static void handle_ecall_pwoff(void) {
+static uint64_t handle_ecall_pwoff(void) {
 	signal_syscon(SYSCON_SHUTDOWN);
+	return 0;
 }
 
-static void handle_ecall_rboot(void) {
+static uint64_t handle_ecall_rboot(void) {
 	signal_syscon(SYSCON_REBOOT);
+	return 0;
+}
+
+static uint64_t handle_ecall_gdev(void) {
+	return 0; /* Placeholder until devices can be enumerated, doubles as the null ecall */
+}
+
+/* Maps the caller's ring on first use. Threads of a process share its address space and so its ring. */
+static uint64_t handle_ecall_ring_setup(void) {
+	thread_t* thread = &thread_table[current_thread];
+	if (thread->mode != MODE_U) return (uint64_t)-1;
+	if (translate_user_address(thread->root_ppn, RING_VA) == NULL &&
+	    map_user_page(thread->root_ppn, RING_VA) != 0) return (uint64_t)-1;
+	return RING_VA;
+}
+
+static ecall_fn_t const ecall_table[NR_ECALLS];
+
+/* Ecalls a ring may carry.  They must not wait on input, exit or switch address     *
+ * space, since the whole batch runs inside the one ECALL_RING_ENTER call.  They may *
+ * still sleep: the fs ecalls on the inode and allocation locks, and TTY_WRITE on    *
+ * 'tty_out' while another writer holds it or the ring is full.  Each of those ends  *
+ * without any input from the program.                                               */
+static bool ring_allowed(uint32_t ecall) {
+	switch (ecall) {
+		case ECALL_GDEV:    case ECALL_MKDIR:   case ECALL_UNLINK:
+		case ECALL_RMDIR:   case ECALL_GETDIR:  case ECALL_CREATE:
+		case ECALL_OPEN:    case ECALL_CLOSE:   case ECALL_READDIR:
+		case ECALL_READ:    case ECALL_WRITE:   case ECALL_TTY_WRITE:
+		case ECALL_FSTAT:   case ECALL_RTC_READ:
+		case ECALL_CLOCK:   case ECALL_GETPID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Consumes up to 'count' submissions in order, posting a completion for each.  Every   *
+ * allowed ecall finishes before it returns, sleeping if it has to, so a completion is  *
+ * ready for each entry taken.  Stops early if the completion queue is full and returns *
+ * the number taken.  Runs on an 'ecall_wq' worker, which calls the entries directly.   */
+static uint64_t handle_ecall_ring_enter(uint64_t count) {
+	thread_t* thread = &thread_table[caller_thread];
+	if (thread->mode != MODE_U || translate_user_address(thread->root_ppn, RING_VA) == NULL)
+		return (uint64_t)-1;
+
+	ring_t* ring = (ring_t*)RING_VA;
+	uint32_t head = ring->sq_head;
+	uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+	if (tail - head > RING_SQ_SIZE) return (uint64_t)-1; /* Indices were corrupted by the program */
+	uint64_t taken = 0;
+	for (; taken < count && head != tail; ++taken) {
+		uint32_t cq_tail = ring->cq_tail;
+		if (cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= RING_CQ_SIZE) break;
+
+		ring_sqe_t sqe = ring->sq[head & (RING_SQ_SIZE - 1)]; /* Copied so the program can't change it mid-call */
+		++head;
+		uint64_t result = (uint64_t)-1;
+		if (ring_allowed(sqe.ecall))
+			result = ecall_table[sqe.ecall](sqe.args[0], sqe.args[1], sqe.args[2], 0, 0, 0);
+
+		ring_cqe_t* cqe = &ring->cq[cq_tail & (RING_CQ_SIZE - 1)];
+		cqe->user_data = sqe.user_data;
+		cqe->result = result;
+		__atomic_store_n(&ring->cq_tail, cq_tail + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+	}
+	return taken;
+}
+
+/*  Every ecall number indexes this table.  Arguments come from a0..a5 of the caller and  *
+ *  handlers take only the ones they use, the rest are ignored by the calling convention. */
+#define ECALL(fn) ((ecall_fn_t)(fn))
+static ecall_fn_t const ecall_table[NR_ECALLS] = {
+	[ECALL_GDEV]      = ECALL(handle_ecall_gdev),
+	[ECALL_PWOFF]     = ECALL(handle_ecall_pwoff),
+	[ECALL_RBOOT]     = ECALL(handle_ecall_rboot),
+	[ECALL_MKDIR]     = ECALL(handle_ecall_mkdir),
+	[ECALL_UNLINK]    = ECALL(handle_ecall_unlink),
+	[ECALL_RMDIR]     = ECALL(handle_ecall_rmdir),
+	[ECALL_GETDIR]    = ECALL(handle_ecall_getdir),
+	[ECALL_CREATE]    = ECALL(handle_ecall_create),
+	[ECALL_OPEN]      = ECALL(handle_ecall_open),
+	[ECALL_CLOSE]     = ECALL(handle_ecall_close),
+	[ECALL_READDIR]   = ECALL(handle_ecall_readdir),
+	[ECALL_READ]      = ECALL(handle_ecall_read),
+	[ECALL_WRITE]     = ECALL(handle_ecall_write),
+	[ECALL_FSTAT]     = ECALL(handle_ecall_fstat),
+	[ECALL_TTY_READ]  = ECALL(handle_ecall_tty_read),
+	[ECALL_TTY_WRITE] = ECALL(handle_ecall_tty_write),
+	[ECALL_SPAWN]     = ECALL(handle_ecall_spawn),
+	[ECALL_EXIT]      = ECALL(handle_ecall_exit),
+	[ECALL_FUTEX]     = ECALL(handle_ecall_futex),
+	[ECALL_SLEEP]     = ECALL(handle_ecall_sleep),
+	[ECALL_CLOCK]     = ECALL(fast_clock),    /* The fast ecalls only get here from supervisor */
+	[ECALL_RTC_READ]  = ECALL(handle_ecall_rtc_read),
+	[ECALL_YIELD]     = ECALL(fast_yield),    /* callers, user ones take '.L_fast'            */
+	[ECALL_SETPRIO]   = ECALL(handle_ecall_setprio),
+	[ECALL_GETTZ]     = ECALL(handle_ecall_gettz),
+	[ECALL_SETTZ]     = ECALL(handle_ecall_settz),
+	[ECALL_GETPID]    = ECALL(fast_getpid),
+	[ECALL_CLONE]     = ECALL(handle_ecall_clone),
+	[ECALL_WAITPID]   = ECALL(handle_ecall_waitpid),
+	[ECALL_TSTAT]     = ECALL(handle_ecall_tstat),
+	[ECALL_LOCKSTAT]  = ECALL(handle_ecall_lockstat),
+	[ECALL_RING_SETUP] = ECALL(handle_ecall_ring_setup),
+	[ECALL_RING_ENTER] = ECALL(handle_ecall_ring_enter),
+};
+
+/*  Exec and the filesystem ecalls can run long and sleep on the fs locks, so they are  *
+ *  handed to an 'ecall_wq' worker instead of being run in the trap.  The worker takes   *
+ *  on the caller's address space while it serves the request, and handlers find the    *
+ *  caller's cwd and files through 'caller_thread'.                                     */
+workqueue_t ecall_wq;
+
+typedef struct {
+	work_t work;          /* Queued on 'ecall_wq'                                 */
+	uint32_t caller;      /* Thread that made the ecall, asleep on 'done'         */
+	ecall_fn_t fn;
+	uint64_t args[6];
+	uint64_t result;
+	semaphore_t done;     /* Posted by the worker once 'result' is set            */
+} ecall_work_t;
+
+static bool ecall_deferred(uint64_t call_id) {
+	switch (call_id) {
+		case ECALL_MKDIR:   case ECALL_UNLINK:  case ECALL_RMDIR:
+		case ECALL_GETDIR:  case ECALL_CREATE:  case ECALL_OPEN:
+		case ECALL_CLOSE:   case ECALL_READDIR: case ECALL_READ:
+		case ECALL_WRITE:   case ECALL_FSTAT:   case ECALL_SPAWN:
+		case ECALL_RING_ENTER:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void run_ecall_work(work_t* work) {
+	ecall_work_t* req = (ecall_work_t*)((byte*)work - offsetof(ecall_work_t, work));
+	thread_t* self = &thread_table[current_thread];
+	uint64_t own_root = self->root_ppn;
+	uint16_t own_asid = self->asid;
+	self->acting_for = req->caller;
+	use_address_space(thread_table[req->caller].root_ppn, thread_table[req->caller].asid);
+	req->result = req->fn(req->args[0], req->args[1], req->args[2], req->args[3], req->args[4], req->args[5]);
+	use_address_space(own_root, own_asid);
+	self->acting_for = current_thread;
+	post_sem(&req->done);
+}
+
+/*  The request lives on the caller's kernel stack.  The caller can only run again  *
+ *  once it holds the kernel lock, which the worker keeps until 'post_sem' is done.  */
+static uint64_t defer_ecall(ecall_fn_t fn, const trapframe* tf) {
+	ecall_work_t req;
+	init_work(&req.work, &run_ecall_work);
+	req.caller = current_thread;
+	req.fn = fn;
+	req.args[0] = tf->a0; req.args[1] = tf->a1; req.args[2] = tf->a2;
+	req.args[3] = tf->a3; req.args[4] = tf->a4; req.args[5] = tf->a5;
+	req.done = create_sem(0);
+	if (!queue_work(&ecall_wq, &req.work)) /* Not started yet, early boot runs them in place */
+		return fn(tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5);
+	wait_sem(&req.done);
+	return req.result;
 }
 
 void handle_ecall(uint64_t* frame_data, uint64_t call_id) {
@@ -59,23 +352,12 @@ void handle_ecall(uint64_t* frame_data, uint64_t call_id) {
 	if (tf == NULL)
 		return;
 	tf->sepc += 4;
-	uint32_t result = 0;
-	/* TODO: function lookup table */
-	switch ((ecall_number)call_id) {
-		case ECALL_GDEV: break;
-		case ECALL_PWOFF: handle_ecall_pwoff(); break;
-		case ECALL_RBOOT: handle_ecall_rboot(); break;
-		case ECALL_OPEN:
-		case ECALL_CLOSE:
-		case ECALL_READ:
-		case ECALL_WRITE:
-			result = handle_device_ecall((ecall_number)call_id, (uint32_t)tf->a0, (byte*)tf->a1);
-			break;
-		case ECALL_SPAWN: result = handle_ecall_spawn((char*)tf->a0, (char*)tf->a1); break;
-		case ECALL_EXIT: /* Currently assumes a supervisor process didn't call this. They have their own exit strategy. */
-			if (thread_table[current_thread].mode == MODE_U) user_thread_exit(tf);
-			break;
+	if (call_id >= NR_ECALLS || ecall_table[call_id] == NULL) {
+		tf->a0 = (uint64_t)-1;
+		return;
 	}
-
-	tf->a0 = result;
+	if (ecall_deferred(call_id))
+		tf->a0 = defer_ecall(ecall_table[call_id], tf);
+	else
+		tf->a0 = ecall_table[call_id](tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5);
 }
@@ -16,6 +16,8 @@
  *
  */
 
+#define FAULT_RETVAL 139   /*  Exit code of a user thread ended by a page fault  */
+
 void s_handle_exception(uint64_t* frame) {
    uint64_t cause, tval, epc;
    asm volatile("csrr %0, scause" : "=r"(cause));
@@ -24,15 +26,23 @@ void s_handle_exception(uint64_t* frame) {
 
 	if ((cause & (1ULL << 63)) == 0) { /* Synchronous exception */
 		uint64_t code = cause & 0xfffULL; /* Get exception code */
+#ifdef BAREOS_FPU
+		/* 2 = illegal instruction, which is how a thread's first FP instruction shows up */
+		if (code == 2 && fpu_first_use((trapframe*)frame)) return;
+#endif
 		/* Placeholder for handling basic page faults without a crash */
 		/* 12 = instruction page fault */
 		/* 13 = load page fault        */
 		/* 15 = store page fault */
 		if (code == 12 || code == 13 || code == 15) {
-			/* No handler. Just kill the thread. */
+			/* No handler. Just end the thread. */
+			trapframe* tf = (trapframe*)frame;
+			thread_table[current_thread].acct.faults++;
 			krprintf("Thread %u faulted at %x on code %u\n", current_thread, (uint32_t)tval, code);
-			if (ready_list.qnext == &ready_list) {
-				panic("Couldn't resched after a fault. There's no other available threads to switch to.\n");
+			if (thread_table[current_thread].mode == MODE_U) {
+				tf->a0 = FAULT_RETVAL;  /* Exits as a zombie so the parent can still read its counters */
+				user_thread_exit(tf);
+				return;
 			}
 			kill_thread(current_thread);
 			pend_resched(RESCHED);
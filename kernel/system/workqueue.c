@@ -0,0 +1,113 @@
+#include <system/workqueue.h>
+#include <system/thread.h>
+#include <system/smp.h>
+#include <system/lockstat.h>
+#include <barelib.h>
+
+/*
+ *  This file contains the kernel's deferred work facilities.
+ *
+ *  Workqueues are run by dedicated kernel threads.  Anything that may block or
+ *  that takes long enough that it should not hold up a trap belongs there.
+ *
+ *  Bottom halves are for interrupt handlers.  A handler does the minimum the
+ *  device needs, queues a bottom half for the rest, and returns.  Each hart's
+ *  bottom halves run in '.L_exit' (see interrupts.s) before the trap returns,
+ *  still in trap context and so they must not block.  They are only queued
+ *  and run from trap context with interrupts off, so the per-hart lists need
+ *  no lock.
+ */
+
+workqueue_t system_wq;
+static workqueue_t* worker_queue[NTHREADS];  /*  Queue each worker thread serves  */
+static work_t* bottom_halves[NHARTS];
+
+void init_work(work_t* work, void (*func)(work_t*)) {
+	work->func = func;
+	work->next = NULL;
+	work->pending = 0;
+}
+
+/*  Removes the first item from a workqueue, or returns NULL if it is empty.  The  *
+ *  item's pending flag is cleared so it can be queued again while it runs.        */
+static work_t* next_work(workqueue_t* wq) {
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	work_t* work = wq->head;
+	if (work != NULL) {
+		wq->head = work->next;
+		if (wq->head == NULL) wq->tail = NULL;
+		work->next = NULL;
+		work->pending = 0;
+	}
+	spin_unlock_irqrestore(&wq->lock, sie);
+	return work;
+}
+
+static void worker(void) {
+	workqueue_t* wq = worker_queue[current_thread];
+	while (1) {
+		wait_sem(&wq->sem);
+		work_t* work = next_work(wq);
+		if (work != NULL) work->func(work);
+	}
+}
+
+/*  Sets up a workqueue and starts 'nworkers' threads to serve it.  Must be called  *
+ *  from a thread once the MMU is on.                                               */
+void init_workqueue(workqueue_t* wq, uint32_t nworkers) {
+	wq->head = wq->tail = NULL;
+	spin_init(&wq->lock);
+	wq->sem = create_sem(0);
+	lockstat_name(&wq->lock, LS_SPIN, "workqueue");
+	lockstat_name(&wq->sem, LS_SEM, "workqueue");
+	for (uint32_t i = 0; i < nworkers; ++i) {
+		int32_t tid = create_thread(&worker, MODE_S);
+		if (tid < 0) break;
+		worker_queue[tid] = wq;
+		set_thread_name(tid, "kworker");
+		resume_thread(tid);
+	}
+}
+
+/*  Adds an item to the end of a workqueue and wakes a worker.  Returns false if  *
+ *  the item was already pending or the queue hasn't been set up yet.            */
+bool queue_work(workqueue_t* wq, work_t* work) {
+	if (wq->sem.state != S_USED) return false;
+	uint64_t sie = spin_lock_irqsave(&wq->lock);
+	if (work->pending) {
+		spin_unlock_irqrestore(&wq->lock, sie);
+		return false;
+	}
+	work->pending = 1;
+	work->next = NULL;
+	if (wq->tail != NULL) wq->tail->next = work;
+	else wq->head = work;
+	wq->tail = work;
+	spin_unlock_irqrestore(&wq->lock, sie);
+	post_sem(&wq->sem);
+	return true;
+}
+
+/*  Queues an item to run on this hart before the current trap returns.  Only to  *
+ *  be called from trap context.  Returns false if the item was already pending.  */
+bool queue_bottom_half(work_t* work) {
+	if (work->pending) return false;
+	uint32_t id = this_hart()->id;
+	work->pending = 1;
+	work->next = bottom_halves[id];
+	bottom_halves[id] = work;
+	return true;
+}
+
+/*  Called from '.L_exit' (see interrupts.s).  Items queued while the list is  *
+ *  being drained are run as well.                                             */
+void run_bottom_halves(void) {
+	uint32_t id = this_hart()->id;
+	while (bottom_halves[id] != NULL) {
+		work_t* work = bottom_halves[id];
+		bottom_halves[id] = work->next;
+		work->next = NULL;
+		work->pending = 0;
+		work->func(work);
+	}
+}
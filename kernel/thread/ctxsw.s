@@ -54,6 +54,14 @@
 	.equ TF_SSTATUS, 256
 	.equ TF_SIZE,    264
 
+#  fpu_t layout (must match fpu.h)
+	.equ FPU_FCSR,   256
+
+#  hart_t layout (must match smp.h)
+	.equ HART_KSTACK, 16
+	.equ SSTATUS_SPP, 0x100
+	.equ SSTATUS_FS,  0x6000
+
 #  void ctxsw(context *prev, context *next, uint64_t next_satp)
 	.globl ctxsw
 ctxsw:
@@ -94,8 +102,8 @@ ctxsw:
 	csrw satp, a2
 	sfence.vma x0, x0
 
-	addi t0, a3, -CTX_SIZE
-	csrw sscratch, t0
+	addi t0, a3, -CTX_SIZE       # Traps on this hart now land on next's kstack
+	sd   t0, HART_KSTACK(tp)
 
 	ret
 
@@ -115,15 +123,21 @@ ctxload:
 	csrs sstatus, t3
 
 	addi t0, a1, -CTX_SIZE
-	csrw sscratch, t0
+	sd   t0, HART_KSTACK(tp)
 	addi sp, t0, -TF_SIZE
 	ret
 
 # void trapret(trapframe *tf)
 # Restore ALL regs from tf on current KSTACK, program sepc/sstatus, then sret.
 # Note: This returns to privilege encoded in sstatus.SPP.
+#       Kernel threads keep this hart's tp (see .L_exit in interrupts.s).
 .globl trapret
 trapret:
+	ld t1, TF_SSTATUS(a0)
+	andi t1, t1, SSTATUS_SPP
+	beqz t1, 1f
+	sd tp, TF_TP(a0)
+1:
 	ld t0, TF_SEPC(a0)
 	csrw sepc, t0
 	ld t1, TF_SSTATUS(a0)
@@ -167,3 +181,46 @@ trapret:
 	ld   a0, TF_A0(a0)
 
 	sret
+
+# FP register file save/restore for the fpu=1 build (see thread/fpu.c).
+# The kernel is built without F/D, so the extensions are only enabled here.
+# FS must be on for FP instructions not to trap, the trapframe decides what
+# the thread returns to user mode with.
+	.option push
+	.option arch, +d
+
+#  void fpu_save(fpu_t *fpu)
+	.globl fpu_save
+fpu_save:
+	li   t0, SSTATUS_FS
+	csrs sstatus, t0
+	fsd  f0,    0(a0);  fsd  f1,    8(a0);  fsd  f2,   16(a0);  fsd  f3,   24(a0)
+	fsd  f4,   32(a0);  fsd  f5,   40(a0);  fsd  f6,   48(a0);  fsd  f7,   56(a0)
+	fsd  f8,   64(a0);  fsd  f9,   72(a0);  fsd  f10,  80(a0);  fsd  f11,  88(a0)
+	fsd  f12,  96(a0);  fsd  f13, 104(a0);  fsd  f14, 112(a0);  fsd  f15, 120(a0)
+	fsd  f16, 128(a0);  fsd  f17, 136(a0);  fsd  f18, 144(a0);  fsd  f19, 152(a0)
+	fsd  f20, 160(a0);  fsd  f21, 168(a0);  fsd  f22, 176(a0);  fsd  f23, 184(a0)
+	fsd  f24, 192(a0);  fsd  f25, 200(a0);  fsd  f26, 208(a0);  fsd  f27, 216(a0)
+	fsd  f28, 224(a0);  fsd  f29, 232(a0);  fsd  f30, 240(a0);  fsd  f31, 248(a0)
+	frcsr t1
+	sd   t1, FPU_FCSR(a0)
+	ret
+
+#  void fpu_restore(fpu_t *fpu)
+	.globl fpu_restore
+fpu_restore:
+	li   t0, SSTATUS_FS
+	csrs sstatus, t0
+	ld   t1, FPU_FCSR(a0)
+	fscsr t1
+	fld  f0,    0(a0);  fld  f1,    8(a0);  fld  f2,   16(a0);  fld  f3,   24(a0)
+	fld  f4,   32(a0);  fld  f5,   40(a0);  fld  f6,   48(a0);  fld  f7,   56(a0)
+	fld  f8,   64(a0);  fld  f9,   72(a0);  fld  f10,  80(a0);  fld  f11,  88(a0)
+	fld  f12,  96(a0);  fld  f13, 104(a0);  fld  f14, 112(a0);  fld  f15, 120(a0)
+	fld  f16, 128(a0);  fld  f17, 136(a0);  fld  f18, 144(a0);  fld  f19, 152(a0)
+	fld  f20, 160(a0);  fld  f21, 168(a0);  fld  f22, 176(a0);  fld  f23, 184(a0)
+	fld  f24, 192(a0);  fld  f25, 200(a0);  fld  f26, 208(a0);  fld  f27, 216(a0)
+	fld  f28, 224(a0);  fld  f29, 232(a0);  fld  f30, 240(a0);  fld  f31, 248(a0)
+	ret
+
+	.option pop
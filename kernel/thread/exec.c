@@ -47,9 +47,11 @@ static bool validate_segment(const pht_entry* ph, uint32_t file_size) {
 /* If we abort partway through, wipe the partially allocated thread table entry */
 static void cleanup_failed_thread(uint32_t tid) {
 	free_process_pages(tid);
+	fdtable_put(thread_table[tid].files);
+	thread_table[tid].files = NULL;
 	thread_table[tid].root_ppn = NULL;
 	thread_table[tid].state = TH_FREE;
-	thread_table[tid].sem = create_sem(0);
+	init_wait_queue(&thread_table[tid].exit_wq);
 	thread_table[tid].tf = NULL;
 	thread_table[tid].ctx = NULL;
 	thread_table[tid].stackptr = NULL;
@@ -166,28 +168,28 @@ int32_t exec(const char* program_name, const char* arg_line) {
 		return -1;
 	}
 
-	FILE f;
-	f.fd = (FD)-1;
+	file_t* f;
 	if (open(filename, &f, bin) != 0) return -2;
 
-	if (f.inode.size == 0) {
-		close(&f);
+	uint32_t size = f->inode.size;
+	if (size == 0) {
+		close(f);
 		kprintf("%s: file is empty\n", program_name);
 		return -1;
 	}
 
 	/* Copy entire elf into memory. Should be okay since they're all small.
 	   In the future we'll read it in chunks.                               */
-	byte* elf = malloc(f.inode.size);
+	byte* elf = malloc(size);
 	if (elf == NULL) {
-		close(&f);
+		close(f);
 		kprintf("%s: insufficient memory\n", program_name);
 		return -1;
 	}
 
-	int32_t bytes_read = read(&f, elf, f.inode.size);
-	close(&f);
-	if (bytes_read < 0 || (uint32_t)bytes_read != f.inode.size) {
+	int32_t bytes_read = read(f, elf, size);
+	close(f);
+	if (bytes_read < 0 || (uint32_t)bytes_read != size) {
 		free(elf);
 		kprintf("%s: failed to read image\n", program_name);
 		return -1;
@@ -195,7 +197,7 @@ int32_t exec(const char* program_name, const char* arg_line) {
 
 	/* Uses structs that mirror the expected layout to validate the header */
 	const elf_hdr* hdr = (const elf_hdr*)elf;
-	if (!is_supported_elf(hdr, f.inode.size)) {
+	if (!is_supported_elf(hdr, size)) {
 		free(elf);
 		kprintf("%s: invalid ELF header\n", program_name);
 		return -1;
@@ -207,7 +209,7 @@ int32_t exec(const char* program_name, const char* arg_line) {
 
 	for (uint16_t i = 0; i < ph_count; ++i) {
 		if (ph_table[i].type != PT_LOAD) continue;
-		if (!validate_segment(&ph_table[i], f.inode.size)) {
+		if (!validate_segment(&ph_table[i], size)) {
 			free(elf);
 			kprintf("%s: invalid program segment\n", program_name);
 			return -1;
@@ -221,15 +223,12 @@ int32_t exec(const char* program_name, const char* arg_line) {
 		kprintf("%s: unable to create process\n", program_name);
 		return -1;
 	}
+	set_thread_name(tid, program_name);
 
-	/* Once we have the root_ppn of the thread, we can start writing data to the pages */
+	/* Once we have the root_ppn of the thread, we can start writing data to the pages. *
+	 * MODE_U threads get their user pages already zeroed (see 'alloc_user_page').      */
 	thread_t* thread = &thread_table[tid];
-	if (zero_user(thread->root_ppn, 0, USER_REGION_SIZE) < 0) {
-		cleanup_failed_thread(tid);
-		free(elf);
-		kprintf("%s: failed to prepare address space\n", program_name);
-		return -1;
-	}
+	thread->files = fdtable_create(thread_table[caller_thread].files); /* Inherits the spawner's open files */
 
 	/* For each pht entry, we'll work through and copy its data given the offsets provided */
 	for (uint16_t i = 0; i < ph_count; ++i) {
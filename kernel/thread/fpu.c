@@ -0,0 +1,63 @@
+#include <system/thread.h>
+#include <system/smp.h>
+#include <util/string.h>
+#include <barelib.h>
+
+/*
+ *  This file contains the lazy FP context handling used by the fpu=1 build.
+ *
+ *  User threads start with sstatus.FS Off, so their first FP instruction
+ *  traps and 'fpu_first_use' hands them a zeroed register file.  Threads that
+ *  never touch FP keep FS Off and cost nothing on a switch.  The hardware sets
+ *  FS to Dirty when a thread writes an FP register, and only then is the file
+ *  saved when it's switched out.  Each hart remembers whose state its registers
+ *  still hold ('fpu_owner') so a thread switched back in on the same hart with
+ *  nothing in between skips the restore.
+ */
+
+#ifdef BAREOS_FPU
+
+/*  Records that this hart's registers hold a thread's latest FP state.  Its copy on  *
+ *  any other hart is stale from here on.                                            */
+static void claim_fpu(hart_t* hart, uint32_t threadid) {
+	for (uint32_t i = 0; i < NHARTS; ++i) {
+		if (harts[i].fpu_owner == threadid) harts[i].fpu_owner = NTHREADS;
+	}
+	hart->fpu_owner = threadid;
+}
+
+static void set_fs(trapframe* tf, uint64_t fs) {
+	tf->sstatus = (tf->sstatus & ~SSTATUS_FS) | fs;
+}
+
+/*  Called by 'context_switch' while still on 'prev'.  Both threads' trapframes hold the  *
+ *  FS they return to user mode with, which is where the lazy decisions are made.        */
+void fpu_switch(thread_t* next, thread_t* prev) {
+	hart_t* hart = this_hart();
+	if (prev->mode == MODE_U && prev->state != TH_ZOMBIE && (prev->tf->sstatus & SSTATUS_FS) == FS_DIRTY) {
+		fpu_save(&prev->fpu);
+		set_fs(prev->tf, FS_CLEAN);
+		claim_fpu(hart, (uint32_t)(prev - thread_table));
+	}
+	uint32_t next_id = (uint32_t)(next - thread_table);
+	if (next->mode == MODE_U && (next->tf->sstatus & SSTATUS_FS) != FS_OFF && hart->fpu_owner != next_id) {
+		fpu_restore(&next->fpu);
+		claim_fpu(hart, next_id);
+	}
+}
+
+/*  Handles an illegal instruction trap from a user thread whose FS is Off by giving it  *
+ *  a zeroed FP register file.  The instruction is retried when the trap returns.        *
+ *  Returns false if the trap was not an FP first use and should be treated as fatal.    */
+bool fpu_first_use(trapframe* tf) {
+	thread_t* thread = &thread_table[current_thread];
+	if (thread->mode != MODE_U || (tf->sstatus & (1UL << 8)) || (tf->sstatus & SSTATUS_FS) != FS_OFF)
+		return false;
+	memset(&thread->fpu, 0, sizeof(fpu_t));
+	fpu_restore(&thread->fpu);
+	set_fs(tf, FS_CLEAN);
+	claim_fpu(this_hart(), current_thread);
+	return true;
+}
+
+#endif
@@ -1,15 +1,15 @@
 #include <system/thread.h>
 #include <system/queue.h>
+#include <system/lockstat.h>
 
 /*  Queues entries in bareOS are contained in the 'queue_table' array.  Each queue has a "root"
  *  that contains  pointers to  the first  and last  elements in that respective queue.  These
- *  roots are created separately - for example, the 'ready_list', which represents all threads
- *  currently available for scheduling.  Non-root nodes are stored in the 'queue_table' proper.
+ *  roots are created separately - for example, each hart's 'runqueues' entry, which holds the
+ *  threads available for scheduling on that hart.  Non-root nodes are stored in the 'queue_table' proper.
  *  Each node points to the previous and next node.  */
 
 queue_t queue_table[NTHREADS];   /*  Array of queue elements          */
-queue_t ready_list;              /*  Struct with the ready_list root  */
-queue_t reap_list;
+runqueue_t runqueues[NHARTS];    /*  Per-hart ready queue roots       */
 
 /* 'init_queues' sets all entries in the queue_table to initial values so they   *
  *  can be used safely later during OS operations.                               */
@@ -19,10 +19,16 @@ void init_queues(void) {
 	queue_table[i].qnext = NULL;
 	queue_table[i].qprev = NULL;
   }
-  ready_list.key = sleep_list.key = reap_list.key = 0;
-  ready_list.qnext = ready_list.qprev = &ready_list;
+  for(uint32_t i = 0; i < NHARTS; ++i) {
+	runqueues[i].ready.key = 0;
+	runqueues[i].ready.qnext = runqueues[i].ready.qprev = &runqueues[i].ready;
+	runqueues[i].nr_ready = runqueues[i].ticks = 0;
+	spin_init(&runqueues[i].lock);
+	lockstat_name(&runqueues[i].lock, LS_SPIN, "runqueue");
+	runqueues[i].min_vruntime = 0;
+  }
+  sleep_list.key = 0;
   sleep_list.qnext = sleep_list.qprev = &sleep_list;
-  reap_list.qnext = reap_list.qprev = &reap_list;
 
   return;
 }
@@ -47,7 +53,7 @@ int32_t enqueue(queue_t* queue, uint32_t threadid, bool delta) {
 	queue_t* node = &queue_table[threadid];
 	if(node->qprev != NULL || node->qnext != NULL) return -1; /* In a queue already. */
 	if(!delta) {
-		node->key = thread_table[threadid].priority;
+		node->key = (int64_t)thread_table[threadid].vruntime;
 	}
 
 	/* FIFO on same key in ascending order means same key is closer to tail, so...
@@ -1,17 +1,216 @@
 #include <system/thread.h>
 #include <system/syscall.h>
 #include <system/panic.h>
+#include <device/timer.h>
 #include <mm/vm.h>
 
-void reaper(void) {
-	while (1) {
-		wait_sem(&reaper_sem); /* Wait until work available */
-		while (reap_list.qnext != &reap_list) {
-			int32_t id = dequeue_thread(&reap_list);
-			if (id == -1) continue; /* Encountered a phantom thread. Not worth panicking over for now. */
-			kill_thread(id);
-		}
+#define SLEEPER_CREDIT (timer_interval / 2)  /*  How far behind 'min_vruntime' a waking thread may be placed  */
+#define BALANCE_TICKS  10                    /*  Ticks between periodic load balancing attempts on a hart     */
+
+/*  Weight of each priority level (the Linux CFS table, PRIO_DEFAULT = nice 0).  A thread's  *
+ *  vruntime advances by its real runtime scaled by NICE_0_WEIGHT / weight, so  heavier      *
+ *  threads must run for longer before they fall behind lighter ones in the ready list.      */
+static const uint32_t prio_to_weight[PRIO_LOWEST + 1] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,   335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,    36,    29,    23,    18,    15
+};
+
+/*  Charges a thread for the time it has run since it was last switched in or charged.  */
+static void update_vruntime(thread_t* thread, uint64_t now) {
+	uint64_t delta = now - thread->exec_start;
+	thread->vruntime += delta * NICE_0_WEIGHT / prio_to_weight[thread->priority];
+	thread->exec_start = now;
+}
+
+/*  Moves a run queue's 'min_vruntime' up to the smallest vruntime among the running  *
+ *  thread and the head of the queue.  It never moves backwards.                      */
+static void update_min_vruntime(runqueue_t* rq, thread_t* curr) {
+	uint64_t floor = (uint64_t)-1;
+	if (curr->state == TH_RUNNING)
+		floor = curr->vruntime;
+	if (rq->ready.qnext != &rq->ready && (uint64_t)rq->ready.qnext->key < floor)
+		floor = (uint64_t)rq->ready.qnext->key;
+	if (floor != (uint64_t)-1 && floor > rq->min_vruntime)
+		rq->min_vruntime = floor;
+}
+
+/*  A thread coming back from a wait keeps its vruntime, but may not trail 'min_vruntime'  *
+ *  by more than SLEEPER_CREDIT.  That gives interactive threads a small head start without  *
+ *  letting a long sleeper monopolize the CPU while it catches up.                         */
+static void place_thread(uint32_t threadid) {
+	thread_t* thread = &thread_table[threadid];
+	uint64_t min_vruntime = runqueues[thread->hart].min_vruntime;
+	uint64_t floor = min_vruntime > SLEEPER_CREDIT ? min_vruntime - SLEEPER_CREDIT : 0;
+	if (thread->vruntime < floor)
+		thread->vruntime = floor;
+}
+
+/*  Run queue primitives.  Each hart's queue has its own lock so that other harts  *
+ *  can take threads from it.  When two queues are locked, the lower hart first.   */
+static void rq_add(uint32_t hartid, uint32_t threadid) {
+	runqueue_t* rq = &runqueues[hartid];
+	uint64_t sie = spin_lock_irqsave(&rq->lock);
+	thread_table[threadid].hart = hartid;
+	enqueue_thread(&rq->ready, threadid);
+	++rq->nr_ready;
+	spin_unlock_irqrestore(&rq->lock, sie);
+}
+
+static int32_t rq_take(uint32_t hartid) {
+	runqueue_t* rq = &runqueues[hartid];
+	uint64_t sie = spin_lock_irqsave(&rq->lock);
+	int32_t threadid = dequeue_thread(&rq->ready);
+	if (threadid != -1) --rq->nr_ready;
+	spin_unlock_irqrestore(&rq->lock, sie);
+	return threadid;
+}
+
+static void rq_remove(uint32_t threadid) {
+	runqueue_t* rq = &runqueues[thread_table[threadid].hart];
+	uint64_t sie = spin_lock_irqsave(&rq->lock);
+	if (detach_thread(threadid, false) == 0) --rq->nr_ready;
+	spin_unlock_irqrestore(&rq->lock, sie);
+}
+
+/*  Threads waiting on a hart plus the one running there (idle threads do not count).  */
+static uint32_t hart_load(uint32_t hartid) {
+	return runqueues[hartid].nr_ready + (harts[hartid].current != harts[hartid].idle_thread ? 1 : 0);
+}
+
+/*  Moves a thread's vruntime from one queue's timeline to another's, keeping its  *
+ *  lag behind (or lead over) the queue's 'min_vruntime'.                          */
+static void migrate_vruntime(thread_t* thread, uint32_t from, uint32_t to) {
+	int64_t lag = (int64_t)(thread->vruntime - runqueues[from].min_vruntime);
+	int64_t moved = (int64_t)runqueues[to].min_vruntime + lag;
+	thread->vruntime = moved < 0 ? 0 : (uint64_t)moved;
+}
+
+/*  Moves up to 'count' threads from the tail of one hart's queue to another's.  The  *
+ *  tail holds the threads with the most vruntime, which are the least likely to be   *
+ *  about to run on their current hart.                                               */
+static uint32_t move_threads(uint32_t from, uint32_t to, uint32_t count) {
+	runqueue_t* src = &runqueues[from];
+	runqueue_t* dst = &runqueues[to];
+	runqueue_t* first = from < to ? src : dst;
+	runqueue_t* second = from < to ? dst : src;
+	uint32_t moved = 0;
+
+	uint64_t sie = spin_lock_irqsave(&first->lock);
+	spin_lock(&second->lock);
+	while (moved < count && src->ready.qprev != &src->ready) {
+		uint32_t threadid = (uint32_t)(src->ready.qprev - queue_table);
+		detach_thread(threadid, false);
+		--src->nr_ready;
+		migrate_vruntime(&thread_table[threadid], from, to);
+		thread_table[threadid].hart = to;
+		enqueue_thread(&dst->ready, threadid);
+		++dst->nr_ready;
+		++moved;
+	}
+	spin_unlock(&second->lock);
+	spin_unlock_irqrestore(&first->lock, sie);
+	return moved;
+}
+
+/*  Returns the online hart other than 'self' with the most queued threads, or  *
+ *  NHARTS if no other hart has a thread waiting.                               */
+static uint32_t busiest_hart(uint32_t self) {
+	uint32_t busiest = NHARTS;
+	for (uint32_t i = 0; i < NHARTS; ++i) {
+		if (i == self || !harts[i].online || runqueues[i].nr_ready == 0) continue;
+		if (busiest == NHARTS || hart_load(i) > hart_load(busiest))
+			busiest = i;
 	}
+	return busiest;
+}
+
+/*  Idle-time stealing.  A hart with nothing to run takes half (rounded up) of the  *
+ *  busiest queue and returns one of those threads to run now, or -1 if none.       */
+static int32_t steal_work(uint32_t self) {
+	uint32_t busiest = busiest_hart(self);
+	if (busiest == NHARTS) return -1;
+	move_threads(busiest, self, (runqueues[busiest].nr_ready + 1) / 2);
+	return rq_take(self);
+}
+
+/*  Periodic balancing, run from every hart's timer tick.  Every BALANCE_TICKS the  *
+ *  hart pulls threads from the busiest hart until their loads are within one.      */
+void balance_load(void) {
+	hart_t* hart = this_hart();
+	runqueue_t* rq = &runqueues[hart->id];
+	if (!hart->online || ++rq->ticks < BALANCE_TICKS) return;
+	rq->ticks = 0;
+
+	uint32_t busiest = busiest_hart(hart->id);
+	if (busiest == NHARTS) return;
+	uint32_t mine = hart_load(hart->id);
+	uint32_t theirs = hart_load(busiest);
+	if (theirs > mine + 1)
+		move_threads(busiest, hart->id, (theirs - mine) / 2);
+}
+
+/*  Picks the hart a new thread starts on: the least loaded online hart, staying on  *
+ *  'preferred' (normally the creating hart) unless another one is strictly lighter.  */
+uint32_t select_hart(uint32_t preferred) {
+	uint32_t best = preferred;
+	for (uint32_t i = 0; i < NHARTS; ++i) {
+		if (harts[i].online && hart_load(i) < hart_load(best))
+			best = i;
+	}
+	return best;
+}
+
+/*  Queues a thread that is becoming ready.  It goes back to the hart it last ran on  *
+ *  unless that hart is noticeably busier than the waking one, in which case it is    *
+ *  pulled over to the waker (whose caches likely hold whatever it is waking up for).  */
+static void wake_thread(uint32_t threadid) {
+	thread_t* thread = &thread_table[threadid];
+	uint32_t self = this_hart()->id;
+	uint32_t target = thread->hart;
+	if (!harts[target].online || (target != self && hart_load(target) > hart_load(self) + 1))
+		target = self;
+	if (target != thread->hart) {
+		migrate_vruntime(thread, thread->hart, target);
+		thread->hart = target;
+	}
+	thread->state = TH_READY;
+	place_thread(threadid);
+	rq_add(target, threadid);
+	kick_hart(target);
+}
+
+/*  Charges the time since a running thread's last mark to its user or system time.  */
+void charge_time(thread_t* thread, bool user) {
+	uint64_t now = r_time();
+	if (user) thread->acct.utime += now - thread->acct.mark;
+	else thread->acct.stime += now - thread->acct.mark;
+	thread->acct.mark = now;
+}
+
+/*  Changes a thread's priority and returns the old one.  The running thread is charged  *
+ *  at its old weight first.  Queued threads are keyed on vruntime, so they stay put.    */
+int32_t set_priority(uint32_t threadid, uint32_t priority) {
+	if (threadid >= NTHREADS || thread_table[threadid].state == TH_FREE || priority > PRIO_LOWEST)
+		return -1;
+	thread_t* thread = &thread_table[threadid];
+	if (threadid == current_thread)
+		update_vruntime(thread, r_time());
+	uint32_t old = thread->priority;
+	thread->priority = priority;
+	return old;
+}
+
+/*  Runs on the far side of every context switch, in the thread switched to.  A zombie  *
+ *  that switched away on this hart no longer runs on its stack or page table, so it    *
+ *  is freed here.                                                                      */
+void finish_switch(void) {
+	hart_t* hart = this_hart();
+	uint32_t zombie = hart->zombie;
+	if (zombie == NTHREADS) return;
+	hart->zombie = NTHREADS;
+	kill_thread(zombie);
 }
 
 /*  Takes a index into the thread table of a thread to resume.  If the thread is already  *
@@ -25,8 +224,7 @@ int32_t resume_thread(uint32_t threadid) {
 	if (thread_table[threadid].root_ppn == NULL) {
 		panic("A thread in the ready list had a null root ppn and was going to be resumed.\n");
 	}
-	thread_table[threadid].state = TH_READY;
-	enqueue_thread(&ready_list, threadid);
+	wake_thread(threadid);
 	return threadid;
 }
 
@@ -42,7 +240,7 @@ int32_t suspend_thread(uint32_t threadid) {
 	}
 
 	if (thread_table[threadid].state == TH_READY) {
-		detach_thread(threadid, false);
+		rq_remove(threadid);
 	}
 
 	thread_table[threadid].state = TH_SUSPEND;
@@ -55,7 +253,7 @@ int32_t sleep_thread(uint32_t threadid, uint32_t delay) {
 	if (threadid >= NTHREADS || thread_table[threadid].state != TH_READY) {
 		panic("Tried to sleep a thread that wasn't ready.\n");
 	}
-	detach_thread(threadid, false);
+	rq_remove(threadid);
 	thread_table[threadid].state = TH_SLEEP;
 	queue_t* node = &queue_table[threadid];
 	node->key = delay;
@@ -70,43 +268,82 @@ int32_t unsleep_thread(uint32_t threadid) {
 		panic("Tried to wake a thread that wasn't sleeping.\n");
 	}
 	detach_thread(threadid, true);
-	queue_t* node = &queue_table[threadid];
-	node->key = thread_table[threadid].priority;
-	thread_table[threadid].state = TH_READY;
-	enqueue_thread(&ready_list, threadid);
+	wake_thread(threadid);
 	return 0;
 }
 
+static wait_queue_t sleepers = WAIT_QUEUE_INIT;  /*  Nothing wakes it, its waiters only time out  */
+
+/*  Blocks the running thread for at least 'ms' milliseconds.  'sleep_thread' only  *
+ *  works on ready threads, so this waits out a timeout on a wait queue instead.    */
+void sleep_current(uint32_t ms) {
+	if (ms == 0) return;
+	(void)wait_event_timeout(&sleepers, false, ms);
+}
+
+/*  Called from hart 0's tick.  Wakes every thread whose timed wait is over.  */
+void expire_timers(void) {
+	uint64_t now = r_time();
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (thread_table[i].wake_at != 0 && thread_table[i].wake_at <= now) {
+			thread_table[i].wake_at = 0;
+			wait_expire(i);
+		}
+	}
+}
+
 static uint64_t get_satp(uint16_t asid, uint64_t root_ppn) {
 	return (8UL << 60) | ((uint64_t)asid << 44) | (root_ppn & ((1UL << 44) - 1));
 }
 
 void context_switch(thread_t* next, thread_t* prev) {
 	uint64_t satp = get_satp(next->asid, next->root_ppn);
+#ifdef BAREOS_FPU
+	fpu_switch(next, prev);
+#endif
 	ctxsw(prev->ctx, next->ctx, satp, (uint64_t)next->kstack_top);
 }
 
+/*  Moves the running thread into another address space, or back into its own.  The  *
+ *  record is changed first, so a switch away and back lands in the same one.       */
+void use_address_space(uint64_t root_ppn, uint16_t asid) {
+	thread_t* thread = &thread_table[current_thread];
+	thread->root_ppn = root_ppn;
+	thread->asid = asid;
+	uint64_t satp = get_satp(asid, root_ppn);
+	asm volatile("csrw satp, %0\n\tsfence.vma x0, x0" :: "r"(satp) : "memory");
+}
+
 void context_load(thread_t* first, uint32_t tid) {
 	if (tid < 0 || tid > NTHREADS)
 		panic("Attempted to context load an invalid thread id\n");
 	current_thread = tid;
 	thread_table[current_thread].state = TH_RUNNING;
+	thread_table[current_thread].exec_start = r_time();
+	thread_table[current_thread].acct.mark = thread_table[current_thread].exec_start;
 	uint64_t satp = get_satp(first->asid, first->root_ppn);
 	if ((uint64_t)first->kstack_top < KVM_BASE) {
 		panic("first ktop wasn't virtual\n");
 	}
 	first->ctx->sp = (uint64_t)first->kstack_top - sizeof(trapframe);
 	ctxload(satp, (uint64_t)first->kstack_top);
-	first->tf = (trapframe*)((uint64_t)first->tf + KVM_BASE);
-	first->ctx = (context*)((uint64_t)first->ctx + KVM_BASE);
+	if ((uint64_t)first->tf < KVM_BASE) { /* Only the boot thread is created before the MMU is on */
+		first->tf = (trapframe*)((uint64_t)first->tf + KVM_BASE);
+		first->ctx = (context*)((uint64_t)first->ctx + KVM_BASE);
+	}
+	this_hart()->online = 1;
+	kernel_exit((uint64_t*)first->tf);
 	trapret(first->tf);
 }
 
-/*  'resched' places the current running thread into the ready state  *
- *  and  places it onto  the tail of the  ready queue.  Then it gets  *
- *  the head  of the ready  queue  and sets this  new thread  as the  *
- *  'current_thread'.  Finally,  'resched' uses 'context_switch' to swap from  *
- *  the old thread to the new thread.                                 */
+/*  'resched' charges the running thread for the time it has used. If  *
+ *  it is still running and no ready thread has a smaller vruntime it  *
+ *  keeps the CPU.  Otherwise it is placed  back into the ready queue  *
+ *  (if still runnable), the head of  the ready queue becomes the new  *
+ *  'current_thread' and 'context_switch' swaps to it.  When the ready *
+ *  queue is empty  and the thread  cannot continue,  the hart's idle  *
+ *  thread is  switched to instead.   Idle threads  are never  placed  *
+ *  in the ready queue.                                                */
 
 #include <system/semaphore.h>
 extern void handle_syscall(uint64_t*);
@@ -122,13 +359,41 @@ void resched(void* caller) {
 	if (caller != &handle_syscall && caller != &wait_sem) /* This is a weak check, if you spoof this to violate policy I'm going to break your kneecaps */
 		panic("Policy violation detected, the scheduler was prompted in an inappropriate context.");
 
-	uint32_t new_thread = dequeue_thread(&ready_list);
-	if (new_thread == -1) return;
+	hart_t* hart = this_hart();
+	if (!hart->online) return; /* Secondary hart still on its way to 'context_load' */
+
+	runqueue_t* rq = &runqueues[hart->id];
+	bool idling = current_thread == hart->idle_thread;
+	thread_t* curr = &thread_table[current_thread];
+	uint64_t now = r_time();
+	if (!idling) {
+		update_vruntime(curr, now);
+		update_min_vruntime(rq, curr);
+	}
+
+	if (!idling && curr->state == TH_RUNNING && rq->ready.qnext != &rq->ready &&
+		curr->vruntime <= (uint64_t)rq->ready.qnext->key)
+		return;
+
+	int32_t new_thread = rq_take(hart->id);
+	if (new_thread == -1 && (idling || curr->state != TH_RUNNING))
+		new_thread = steal_work(hart->id);
+	if (new_thread == -1) {
+		if (idling || curr->state == TH_RUNNING || hart->idle_thread == NTHREADS) return;
+		new_thread = hart->idle_thread;
+	}
 
 	if (!MMU_ENABLED) {
 		panic("Can't resched - MMU is not enabled.");
 	}
 
+	/* Switching away, account for why.  Idle threads only ever give way to work */
+	charge_time(curr, false);
+	if (!idling) {
+		if (curr->state == TH_RUNNING) ++curr->acct.nivcsw;
+		else ++curr->acct.nvcsw;
+	}
+
 	if (thread_table[new_thread].root_ppn == NULL) {
 		panic("A thread in the ready list had a null root ppn and was going to be resumed.\n");
 	}
@@ -136,12 +401,20 @@ void resched(void* caller) {
 	uint32_t old_thread = current_thread;
 	current_thread = new_thread;
 	thread_table[new_thread].state = TH_RUNNING;
+	thread_table[new_thread].exec_start = now;
+	thread_table[new_thread].acct.mark = now;
 
-	if (thread_table[old_thread].state == TH_RUNNING || thread_table[old_thread].state == TH_READY) {
+	if (idling) {
+		thread_table[old_thread].state = TH_SUSPEND;
+	}
+	else if (thread_table[old_thread].state == TH_ZOMBIE) {
+		hart->zombie = old_thread;
+	}
+	else if (thread_table[old_thread].state == TH_RUNNING || thread_table[old_thread].state == TH_READY) {
 		thread_table[old_thread].state = TH_READY;
-		queue_table[old_thread].key = thread_table[old_thread].priority;
-		enqueue_thread(&ready_list, old_thread);
+		rq_add(hart->id, old_thread);
 	}
 
 	context_switch(&thread_table[new_thread], &thread_table[old_thread]);
+	finish_switch();
 }
\ No newline at end of file
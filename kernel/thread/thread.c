@@ -14,10 +14,10 @@
 #define SSTATUS_MXR   (1UL << 19)
 
 thread_t thread_table[NTHREADS];  /*  Create a table of threads  */
-uint32_t current_thread; 
 queue_t sleep_list;
 uint16_t next_asid;
-semaphore_t reaper_sem; /* Wakes the reaper only when new zombies are reapable. */
+
+#define USTACK_TOP 0x400000UL  /*  Statically allocated by the simple allocator: top of the second user megapage  */
 
 /*
  *  'thread_init' sets up the thread table so that each thread is
@@ -27,24 +27,35 @@ semaphore_t reaper_sem; /* Wakes the reaper only when new zombies are reapable.
 void init_threads(void) {
 	for (uint32_t i = 0; i < NTHREADS; i++) {
 		thread_table[i].stackptr = NULL;
-		thread_table[i].priority = 0;
+		thread_table[i].priority = PRIO_DEFAULT;
+		thread_table[i].vruntime = 0;
+		thread_table[i].exec_start = 0;
 		thread_table[i].parent = NTHREADS;
 		thread_table[i].asid = i;
 		thread_table[i].state = TH_FREE;
-		thread_table[i].sem = create_sem(0);
+		init_wait_queue(&thread_table[i].exit_wq);
+		init_wait_queue(&thread_table[i].child_wq);
+		thread_table[i].wq = NULL;
+		thread_table[i].wake_at = 0;
+		thread_table[i].wq_sem = create_sem(0);
 		thread_table[i].mode = MODE_S;
+		memset(&thread_table[i].acct, 0, sizeof(acct_t));
+		thread_table[i].name[0] = '\0';
+		thread_table[i].acting_for = i;
 	}
 	next_asid = 1;
-	reaper_sem = create_sem(0);
 }
 
-/* This is where processes wait to be reaped. It's its own function for debugging clarity. */
-static void wait_for_reaper(void) {
-	post_sem(&reaper_sem);
-	while (1);
+/* This is where finished threads end up. The thread is already a zombie, so the reschedule *
+ * switches away from it for good and 'finish_switch' frees it on the hart's next switch.  */
+static void exit_thread(void) {
+	pend_resched(RESCHED);
+	while (1); /* Not reached, the SSIP is taken before the first iteration */
 }
 
 static void landing_pad(void) {
+	finish_switch();
+	kernel_exit((uint64_t*)thread_table[current_thread].tf);
 	trapret(thread_table[current_thread].tf);
 }
 
@@ -55,8 +66,7 @@ static void wrapper(uint8_t(*proc)()) {
 	thread_t* thread = &thread_table[current_thread];
 	thread->retval = proc();
 	thread->state = TH_ZOMBIE;
-	enqueue_thread(&reap_list, current_thread);
-	wait_for_reaper();
+	exit_thread();
 }
 
 /* user_thread_exit is a jump point after a user process sends an ecall to exit */
@@ -64,33 +74,24 @@ void user_thread_exit(trapframe* tf) {
 	thread_t* thread = &thread_table[current_thread];
 	thread->retval = (uint8_t)(tf->a0 & 0xFF);
 	thread->state = TH_ZOMBIE;
-	enqueue_thread(&reap_list, current_thread);
 	tf->sstatus |= SSTATUS_SPP | SSTATUS_SPIE;
-	tf->sepc = (uint64_t)wait_for_reaper;
+	tf->sepc = (uint64_t)exit_thread;
+	pend_resched(RESCHED); /* Taken as soon as the ecall returns, before 'exit_thread' runs */
 }
 
-/*  `create_thread`  takes a pointer  to a function that  acts as the entry  *
- *  point for a thread and selects an unused entry in the thread table.  It  *
- *  configures this  entry to represent a newly  created thread running the  *
- *  entry point function and places it in the suspended state.               */
-int32_t create_thread(void* proc, thread_mode mode) {
-	uint64_t new_id;
-	/* Statically allocated by the simple allocator */
-	const uint64_t STACK_BASE = 0x200000UL;
-	const uint64_t STACK_SIZE = 0x200000UL;
-
-	for (new_id = 0; new_id < NTHREADS && thread_table[new_id].state != TH_FREE; new_id++); /*  Find the first TH_FREE entry in the thread table    */
+/*  Finds the first TH_FREE entry in the thread table  */
+static uint32_t find_free_entry(void) {
+	uint32_t new_id;
+	for (new_id = 0; new_id < NTHREADS && thread_table[new_id].state != TH_FREE; new_id++);
 	if (new_id == NTHREADS) {
 		panic("No free thread entries in the thread table for this new thread. No handler exists to wait for one to become free.\n");
 	}
-	thread_t* thread = &thread_table[new_id];
-
-	/* Allocate per-thread address space for VM */
-	uint64_t root_ppn = alloc_page(new_id);
-	if (root_ppn == NULL) {
-		panic("Page allocator failed to allocate a page for this new thread.\n");
-	}
+	return new_id;
+}
 
+/*  Lays out the context and trapframe at the top of a thread's kernel stack and  *
+ *  returns the (zeroed) trapframe for the caller to fill in.                     */
+static trapframe* init_frames(thread_t* thread) {
 	/* Layout: [ kernel stack � ][ trapframe ][ context ][TOP] */
 	byte* ktop = thread->kstack_top; /* Virtual if MMU on, physical if MMU off */
 	if (ktop == NULL) {
@@ -105,31 +106,78 @@ int32_t create_thread(void* proc, thread_mode mode) {
 	ctx->ra = (uint64_t)landing_pad; /* Starter ret landing pad for new threads */
 
 	memset(tf, 0, sizeof(trapframe));
+	thread->tf = tf;
+	thread->ctx = ctx;
+	thread->stackptr = (uint64_t*)ktop;
+	return tf;
+}
+
+/*  Fills in the rest of a new thread's record.  The thread starts suspended as a  *
+ *  child of the calling thread, with its priority and working directory.  That is *
+ *  the current thread, unless an 'ecall_wq' worker is spawning on its behalf.     */
+static void init_record(thread_t* thread, uint64_t root_ppn, uint16_t asid, thread_mode mode) {
+	thread->root_ppn = root_ppn;
+	thread->asid = asid;
+	thread->state = TH_SUSPEND;
+	thread->priority = thread_table[caller_thread].priority; /* Children inherit their parent's priority */
+	thread->hart = select_hart(this_hart()->id);
+	thread->vruntime = runqueues[thread->hart].min_vruntime;
+	thread->parent = caller_thread;
+	init_wait_queue(&thread->exit_wq);
+	init_wait_queue(&thread->child_wq);
+	thread->wq = NULL;
+	thread->wake_at = 0;
+	thread->wq_sem = create_sem(0);
+	thread->mode = mode;
+	thread->ustack = 0;
+	thread->cwd = boot_fsd->super.root_dirent;
+	thread->files = NULL;
+	thread->acting_for = (uint32_t)(thread - thread_table);
+	memset(&thread->acct, 0, sizeof(acct_t));
+	/* Kernel threads get a generic label, user threads keep their creator's name until exec renames them */
+	set_thread_name((uint32_t)(thread - thread_table), mode == MODE_S ? "kthread" : thread_table[caller_thread].name);
+}
+
+/*  Names a thread for accounting and 'top'.  Names are cut to THREAD_NAME_LEN - 1.  */
+void set_thread_name(uint32_t threadid, const char* name) {
+	if (threadid >= NTHREADS) return;
+	char* dst = thread_table[threadid].name;
+	if (dst == name) return;
+	uint32_t i = 0;
+	for (; i < THREAD_NAME_LEN - 1 && name[i] != '\0'; ++i) dst[i] = name[i];
+	dst[i] = '\0';
+}
+
+/*  `create_thread`  takes a pointer  to a function that  acts as the entry  *
+ *  point for a thread and selects an unused entry in the thread table.  It  *
+ *  configures this  entry to represent a newly  created thread running the  *
+ *  entry point function and places it in the suspended state.               */
+int32_t create_thread(void* proc, thread_mode mode) {
+	uint32_t new_id = find_free_entry();
+	thread_t* thread = &thread_table[new_id];
+
+	/* Allocate per-thread address space for VM */
+	uint64_t root_ppn = mode == MODE_U ? alloc_user_page(new_id) : alloc_page(new_id); /* User pages come zeroed */
+	if (root_ppn == NULL) {
+		panic("Page allocator failed to allocate a page for this new thread.\n");
+	}
+
+	trapframe* tf = init_frames(thread);
 	if (mode == MODE_S) {
 		tf->sstatus = SSTATUS_SPP | SSTATUS_SPIE | SSTATUS_SUM;
 		tf->sepc = (uint64_t)wrapper;             /* first PC */
 		tf->a0 = (uint64_t)proc;                  /* wrapper(proc) */
-		tf->ra = (uint64_t)wait_for_reaper;       /* if wrapper ever returns */
+		tf->ra = (uint64_t)exit_thread;           /* if wrapper ever returns */
 	}
 	else {
 		tf->sstatus = SSTATUS_SPIE | SSTATUS_SUM;
 		tf->sepc = (uint64_t)proc;
 		tf->ra = 0;
 	}
-	tf->sp = STACK_BASE + STACK_SIZE - 0x20;
+	tf->sp = USTACK_TOP - 0x20;
 	
 	/* Publish into thread record */
-	thread->tf = tf;
-	thread->ctx = ctx;
-	thread->stackptr = (uint64_t*)ktop;
-	thread->root_ppn = root_ppn;
-	thread->asid = next_asid++;
-	thread->state = TH_SUSPEND;
-	thread->priority = 0;
-	thread->parent = current_thread;
-	thread->sem = create_sem(0);
-	thread->mode = mode;
-	thread->cwd = boot_fsd->super.root_dirent;
+	init_record(thread, root_ppn, next_asid++, mode);
 
 	/* First thread means these were set to physical and have to be virtual after being loaded */
 	if (!MMU_ENABLED) {
@@ -140,50 +188,146 @@ int32_t create_thread(void* proc, thread_mode mode) {
 	return new_id;
 }
 
-/*  Takes an index into the thread_table.  If the thread is TH_DEFUNCT,  *
- *  mark  the thread  as TH_FREE  and return its  `retval`.   Otherwise  *
- *  raise RESCHED and loop to check again later.                         */
+/*  Clone stacks are mapped a page at a time above the user megapages, so the main stack  *
+ *  keeps the whole second megapage.  Slot 'n' ends where the guard page of slot 'n + 1'   *
+ *  starts and its own guard page is left unmapped, so an overflow faults instead of       *
+ *  running into another thread's stack.  The pages stay mapped for the next thread in     *
+ *  the slot and are freed with the address space.                                        */
+static uint64_t clone_stack_top(uint8_t slot) {
+	return USTACK_CLONE_BASE + (uint64_t)slot * (USTACK_SIZE + PAGE_SIZE);
+}
+
+static int32_t map_clone_stack(uint64_t root_ppn, uint8_t slot) {
+	uint64_t top = clone_stack_top(slot);
+	for (uint64_t va = top - USTACK_SIZE; va < top; va += PAGE_SIZE) {
+		if (translate_user_address(root_ppn, va) == NULL && map_user_page(root_ppn, va) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*  `clone_thread` creates a user thread that shares the current thread's address space  *
+ *  and ASID.  It starts at 'entry' with 'arg0' and 'arg1' in a0 and a1, on the first     *
+ *  free clone stack slot.  Returns the new thread's index, or -1 if the caller isn't a   *
+ *  user thread, or the thread table, the stack slots or the pages for a stack have run   *
+ *  out.  Any user program can call this, so running out is never fatal.                  */
+int32_t clone_thread(uint64_t entry, uint64_t arg0, uint64_t arg1) {
+	thread_t* self = &thread_table[current_thread];
+	if (self->mode != MODE_U) return -1;
+
+	uint32_t new_id = 0;
+	while (new_id < NTHREADS && thread_table[new_id].state != TH_FREE) ++new_id;
+	if (new_id == NTHREADS) return -1;
+
+	uint32_t used = 0;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		if (thread_table[i].state != TH_FREE && thread_table[i].root_ppn == self->root_ppn)
+			used |= 1U << thread_table[i].ustack;
+	}
+	uint8_t slot = 1; /* Slot 0 stays the main stack's, even after the main thread exits */
+	while (slot < USTACK_SLOTS && (used & (1U << slot))) ++slot;
+	if (slot == USTACK_SLOTS) return -1;
+
+	thread_t* thread = &thread_table[new_id];
+	if (map_clone_stack(self->root_ppn, slot) < 0) return -1;
+	if (alloc_kstack(new_id) < 0) return -1;
+
+	trapframe* tf = init_frames(thread);
+	tf->sstatus = SSTATUS_SPIE | SSTATUS_SUM;
+	tf->sepc = entry;
+	tf->a0 = arg0;
+	tf->a1 = arg1;
+	tf->ra = 0;
+	tf->sp = clone_stack_top(slot) - 0x20;
+
+	init_record(thread, self->root_ppn, self->asid, MODE_U);
+	thread->cwd = self->cwd;
+	thread->files = self->files;
+	if (thread->files != NULL) ++thread->files->refs;
+	thread->ustack = slot;
+	return new_id;
+}
+
+/*  Takes an index into the thread_table.  Waits until the thread is  *
+ *  TH_DEFUNCT, then marks it as TH_FREE and returns its `retval`.     */
 int32_t join_thread(uint32_t threadid) {
 	thread_t* thread = &thread_table[threadid];
 	if (threadid >= NTHREADS || thread->state == TH_FREE) {
 		return -1;
 	}
 
-	if (thread->state != TH_DEFUNCT) {
-		wait_sem(&thread->sem);
-	}
+	wait_event(&thread->exit_wq, thread->state == TH_DEFUNCT || thread->state == TH_FREE);
+	if (thread->state == TH_FREE) return -1; /* Another joiner or an orphan cleanup took it */
 
 	thread->state = TH_FREE;
 	return thread->retval;
 }
 
+/*  Finds a finished child of the current thread matching 'threadid' (-1 for any).  *
+ *  Returns its index, 0 if the matching children are all still running, or -1 if  *
+ *  there are none.                                                                 */
+static int32_t finished_child(int32_t threadid) {
+	bool found = false;
+	for (uint32_t i = 0; i < NTHREADS; ++i) {
+		thread_t* child = &thread_table[i];
+		if (i == current_thread || child->state == TH_FREE || child->parent != current_thread) continue;
+		if (threadid != -1 && i != threadid) continue;
+		if (child->state == TH_DEFUNCT) return i;
+		found = true;
+	}
+	return found ? 0 : -1;
+}
+
+/*  Collects a finished child of the current thread: the one given by 'threadid', or  *
+ *  any child when it is -1.  Returns the child's index and stores its return value   *
+ *  in 'retval'.  Returns 0 if 'nohang' is set and no matching child has finished yet  *
+ *  (0 is the root thread, which is never anyone's child), or -1 if there is no       *
+ *  matching child at all.                                                            */
+int32_t wait_child(int32_t threadid, uint8_t* retval, bool nohang) {
+	thread_t* self = &thread_table[current_thread];
+	int32_t child = finished_child(threadid);
+	if (child == 0 && !nohang) {
+		wait_event(&self->child_wq, finished_child(threadid) != 0); /* Woken by 'kill_thread' */
+		child = finished_child(threadid);
+	}
+	if (child > 0) {
+		*retval = thread_table[child].retval;
+		thread_table[child].state = TH_FREE;
+	}
+	return child;
+}
+
 /* Takes an index into the thread table and marks the thread as defunct and *
  * frees up any resources it was using. This can only be called by the      *
- * scheduler looking through the reap_list of to-be-killed threads after    *
- * their context is swapped from for the last time. So there's no possible  *
+ * scheduler's 'finish_switch' on the far side of a zombie's last context  *
+ * switch, once nothing runs on its stack or page table. So there's no possible  *
  * chance of context corruption from freeing pages                          */
 int32_t kill_thread(uint32_t thread_id) {
 	thread_t* thread = &thread_table[thread_id];
 	if (thread_id >= NTHREADS || thread->state == TH_FREE) /*                                                             */
 		return -1;                                                       /*  Return if the requested thread is invalid or already free  */
 
-	/* TODO: This is lousy and unsafe. Doesn't properly reap anything. */
-	/* Actually don't do this at all, this kills the idle and shell when root is reaped LOL 
-	
+	/* Children outlive their parent as orphans nobody will wait for.  Finished ones are  *
+	 * freed now and the rest are freed as soon as they are reaped.                        */
 	for (uint32_t i = 0; i < NTHREADS; ++i) {
-		if (thread->parent == threadid) {
-			thread->state = TH_FREE;
-		}
+		if (i == thread_id || thread_table[i].parent != thread_id || thread_table[i].state == TH_FREE) continue;
+		if (thread_table[i].state == TH_DEFUNCT) thread_table[i].state = TH_FREE;
+		else thread_table[i].parent = NTHREADS;
 	}
-	*/
 
+	wait_remove(thread_id);              /*  Off any wait queue it was still on   */
 	if (thread->root_ppn != kernel_root_ppn) {
 		free_process_pages(thread_id);   /*  Free pages associated with thread     */
 	}
 	thread->root_ppn = NULL;
-	post_sem(&thread->sem); /* Notify waiting threads. */
-	free_sem(&thread->sem); /* Calls resched after dumping children. */
+	fdtable_put_deferred(thread->files); /*  The last thread of a process has its files closed  */
+	thread->files = NULL;
 
 	thread->state = TH_DEFUNCT;         /*  Set the thread's state to TH_DEFUNCT  */
+	if (thread->parent == NTHREADS)
+		thread->state = TH_FREE;        /*  Orphans have nobody to collect them   */
+	else
+		wake_up_all(&thread_table[thread->parent].child_wq);
+	wake_up_all(&thread->exit_wq);      /*  Notify joining threads                */
 	return 0;
 }
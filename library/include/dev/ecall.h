@@ -2,31 +2,121 @@
 #define H_ECALL
 
 #include <barelib.h>
-
-/* TEMPORARY */
-#define UART_DEV_NUM 0
-#define DISK_DEV_NUM 1
-#define RTC_DEV_NUM  2
+#include <dev/io_iface.h>
+#include <dev/time.h>
 
 /* Enum assigns identifying numbers to different ecalls    *
- * This is based on common linux numbering but not exactly */
+ * This is based on common linux numbering but not exactly *
+ * Arguments are passed in a0..a5 and the result in a0    */
 typedef enum {
 	ECALL_GDEV  = 0,   /* Request a list of available devices   */ /* This is a temp solution until we can enumerate devices properly */
 	ECALL_PWOFF = 1,   /* Request immediate shutdown            */ /* This is a temp solution until better power options support      */
 	ECALL_RBOOT = 2,   /* Request immediate reboot              */ /* This is a temp solution until better power options support      */
-	ECALL_OPEN  = 56,  /* Call the open() function of a device  */
-	ECALL_CLOSE = 57,  /* Call the close() function of a device */
-	ECALL_READ  = 63,  /* Call the read() function of a device  */
-	ECALL_WRITE = 64,  /* Call the write() function of a device */
+	ECALL_MKDIR = 34,  /* Create a directory                    */
+	ECALL_UNLINK = 35, /* Delete a file                         */
+	ECALL_RMDIR = 36,  /* Delete an empty directory             */
+	ECALL_GETDIR = 49, /* Resolve a directory, optionally chdir */
+	ECALL_CREATE = 55, /* Create a file                         */
+	ECALL_OPEN  = 56,  /* Open a file, returns its fd           */
+	ECALL_CLOSE = 57,  /* Close an fd                           */
+	ECALL_READDIR = 61,/* List the entries of a directory       */
+	ECALL_READ  = 63,  /* Read from an fd                       */
+	ECALL_WRITE = 64,  /* Write to an fd                        */
+	ECALL_TTY_READ = 65,  /* Read a line from the console       */
+	ECALL_TTY_WRITE = 66, /* Write to the console               */
+	ECALL_FSTAT = 80,  /* Copy out the inode of an open fd      */
 	ECALL_SPAWN = 92,  /* Spawn a child of the current process  */
-	ECALL_EXIT  = 93   /* Exit a user process                   */
+	ECALL_EXIT  = 93,  /* Exit a user process                   */
+	ECALL_FUTEX = 98,  /* Wait on or wake a word of user memory */
+	ECALL_SLEEP = 101, /* Sleep for a number of milliseconds    */
+	ECALL_CLOCK = 113, /* Read the time counter (fast path)     */
+	ECALL_RTC_READ = 114, /* Seconds since the epoch from the RTC */
+	ECALL_YIELD = 124, /* Give up the rest of the time slice (fast path) */
+	ECALL_SETPRIO = 140, /* Change the priority of a process    */
+	ECALL_GETTZ = 169,   /* Copy out the current timezone rule  */
+	ECALL_SETTZ = 170,   /* Change the timezone                 */
+	ECALL_GETPID = 172,  /* Thread id of the caller (fast path) */
+	ECALL_CLONE = 220,   /* Start a thread in the same process  */
+	ECALL_WAITPID = 260, /* Collect a finished child process    */
+	ECALL_TSTAT = 300,   /* Snapshot the counters of every thread */
+	ECALL_LOCKSTAT = 301, /* Snapshot the lock contention counters (lockstat=1 kernels) */
+	ECALL_RING_SETUP = 425, /* Map the process' submission ring (see dev/ring.h) */
+	ECALL_RING_ENTER = 426  /* Run the queued submissions in one trap */
 } ecall_number;
 
-uint64_t ecall_open(uint32_t, byte*);
-uint64_t ecall_close(uint32_t, byte*);
-uint64_t ecall_read(uint32_t, byte*);
-uint64_t ecall_write(uint32_t, byte*);
+#define WNOHANG 0x1  /* ECALL_WAITPID option: return 0 instead of blocking */
+
+#define FUTEX_WAIT 0 /* ECALL_FUTEX ops: sleep while the word holds a value, */
+#define FUTEX_WAKE 1 /* or wake up to that many of its waiters               */
+
+#define TSTAT_NAME_LEN 16
+
+/* One entry of the ECALL_TSTAT snapshot.  Times are in 'rdtime' ticks, RDTIME_HZ a second. */
+typedef struct {
+	uint32_t tid;
+	int32_t parent;      /* -1 if the thread has no parent */
+	uint32_t priority;
+	uint32_t hart;       /* Hart whose run queue the thread belongs to */
+	uint32_t mode;       /* 0 for supervisor threads, 1 for user */
+	char state;          /* R running, Q queued, W waiting, S sleeping, T suspended, Z finished */
+	char name[TSTAT_NAME_LEN];
+	uint64_t utime;      /* Time spent running in user mode */
+	uint64_t stime;      /* Time spent running in the kernel */
+	uint64_t wait_time;  /* Time spent blocked on semaphores */
+	uint64_t nvcsw;      /* Switches away because the thread blocked or yielded */
+	uint64_t nivcsw;     /* Switches away because the thread was preempted */
+	uint64_t faults;     /* Page faults taken */
+} thread_stat_t;
+
+#define LSTAT_NAME_LEN 16
+#define LSTAT_TOP 3          /* Longest waiters reported for each lock                  */
+#define LSTAT_RESET 0x1      /* ECALL_LOCKSTAT flag: zero the counters once copied out  */
+
+/* One entry of the ECALL_LOCKSTAT snapshot.  Times are in 'rdtime' ticks, RDTIME_HZ a second. */
+typedef struct {
+	uint64_t lock;       /* Kernel address of the lock */
+	uint64_t site;       /* Kernel address it was first taken from, look it up in the kernel map */
+	char kind;           /* S spinlock, M MCS lock, W semaphore, Q wait queue */
+	char name[LSTAT_NAME_LEN]; /* Empty unless the kernel named the lock */
+	uint64_t acquired;
+	uint64_t contended;  /* Acquisitions that had to spin or sleep */
+	uint64_t wait_total; /* Time spent spinning or asleep for it */
+	uint64_t wait_max;
+	int32_t top_tid[LSTAT_TOP];  /* Threads that waited longest for it, -1 past the last */
+	uint64_t top_wait[LSTAT_TOP];
+} lock_stat_t;
+
+uint64_t ecall_tty_write(const byte*, uint32_t);
+uint64_t ecall_tty_read(byte*, uint32_t);
+uint64_t ecall_create(const char*);
+uint64_t ecall_open(const char*);
+uint64_t ecall_close(FD);
+uint64_t ecall_read(FD, byte*, uint32_t);
+uint64_t ecall_write(FD, const byte*, uint32_t);
+uint64_t ecall_fstat(FD, inode_t*);
+uint64_t ecall_unlink(const char*);
+uint64_t ecall_mkdir(const char*, dirent_t*);
+uint64_t ecall_rmdir(const char*);
+uint64_t ecall_readdir(const char*, dirent_t*, uint32_t);
+uint64_t ecall_getdir(const char*, directory_t*, bool);
+uint64_t ecall_rtc_read(void);
+uint64_t ecall_gettz(tzrule*);
+uint64_t ecall_settz(const char*);
 uint64_t ecall_spawn(char*, char*);
+uint64_t ecall_setprio(int32_t, uint32_t);
+uint64_t ecall_clone(uint64_t, uint64_t, uint64_t);
+uint64_t ecall_futex(volatile uint32_t*, uint32_t, uint32_t);
+uint64_t ecall_waitpid(int32_t, uint8_t*, uint32_t);
+uint64_t ecall_wait(uint8_t*);
+uint64_t ecall_sleep(uint32_t);
+uint64_t ecall_getpid(void);
+uint64_t ecall_clock(void);
+void ecall_yield(void);
+uint64_t ecall_tstat(thread_stat_t*, uint32_t);
+uint64_t ecall_lockstat(lock_stat_t*, uint32_t, uint32_t);
+uint64_t ecall_ring_setup(void);
+uint64_t ecall_ring_enter(uint32_t);
+void ecall_exit(uint8_t);
 void ecall_pwoff(void);
 void ecall_rboot(void);
 
@@ -8,6 +8,9 @@
 void printf(const char*, ...);
 void sprintf(byte*, const char*, ...);
 int32_t gets(char*, uint32_t);
+uint32_t num_digits(uint64_t);
+void print_pad(uint32_t, uint32_t);
+void print_column(uint64_t, uint32_t);
 
 int8_t fcreate(const char*);
 int8_t fopen(const char*, FILE*);
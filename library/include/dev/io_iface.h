@@ -5,23 +5,10 @@
 #define FILENAME_LEN 56  /* Arbitrary maximum length of a filename in the FS */
 #define MAX_PATH_DEPTH 32 /* Arbitrary path depth limit for searching */
 #define MAX_PATH_LEN ((FILENAME_LEN * MAX_PATH_DEPTH) + MAX_PATH_DEPTH + 1) /* Enough for max depth count filenames plus '/' for each */
-typedef uint8_t FD;
+typedef int32_t FD; /* Index into the process' fd table, negative if not open */
 
 typedef enum { EN_FREE, EN_BUSY, EN_FILE, EN_DIR } EN_TYPE;
 
-typedef enum {
-	FILE_CREATE,
-	FILE_OPEN,
-	FILE_READ,
-	FILE_WRITE,
-	FILE_TRUNCATE,
-	DIR_CREATE,
-	DIR_OPEN,
-	DIR_READ,
-	DIR_WRITE,
-	DIR_TRUNCATE,
-} DISKMODE;
-
 /* 'inode_t' are stored in the block device and contain all of the information needed by the file system      *
  * to read from and write to a given file or directory. Eact dirent (a file or directory) has a single inode. *
  * All inodes are serialized to the block device in a secret non-inode chain of blocks, walkable via the fsd  *
@@ -34,8 +21,8 @@ typedef struct {
 	uint32_t modified;   /* UNUSED - Last modified in Unix time                             */
 } inode_t;
 
-/* 'FILE' wraps the index into the oft with a copy of the inode
-   A temporary solution until a better stat method comes about  */
+/* 'FILE' pairs an fd with a copy of the file's inode taken by fopen().
+   The kernel keeps the real open file state, the copy is only a stat  */
 typedef struct {
 	FD fd;
 	inode_t inode;
@@ -57,19 +44,4 @@ typedef struct {
 	dirent_t dir;
 } directory_t;
 
-/* Options for io ecall request */
-typedef struct {
-	byte* buffer;
-	uint32_t length;
-} uart_dev_opts;
-
-/* Options for disk ecall request */
-typedef struct {
-	DISKMODE mode;
-	FILE* file;
-	byte* buff_in;
-	byte* buff_out;
-	uint32_t length;
-} disk_dev_opts;
-
 #endif
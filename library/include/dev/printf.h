@@ -10,6 +10,7 @@
 /* Impl must provide this. Returns updated ptr. */
 extern byte* printf_putc(char c, uint8_t mode, byte* ptr);
 
+char* get_color_str(char t);
 void printf_core(uint8_t mode, byte* ptr, const char* format, va_list ap);
 
 #endif
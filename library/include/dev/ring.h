@@ -0,0 +1,47 @@
+#ifndef H_RING
+#define H_RING
+
+#include <barelib.h>
+
+#define RING_VA      0x400000UL  /* Where ECALL_RING_SETUP maps the ring, just above the user stacks */
+#define RING_SQ_SIZE 64          /* Both sizes must be powers of two, the indices run freely and are */
+#define RING_CQ_SIZE 64          /* masked when an entry is picked                                   */
+
+/* A submission entry asks for one ecall.  Only the file and console output ecalls are  *
+ * accepted, anything else completes with -1.  They never wait for input, but an entry  *
+ * may sleep on a filesystem lock or until the console has room, and the rest of the    *
+ * batch waits with it.                                                                  */
+typedef struct {
+	uint32_t ecall;      /* An 'ecall_number'                          */
+	uint32_t _pad;
+	uint64_t args[3];    /* Passed in a0..a2, as if the ecall was made */
+	uint64_t user_data;  /* Copied into the completion untouched       */
+} ring_sqe_t;
+
+typedef struct {
+	uint64_t user_data;
+	uint64_t result;     /* What the ecall returned */
+} ring_cqe_t;
+
+/* One page shared by a process and the kernel.  The program fills 'sq' and moves       *
+ * 'sq_tail', the kernel consumes up to it during ECALL_RING_ENTER and posts a          *
+ * completion for each entry, in order.  The program then reads 'cq' up to 'cq_tail'.   *
+ * Each side only writes its own index.  Threads of a process share the ring, so only   *
+ * one of them should drive it at a time.                                               */
+typedef struct {
+	volatile uint32_t sq_head;   /* Kernel: next entry to consume    */
+	volatile uint32_t sq_tail;   /* Program: next free entry         */
+	volatile uint32_t cq_head;   /* Program: next completion to read */
+	volatile uint32_t cq_tail;   /* Kernel: next completion to post  */
+	ring_sqe_t sq[RING_SQ_SIZE];
+	ring_cqe_t cq[RING_CQ_SIZE];
+} ring_t;
+
+_Static_assert(sizeof(ring_t) <= 0x1000, "ring_t must fit in one page");
+
+ring_t* ring_setup(void);
+bool ring_queue(ring_t*, uint32_t, uint64_t, uint64_t, uint64_t, uint64_t);
+int32_t ring_submit(ring_t*);
+bool ring_reap(ring_t*, ring_cqe_t*);
+
+#endif
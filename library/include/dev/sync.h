@@ -0,0 +1,30 @@
+#ifndef H_DEV_SYNC
+#define H_DEV_SYNC
+
+#include <barelib.h>
+
+/* User mutexes and condition variables built on ECALL_FUTEX. Neither traps into the *
+ * kernel unless a thread actually has to wait or there is a waiter to wake.        */
+typedef struct {
+	volatile uint32_t state;   /* 0 unlocked, 1 locked, 2 locked with (possible) waiters */
+} mutex_t;
+
+typedef struct {
+	volatile uint32_t seq;     /* Bumped by every signal, waiters sleep on it           */
+	volatile uint32_t waiters; /* Threads inside 'cond_wait', lets signal skip the trap */
+} cond_t;
+
+#define MUTEX_INIT { 0 }
+#define COND_INIT  { 0, 0 }
+
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+bool mutex_trylock(mutex_t*);
+void mutex_unlock(mutex_t*);
+
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef H_DEV_THREAD
+#define H_DEV_THREAD
+
+#include <barelib.h>
+
+/* Threads made with 'thread_create' share the process' memory. Each has its own 64KiB *
+ * stack with an unmapped page below it, so overflowing it ends the thread with a      *
+ * fault. A process can have up to 7 of them besides its main thread.                  */
+typedef uint8_t (*thread_func_t)(void*);
+
+int32_t thread_create(thread_func_t, void*);
+int32_t thread_join(int32_t, uint8_t*);
+
+#endif
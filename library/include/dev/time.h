@@ -4,15 +4,7 @@
 #include <barelib.h>
 
 #define TIME_BUFF_SZ 34
-
-typedef enum { GET_SEC, GET_TZ } get_type;
-
-/* Options for rtc ecall request */
-typedef struct {
-	byte* buffer;
-	uint8_t length;
-	get_type type;
-} rtc_dev_opts;
+#define RDTIME_HZ 10000000UL  /* Rate of 'rdtime', the QEMU virt timebase */
 
 typedef struct {
 	uint8_t mon, week, wday, hh;
@@ -40,6 +32,27 @@ typedef struct {
 	uint8_t  second; /* 0-59 */
 } datetime;
 
+#define VDSO_TIME_VA 0x401000UL  /* Read-only page the kernel keeps the clock and timezone in */
+
+/* Mapped into every address space so 'rtc_read' and 'rtc_gettz' don't need an ecall. *
+ * The kernel makes 'seq' odd while it updates the page, readers retry until they     *
+ * copy it with the same even 'seq' before and after.  0 means it was never filled.   */
+typedef struct {
+	volatile uint32_t seq;
+	uint32_t _pad;
+	uint64_t base_ns;      /* Nanoseconds since the epoch when the time counter read 'base_ticks' */
+	uint64_t base_ticks;
+	uint64_t timebase_hz;  /* Rate of the time counter */
+	tzrule tz;             /* The active timezone      */
+} vdso_time_t;
+
+/* Reads the time counter, 'RDTIME_HZ' ticks per second */
+static inline uint64_t rdtime(void) {
+	uint64_t t;
+	asm volatile("rdtime %0" : "=r"(t));
+	return t;
+}
+
 datetime seconds_to_dt(uint64_t);
 uint64_t dt_to_seconds(datetime);
 void dt_to_string(datetime, char*, uint8_t);
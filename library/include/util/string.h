@@ -10,5 +10,6 @@ char* strstr(const char*, const char*);
 void* memset(void*, uint8_t, uint64_t);
 void* memcpy(void*, const void*, uint64_t);
 int16_t memcmp(const void*, const void*, uint64_t);
+uint64_t parse_u64(const char*);
 
 #endif
@@ -7,6 +7,13 @@ static inline uint64_t ecall0(uint64_t signum) {
 	return a0;
 }
 
+static inline uint64_t ecall1(uint64_t signum, uint64_t x0) {
+	register uint64_t a0 asm("a0") = x0;
+	register uint64_t a7 asm("a7") = signum;
+	asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+	return a0;
+}
+
 static inline uint64_t ecall2(uint64_t signum, uint64_t x0, uint64_t x1) {
 	register uint64_t a0 asm("a0") = x0;
 	register uint64_t a1 asm("a1") = x1;
@@ -24,26 +31,147 @@ static inline uint64_t ecall3(uint64_t signum, uint64_t x0, uint64_t x1, uint64_
 	return a0;
 }
 
-uint64_t ecall_open(uint32_t device, byte* options) {
-	return ecall2(ECALL_OPEN, (uint64_t)device, (uint64_t)options);
+uint64_t ecall_tty_write(const byte* buffer, uint32_t length) {
+	return ecall2(ECALL_TTY_WRITE, (uint64_t)buffer, (uint64_t)length);
+}
+
+uint64_t ecall_tty_read(byte* buffer, uint32_t length) {
+	return ecall2(ECALL_TTY_READ, (uint64_t)buffer, (uint64_t)length);
+}
+
+uint64_t ecall_create(const char* path) {
+	return ecall1(ECALL_CREATE, (uint64_t)path);
+}
+
+/* Returns an fd for the file, or a negative error */
+uint64_t ecall_open(const char* path) {
+	return ecall1(ECALL_OPEN, (uint64_t)path);
+}
+
+uint64_t ecall_close(FD fd) {
+	return ecall1(ECALL_CLOSE, (uint64_t)fd);
+}
+
+uint64_t ecall_read(FD fd, byte* buffer, uint32_t length) {
+	return ecall3(ECALL_READ, (uint64_t)fd, (uint64_t)buffer, (uint64_t)length);
+}
+
+uint64_t ecall_write(FD fd, const byte* buffer, uint32_t length) {
+	return ecall3(ECALL_WRITE, (uint64_t)fd, (uint64_t)buffer, (uint64_t)length);
+}
+
+uint64_t ecall_fstat(FD fd, inode_t* out) {
+	return ecall2(ECALL_FSTAT, (uint64_t)fd, (uint64_t)out);
+}
+
+uint64_t ecall_unlink(const char* path) {
+	return ecall1(ECALL_UNLINK, (uint64_t)path);
+}
+
+uint64_t ecall_mkdir(const char* path, dirent_t* out) {
+	return ecall2(ECALL_MKDIR, (uint64_t)path, (uint64_t)out);
+}
+
+uint64_t ecall_rmdir(const char* path) {
+	return ecall1(ECALL_RMDIR, (uint64_t)path);
+}
+
+uint64_t ecall_readdir(const char* path, dirent_t* out, uint32_t count) {
+	return ecall3(ECALL_READDIR, (uint64_t)path, (uint64_t)out, (uint64_t)count);
+}
+
+uint64_t ecall_getdir(const char* path, directory_t* out, bool chdir) {
+	return ecall3(ECALL_GETDIR, (uint64_t)path, (uint64_t)out, (uint64_t)chdir);
 }
 
-uint64_t ecall_close(uint32_t device, byte* options) {
-	return ecall2(ECALL_CLOSE, (uint64_t)device, (uint64_t)options);
+uint64_t ecall_rtc_read(void) {
+	return ecall0(ECALL_RTC_READ);
 }
 
-uint64_t ecall_read(uint32_t device, byte* options) {
-	return ecall2(ECALL_READ, (uint64_t)device, (uint64_t)options);
+uint64_t ecall_gettz(tzrule* out) {
+	return ecall1(ECALL_GETTZ, (uint64_t)out);
 }
 
-uint64_t ecall_write(uint32_t device, byte* options) {
-	return ecall2(ECALL_WRITE, (uint64_t)device, (uint64_t)options);
+uint64_t ecall_settz(const char* rule) {
+	return ecall1(ECALL_SETTZ, (uint64_t)rule);
 }
 
+/* Returns the child's thread id right away, or a negative value if it could not be started. */
 uint64_t ecall_spawn(char* name, char* arg) {
 	return ecall2(ECALL_SPAWN, (uint64_t)name, (uint64_t)arg);
 }
 
+/* Pass -1 as the thread to change the caller's own priority. Returns the old priority or -1. */
+uint64_t ecall_setprio(int32_t tid, uint32_t prio) {
+	return ecall2(ECALL_SETPRIO, (uint64_t)tid, (uint64_t)prio);
+}
+
+/* Starts a thread at 'entry' with a0/a1 set to 'arg0'/'arg1', sharing the caller's address space. *
+ * Returns its tid, or a negative value if the process is out of thread stacks.                  */
+uint64_t ecall_clone(uint64_t entry, uint64_t arg0, uint64_t arg1) {
+	return ecall3(ECALL_CLONE, entry, arg0, arg1);
+}
+
+/* FUTEX_WAIT returns 0 once woken or -1 if '*addr' no longer held 'val'. FUTEX_WAKE wakes *
+ * up to 'val' waiters and returns how many it woke.                                       */
+uint64_t ecall_futex(volatile uint32_t* addr, uint32_t op, uint32_t val) {
+	return ecall3(ECALL_FUTEX, (uint64_t)addr, (uint64_t)op, (uint64_t)val);
+}
+
+/* Waits for a child (tid -1 for any) to finish and stores its return value in 'status'.    *
+ * Returns the child's tid, 0 if WNOHANG was given and it's still running, or -1 if the    *
+ * caller has no such child.                                                               */
+uint64_t ecall_waitpid(int32_t tid, uint8_t* status, uint32_t options) {
+	return ecall3(ECALL_WAITPID, (uint64_t)tid, (uint64_t)status, (uint64_t)options);
+}
+
+uint64_t ecall_wait(uint8_t* status) {
+	return ecall_waitpid(-1, status, 0);
+}
+
+uint64_t ecall_getpid(void) {
+	return ecall0(ECALL_GETPID);
+}
+
+/* Ticks of the 10 MHz time counter since boot */
+uint64_t ecall_clock(void) {
+	return ecall0(ECALL_CLOCK);
+}
+
+void ecall_yield(void) {
+	ecall0(ECALL_YIELD);
+}
+
+uint64_t ecall_sleep(uint32_t ms) {
+	return ecall2(ECALL_SLEEP, (uint64_t)ms, 0);
+}
+
+/* Fills 'buf' with up to 'max' entries, one per thread in use, and returns how many were written. */
+uint64_t ecall_tstat(thread_stat_t* buf, uint32_t max) {
+	return ecall2(ECALL_TSTAT, (uint64_t)buf, (uint64_t)max);
+}
+
+/* Fills 'buf' with up to 'max' lock entries and returns how many were written, *
+ * or -1 if the kernel was built without lock statistics.                       */
+uint64_t ecall_lockstat(lock_stat_t* buf, uint32_t max, uint32_t flags) {
+	return ecall3(ECALL_LOCKSTAT, (uint64_t)buf, (uint64_t)max, (uint64_t)flags);
+}
+
+/* Returns the address of the caller's ring, mapping it on first use, or -1 */
+uint64_t ecall_ring_setup(void) {
+	return ecall0(ECALL_RING_SETUP);
+}
+
+/* Consumes up to 'count' submissions, posting a completion for each, and returns how many it took */
+uint64_t ecall_ring_enter(uint32_t count) {
+	return ecall1(ECALL_RING_ENTER, (uint64_t)count);
+}
+
+void ecall_exit(uint8_t status) {
+	ecall2(ECALL_EXIT, (uint64_t)status, 0);
+	while (1); /* Not reached */
+}
+
 void ecall_pwoff(void) {
 	ecall0(ECALL_PWOFF);
 }
@@ -23,10 +23,7 @@ void printf(const char* format, ...) {
 	va_start(ap, format);
 	printf_core(MODE_BUFFER, (byte*)buffer, format, ap);
 	va_end(ap);
-	uart_dev_opts options;
-	options.length = strlen(buffer);
-	options.buffer = (byte*)buffer;
-	ecall_write(UART_DEV_NUM, (byte*)&options);
+	ecall_tty_write((byte*)buffer, strlen(buffer));
 }
 
 /* Behaves similarly to std sprinf, see above */
@@ -37,118 +34,86 @@ void sprintf(byte* buffer, const char* format, ...) {
 	va_end(ap);
 }
 
+/* Number of decimal digits in 'v' */
+uint32_t num_digits(uint64_t v) {
+	uint32_t n = 1;
+	while (v >= 10) { v /= 10; ++n; }
+	return n;
+}
+
+/* printf has no field widths, so tables are padded by hand.  Prints spaces
+   until 'printed' characters have filled 'width'                          */
+void print_pad(uint32_t printed, uint32_t width) {
+	while (printed++ < width) printf(" ");
+}
+
+/* Prints 'v' right aligned in 'width' characters, followed by a space */
+void print_column(uint64_t v, uint32_t width) {
+	print_pad(num_digits(v), width);
+	printf("%lu ", v);
+}
+
 /* Gets a line of characters from the tty/uart and converts
    it into a C string when either enter is pressed or the 
    buffer is populated with 'length' characters             */
 int32_t gets(char* buffer, uint32_t length) {
 	if (buffer == NULL || length == 0) return 0;
-	uart_dev_opts options;
-	options.length = length;
-	options.buffer = (byte*)buffer;
-	return (int32_t)ecall_read(UART_DEV_NUM, (byte*)&options);
+	return (int32_t)ecall_tty_read((byte*)buffer, length);
 }
 
 /* Creates a file at path */
 int8_t fcreate(const char* path) {
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = FILE_CREATE;
-	options.buff_in = (byte*)path;
-	options.buff_out = NULL;
-	options.length = strlen(path);
-	return ecall_open(DISK_DEV_NUM, (byte*)&options);
+	return (int8_t)ecall_create(path);
 }
 
-/* Opens a file at path. Without malloc it requires you to pass in your own FILE */
+/* Opens a file at path. Without malloc it requires you to pass in your own FILE.
+   On failure 'fd' is left at -1 and the negative error is returned              */
 int8_t fopen(const char* path, FILE* file) {
-	disk_dev_opts options;
 	file->fd = (FD)-1;
-	options.file = file;
-	options.mode = FILE_OPEN;
-	options.buff_in = (byte*)path;
-	options.buff_out = NULL;
-	options.length = strlen(path);
-	return ecall_open(DISK_DEV_NUM, (byte*)&options);
+	FD fd = (FD)ecall_open(path);
+	if (fd < 0) return (int8_t)fd;
+	file->fd = fd;
+	ecall_fstat(fd, &file->inode);
+	return 0;
 }
 
 /* Closes an open FILE */
 int8_t fclose(FILE* file) {
-	disk_dev_opts options;
-	options.file = file;
-	options.mode = 0; /* forgot about close when writing, is it necessary? */
-	options.buff_in = NULL;
-	options.buff_out = NULL;
-	options.length = 0;
-	return ecall_close(DISK_DEV_NUM, (byte*)&options);
+	int8_t status = (int8_t)ecall_close(file->fd);
+	file->fd = (FD)-1;
+	return status;
 }
 
 /* Reads 'len' bytes into 'buffer' starting at index 0 from a file, no seek supported */
 uint32_t fread(FILE* file, byte* buffer, uint32_t len) {
-	disk_dev_opts options;
-	options.file = file;
-	options.mode = FILE_READ;
-	options.buff_in = NULL;
-	options.buff_out = buffer;
-	options.length = len;
-	return ecall_read(DISK_DEV_NUM, (byte*)&options);
+	return (uint32_t)ecall_read(file->fd, buffer, len);
 }
 
 /* Writes 'len' bytes from 'buffer' starting at index 0 into a file, no seek supported */
 uint32_t fwrite(FILE* file, byte* buffer, uint32_t len) {
-	disk_dev_opts options;
-	options.file = file;
-	options.mode = FILE_WRITE;
-	options.buff_in = buffer;
-	options.buff_out = NULL;
-	options.length = len;
-	return ecall_write(DISK_DEV_NUM, (byte*)&options);
+	return (uint32_t)ecall_write(file->fd, buffer, len);
 }
 
 /* Deletes a file at path */
 int8_t fdelete(const char* path) {
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = FILE_TRUNCATE;
-	options.buff_in = (byte*)path;
-	options.buff_out = NULL;
-	options.length = 0;
-	return (int8_t)ecall_write(DISK_DEV_NUM, (byte*)&options);
+	return (int8_t)ecall_unlink(path);
 }
 
 /* Creates a new directory at path */
 int8_t mkdir(const char* path) {
 	dirent_t placeholder; /* mkdir returns the dirent_t of the directory but nothing uses it */
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = DIR_CREATE;
-	options.buff_in = (byte*)path;
-	options.buff_out = (byte*)&placeholder;
-	options.length = 0;
-	return ecall_open(DISK_DEV_NUM, (byte*)&options);
+	return (int8_t)ecall_mkdir(path, &placeholder);
 }
 
 /* Deletes an empty directory at path */
 int8_t rmdir(const char* path) {
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = DIR_TRUNCATE;
-	options.buff_in = (byte*)path;
-	options.buff_out = NULL;
-	options.length = 0;
-	return (int8_t)ecall_write(DISK_DEV_NUM, (byte*)&options);
+	return (int8_t)ecall_rmdir(path);
 }
 
 /* Function requires an array of dirent_t to hold the response
    The 'count' field is the maximum number of children the array can hold */
 int8_t rddir(const char* path, dirent_t* out, uint32_t count) {
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = DIR_READ;
-	options.buff_in = (byte*)path;
-	options.buff_out = (byte*)out;
-	options.length = count;
-	uint32_t result = ecall_read(DISK_DEV_NUM, (byte*)&options);
-	return (int8_t)result;
+	return (int8_t)ecall_readdir(path, out, count);
 }
 
 /* Function returns a full directory_t of the target dir
@@ -157,17 +122,5 @@ int8_t rddir(const char* path, dirent_t* out, uint32_t count) {
    'path' field of the directory_t will be populated with its absolute
    path from the root, use this with chdir = false to expand paths     */
 int8_t getdir(const char* path, directory_t* out, bool chdir) {
-	disk_dev_opts options;
-	options.file = NULL;
-	options.mode = DIR_OPEN;
-	options.buff_out = (byte*)out;
-
-	options.length = strlen(path);
-	byte buffer[MAX_PATH_LEN + 1 + sizeof(bool)];
-	memcpy(buffer, &chdir, sizeof(bool));
-	memcpy(buffer + sizeof(bool), path, options.length);
-	buffer[options.length + sizeof(bool)] = '\0';
-	options.buff_in = buffer;
-
-	return ecall_open(DISK_DEV_NUM, (byte*)&options);
+	return (int8_t)ecall_getdir(path, out, chdir);
 }
@@ -0,0 +1,43 @@
+#include <dev/ring.h>
+#include <dev/ecall.h>
+
+/* Maps the process' ring and returns it, or NULL if no page was left for it.  Calling it *
+ * again returns the same ring.                                                           */
+ring_t* ring_setup(void) {
+	int64_t va = (int64_t)ecall_ring_setup();
+	return va < 0 ? NULL : (ring_t*)va;
+}
+
+/* Queues one ecall without entering the kernel.  Returns false when the submission queue *
+ * is full, the caller should 'ring_submit' and reap before trying again.                 */
+bool ring_queue(ring_t* ring, uint32_t ecall, uint64_t a0, uint64_t a1, uint64_t a2, uint64_t user_data) {
+	uint32_t tail = ring->sq_tail;
+	if (tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE) >= RING_SQ_SIZE) return false;
+	ring_sqe_t* sqe = &ring->sq[tail & (RING_SQ_SIZE - 1)];
+	sqe->ecall = ecall;
+	sqe->args[0] = a0;
+	sqe->args[1] = a1;
+	sqe->args[2] = a2;
+	sqe->user_data = user_data;
+	__atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Runs everything queued in a single trap.  Returns how many entries the kernel took, *
+ * fewer than were queued only if the completion queue filled up, or -1 if the ring    *
+ * was never set up or its indices are corrupt.                                        */
+int32_t ring_submit(ring_t* ring) {
+	uint32_t pending = ring->sq_tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+	if (pending == 0) return 0;
+	int64_t taken = (int64_t)ecall_ring_enter(pending);
+	return taken < 0 ? -1 : (int32_t)taken;
+}
+
+/* Takes the oldest completion, returns false if there is none */
+bool ring_reap(ring_t* ring, ring_cqe_t* out) {
+	uint32_t head = ring->cq_head;
+	if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) return false;
+	*out = ring->cq[head & (RING_CQ_SIZE - 1)];
+	__atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
@@ -0,0 +1,59 @@
+#include <dev/sync.h>
+#include <dev/ecall.h>
+
+void mutex_init(mutex_t* m) {
+	__atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+}
+
+/* Takes the lock as contended (state 2), sleeping while someone else holds it. Used   *
+ * once a thread has had to wait, since it can't know whether others are still queued. */
+static void lock_contended(mutex_t* m) {
+	while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+		ecall_futex(&m->state, FUTEX_WAIT, 2);
+	}
+}
+
+void mutex_lock(mutex_t* m) {
+	uint32_t expected = 0;
+	if (__atomic_compare_exchange_n(&m->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	lock_contended(m);
+}
+
+bool mutex_trylock(mutex_t* m) {
+	uint32_t expected = 0;
+	return __atomic_compare_exchange_n(&m->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(mutex_t* m) {
+	if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+		ecall_futex(&m->state, FUTEX_WAKE, 1);
+}
+
+void cond_init(cond_t* c) {
+	__atomic_store_n(&c->seq, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->waiters, 0, __ATOMIC_RELEASE);
+}
+
+/* The sequence number is read before the mutex is dropped, so a signal sent in *
+ * between changes it and the futex wait returns at once instead of sleeping.   */
+void cond_wait(cond_t* c, mutex_t* m) {
+	uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+	__atomic_fetch_add(&c->waiters, 1, __ATOMIC_ACQ_REL);
+	mutex_unlock(m);
+	ecall_futex(&c->seq, FUTEX_WAIT, seq);
+	__atomic_fetch_sub(&c->waiters, 1, __ATOMIC_ACQ_REL);
+	lock_contended(m);
+}
+
+void cond_signal(cond_t* c) {
+	__atomic_fetch_add(&c->seq, 1, __ATOMIC_ACQ_REL);
+	if (__atomic_load_n(&c->waiters, __ATOMIC_ACQUIRE) != 0)
+		ecall_futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void cond_broadcast(cond_t* c) {
+	__atomic_fetch_add(&c->seq, 1, __ATOMIC_ACQ_REL);
+	if (__atomic_load_n(&c->waiters, __ATOMIC_ACQUIRE) != 0)
+		ecall_futex(&c->seq, FUTEX_WAKE, 0x7FFFFFFF);
+}
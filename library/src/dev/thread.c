@@ -0,0 +1,19 @@
+#include <dev/thread.h>
+#include <dev/ecall.h>
+
+/* First code run by every thread made with 'thread_create'. The thread exits *
+ * with the function's return value once it returns.                          */
+static void thread_start(thread_func_t func, void* arg) {
+	ecall_exit(func(arg));
+}
+
+/* Returns the new thread's id, or a negative value if it couldn't be started. */
+int32_t thread_create(thread_func_t func, void* arg) {
+	return (int32_t)ecall_clone((uint64_t)&thread_start, (uint64_t)func, (uint64_t)arg);
+}
+
+/* Waits for a thread to finish and stores its return value in 'retval' if not NULL. *
+ * Returns the thread's id, or -1 if it isn't a thread of this process.              */
+int32_t thread_join(int32_t tid, uint8_t* retval) {
+	return (int32_t)ecall_waitpid(tid, retval, 0);
+}
@@ -210,29 +210,38 @@ void dt_to_string(datetime dt, char* out, uint8_t len) {
 	sprintf((byte*)out, "%s %u %u %s:%s:%s %s %s", month, dt.day, dt.year, hr, min, sec, mer, tz);
 }
 
+#define NSEC_PER_SEC 1000000000UL
+
+/* Copies the time page, retrying while the kernel is updating it. Returns its 'seq'. */
+static uint32_t read_time_page(vdso_time_t* out) {
+	const vdso_time_t* page = (const vdso_time_t*)VDSO_TIME_VA;
+	uint32_t seq;
+	do {
+		while ((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1);
+		memcpy(out, (const void*)page, sizeof(vdso_time_t));
+		asm volatile("fence r, r" ::: "memory");
+	} while (seq != page->seq);
+	return seq;
+}
+
+/* Seconds since the epoch, worked out from the time page without trapping */
 uint64_t rtc_read(void) {
-	rtc_dev_opts options;
-	uint64_t time = 0;
-	options.buffer = (byte*)&time;
-	options.length = 0;
-	options.type = GET_SEC;
-	ecall_read(RTC_DEV_NUM, (byte*)&options);
-	return time;
+	vdso_time_t page;
+	if (read_time_page(&page) == 0) return ecall_rtc_read();
+	uint64_t delta = rdtime() - page.base_ticks;
+	uint64_t ns = page.base_ns + (delta / page.timebase_hz) * NSEC_PER_SEC
+		+ (delta % page.timebase_hz) * NSEC_PER_SEC / page.timebase_hz;
+	return ns / NSEC_PER_SEC;
 }
 
 int8_t rtc_chtz(char* newtz) {
-	rtc_dev_opts options;
-	options.buffer = (byte*)newtz;
-	options.length = strlen(newtz);
-	return (uint8_t)ecall_write(RTC_DEV_NUM, (byte*)&options);
+	return (uint8_t)ecall_settz(newtz);
 }
 
 tzrule rtc_gettz(void) {
+	vdso_time_t page;
+	if (read_time_page(&page) != 0) return page.tz;
 	tzrule rule;
-	rtc_dev_opts options;
-	options.buffer = (byte*)&rule;
-	options.length = 0;
-	options.type = GET_TZ;
-	ecall_read(RTC_DEV_NUM, (byte*)&options);
+	ecall_gettz(&rule);
 	return rule;
-}
\ No newline at end of file
+}
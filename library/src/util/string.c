@@ -59,3 +59,10 @@ int16_t memcmp(const void* s1, const void* s2, uint64_t n) {
 	}
 	return 0;
 }
+
+/* Reads the decimal number at the start of a string, stopping at the first non-digit */
+uint64_t parse_u64(const char* s) {
+	uint64_t v = 0;
+	while (*s >= '0' && *s <= '9') v = v * 10 + (uint64_t)(*s++ - '0');
+	return v;
+}
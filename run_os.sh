@@ -6,10 +6,14 @@ set -eu
 
 usage() {
 	cat <<'USAGE'
-Usage: run_os.sh [--debug] [--silent] [--help] [--with <target ...>]
+Usage: run_os.sh [--debug] [--sstc] [--smp <n>] [--fpu] [--lockstat] [--silent] [--help] [--with <target ...>]
 
 Options:
 	--debug    Build with BAREOS_QEMU_DEBUG=1 so QEMU starts with a GDB stub.
+	--sstc     Enable the Sstc extension in QEMU (Supervisor-mode timer).
+	--smp      Number of harts to start QEMU with (1-4, default 1).
+	--fpu      Build the kernel and user programs with hardware floating point.
+	--lockstat Build the kernel with lock contention statistics.
 	--silent   Suppress build output from scons and show a tiny spinner.
 	--with     Treat all the following arguments as "scons build <arg>" targets.
 	--help     Show this help and exit.
@@ -17,6 +21,10 @@ USAGE
 }
 
 DEBUG_MODE=0
+SSTC_MODE=0
+SMP_HARTS=1
+FPU_MODE=0
+LOCKSTAT_MODE=0
 SILENT_MODE=0
 WITH_TARGETS=""
 LOG_FILE=""
@@ -126,6 +134,12 @@ trap 'handle_signal TERM' TERM
 while [ "$#" -gt 0 ]; do
 	case "$1" in
 		--debug|-d)  DEBUG_MODE=1 ; shift ;;
+		--sstc)      SSTC_MODE=1 ; shift ;;
+		--smp)
+			[ "$#" -ge 2 ] || { echo "--smp needs a hart count" >&2 ; usage ; exit 2 ; }
+			SMP_HARTS=$2 ; shift 2 ;;
+		--fpu)       FPU_MODE=1 ; shift ;;
+		--lockstat)  LOCKSTAT_MODE=1 ; shift ;;
 		--silent|-s) SILENT_MODE=1 ; shift ;;
 		--help|-h)   usage ; exit 0 ;;
 		--with)
@@ -154,13 +168,13 @@ if ! run_scons -c; then # Mandatory clean
 	fatal 1 "Failed to clean user build artifacts"
 fi
 
-if ! run_scons build shell; then # Mandatory shell
+if ! run_scons build shell fpu="${FPU_MODE}"; then # Mandatory shell
 	fatal 1 "Failed to build shell target"
 fi
 
 if [ -n "$WITH_TARGETS" ]; then # Optional build targets, skipped if fail
 	for target in $WITH_TARGETS; do
-		if ! run_scons build "$target"; then
+		if ! run_scons build "$target" fpu="${FPU_MODE}"; then
 			report_optional_failure "$target"
 		fi
 	done
@@ -170,11 +184,11 @@ cd "$ROOT_DIR"
 
 # Full build. DEBUG toggles QEMU flag generation via env.
 if [ "${DEBUG_MODE}" -eq 1 ]; then
-	if ! BAREOS_QEMU_DEBUG=1 run_scons build; then
+	if ! BAREOS_QEMU_DEBUG=1 run_scons build sstc="${SSTC_MODE}" smp="${SMP_HARTS}" fpu="${FPU_MODE}" lockstat="${LOCKSTAT_MODE}"; then
 		fatal 1 "Failed to build kernel (debug mode)"
 	fi
 else
-	if ! run_scons build; then
+	if ! run_scons build sstc="${SSTC_MODE}" smp="${SMP_HARTS}" fpu="${FPU_MODE}" lockstat="${LOCKSTAT_MODE}"; then
 		fatal 1 "Failed to build kernel"
 	fi
 fi
@@ -4,7 +4,7 @@ import subprocess
 from pathlib import Path
 from typing import Dict, Iterable, List, Sequence, Set
 
-from SCons.Script import COMMAND_LINE_TARGETS, Exit, GetOption
+from SCons.Script import ARGUMENTS, COMMAND_LINE_TARGETS, Exit, GetOption
 
 USER_DIR = Path(Dir(".").abspath)
 ROOT_DIR = USER_DIR.parent
@@ -15,6 +15,11 @@ LIB_INCLUDE_DIR = LIB_DIR / "include"
 LINKER_SCRIPT = USER_DIR / "linker.ld"
 START_SOURCE = USER_DIR / "start.s"
 
+# fpu=1 builds for rv64gc with hardware floating point. The kernel must be built with fpu=1 too,
+# otherwise the first FP instruction is an illegal instruction.
+FPU = ARGUMENTS.get("fpu", "0") == "1"
+ARCH_FLAGS = ["-march=rv64imafdc_zicsr", "-mabi=lp64d"] if FPU else ["-march=rv64imac_zicsr", "-mabi=lp64"]
+
 # Map tells the compiler what source files come with what header
 # Prevents us from including unnecessary stuff in a user program
 LIBRARY_HEADER_MAP: Dict[str, List[str]] = {
@@ -24,6 +29,9 @@ LIBRARY_HEADER_MAP: Dict[str, List[str]] = {
     "dev/printf.h": ["src/dev/printf.c"],
     "dev/printf_iface.h": ["src/dev/io.c", "src/dev/printf.c"],
     "dev/ecall.h": ["src/dev/ecall.c"],
+    "dev/thread.h": ["src/dev/thread.c", "src/dev/ecall.c"],
+    "dev/sync.h": ["src/dev/sync.c", "src/dev/ecall.c"],
+    "dev/ring.h": ["src/dev/ring.c", "src/dev/ecall.c"],
     "dev/io.h": ["src/dev/io.c", "src/dev/printf.c", "src/util/string.c", "src/dev/ecall.c"],
     "dev/time.h": ["src/dev/time.c", "src/dev/io.c", "src/util/string.c", "src/dev/ecall.c", "src/dev/printf.c"],
 }
@@ -146,8 +154,7 @@ common_flags = [
 	"-fno-builtin",
 	"-nostdlib",
 	"-nostdinc",
-	"-march=rv64imac_zicsr",
-	"-mabi=lp64",
+	*ARCH_FLAGS,
 	"-mcmodel=medany",
 	"-O0",
 	"-g",
@@ -166,6 +173,7 @@ subprocess.check_call(start_cmd)
 all_objects = [start_obj, *object_paths, *lib_objects]
 
 link_flags = [
+	*ARCH_FLAGS,
 	"-nostdlib",
 	"-nostartfiles",
 	f"-Wl,-T,{LINKER_SCRIPT}",
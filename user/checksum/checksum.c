@@ -0,0 +1,81 @@
+#include <dev/io.h>
+#include <dev/thread.h>
+#include <util/string.h>
+
+/* Parallel checksum: reads a file into memory, then sums it in slices on several threads *
+ * of this process and combines the partial sums. Usage: checksum <file> [threads]        */
+
+#define MAX_THREADS 7         /* Thread stack slots per process, besides main's */
+#define BUFF_SIZE   0x100000  /* Largest file handled, lives in .bss */
+#define CHUNK_SIZE  512
+
+typedef struct {
+	uint32_t start;
+	uint32_t len;
+	uint32_t sum;
+} slice_t;
+
+static byte buffer[BUFF_SIZE];
+static slice_t slices[MAX_THREADS];
+
+/* Each byte is weighted by its position so that order matters, which keeps the *
+ * checksum a plain sum of the slices whatever the thread count.                 */
+static uint8_t sum_slice(void* arg) {
+	slice_t* slice = (slice_t*)arg;
+	uint32_t sum = 0;
+	for (uint32_t i = slice->start; i < slice->start + slice->len; ++i) {
+		sum += (uint32_t)buffer[i] * (i + 1);
+	}
+	slice->sum = sum;
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		printf("usage: checksum <file> [threads]\n");
+		return 1;
+	}
+	uint32_t nthreads = 4;
+	if (argc > 2) {
+		nthreads = 0;
+		for (const char* p = argv[2]; *p >= '0' && *p <= '9'; ++p) nthreads = nthreads * 10 + (uint32_t)(*p - '0');
+		if (nthreads == 0 || nthreads > MAX_THREADS) {
+			printf("checksum: threads must be between 1 and %u\n", MAX_THREADS);
+			return 1;
+		}
+	}
+
+	FILE f;
+	f.fd = (FD)-1;
+	fopen(argv[1], &f);
+	if (f.fd == (FD)-1) {
+		printf("%s - File not found.\n", argv[1]);
+		return 1;
+	}
+	uint32_t size = 0;
+	while (size < BUFF_SIZE) {
+		uint32_t want = BUFF_SIZE - size < CHUNK_SIZE ? BUFF_SIZE - size : CHUNK_SIZE;
+		uint32_t got = fread(&f, buffer + size, want);
+		size += got;
+		if (got < want) break;
+	}
+	fclose(&f);
+
+	uint32_t per = (size + nthreads - 1) / nthreads;
+	int32_t tids[MAX_THREADS];
+	for (uint32_t i = 0; i < nthreads; ++i) {
+		uint32_t start = i * per < size ? i * per : size;
+		slices[i].start = start;
+		slices[i].len = start + per < size ? per : size - start;
+		tids[i] = thread_create(&sum_slice, &slices[i]);
+		if (tids[i] < 0) sum_slice(&slices[i]); /* Out of threads, do it here */
+	}
+
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < nthreads; ++i) {
+		if (tids[i] >= 0) thread_join(tids[i], NULL);
+		total += slices[i].sum;
+	}
+	printf("%s: %u bytes, %u threads, checksum %x\n", argv[1], size, nthreads, total);
+	return 0;
+}
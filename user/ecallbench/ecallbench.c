@@ -0,0 +1,41 @@
+#include <dev/io.h>
+#include <dev/ecall.h>
+#include <dev/time.h>
+#include <util/string.h>
+
+/* Measures the ecall round trip. ecall_getpid takes the fast path, which skips the     *
+ * trapframe and the kernel lock. ECALL_GDEV does nothing and goes through the full      *
+ * trap path, so it is the null ecall to compare against. Usage: ecallbench [rounds]     */
+
+#define DEFAULT_ROUNDS 10000
+#define NS_PER_TICK (1000000000UL / RDTIME_HZ)
+
+static inline void null_ecall(void) {
+	register uint64_t a0 asm("a0") = 0;
+	register uint64_t a7 asm("a7") = ECALL_GDEV;
+	asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+}
+
+int main(int argc, char** argv) {
+	uint64_t rounds = argc > 1 ? parse_u64(argv[1]) : DEFAULT_ROUNDS;
+	if (rounds == 0) {
+		printf("usage: ecallbench [rounds]\n");
+		return 1;
+	}
+
+	uint64_t start = rdtime();
+	for (uint64_t i = 0; i < rounds; ++i) null_ecall();
+	uint64_t slow = (rdtime() - start) * NS_PER_TICK / rounds;
+
+	start = rdtime();
+	for (uint64_t i = 0; i < rounds; ++i) ecall_getpid();
+	uint64_t fast = (rdtime() - start) * NS_PER_TICK / rounds;
+
+	start = rdtime();
+	for (uint64_t i = 0; i < rounds; ++i) ecall_clock();
+	uint64_t clock = (rdtime() - start) * NS_PER_TICK / rounds;
+
+	printf("ecall round trip over %lu rounds (ns): full path %lu, getpid %lu, clock %lu\n", rounds, slow, fast, clock);
+	if (fast > 0) printf("fast path is %lux faster than the full trap path\n", slow / fast);
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include <dev/io.h>
+#include <dev/thread.h>
+#include <dev/time.h>
+
+/* Measures how long a finished thread takes to be collected: the time from a thread  *
+ * reading the clock right before it exits to its parent returning from the join.     *
+ * The parent is already waiting when the thread exits, so this is the exit path and  *
+ * the wakeup, without the cost of starting the thread.                                */
+
+#define ROUNDS 32
+#define TICKS_PER_US (RDTIME_HZ / 1000000)
+
+static volatile uint64_t exit_time;  /* Written by each thread just before it exits */
+
+static uint8_t exit_now(void* arg) {
+	(void)arg;
+	exit_time = rdtime();
+	return 7;
+}
+
+int main(void) {
+	uint64_t min = (uint64_t)-1, max = 0, total = 0;
+	uint32_t done = 0;
+	for (uint32_t i = 0; i < ROUNDS; ++i) {
+		exit_time = 0;
+		int32_t tid = thread_create(&exit_now, NULL);
+		if (tid < 0) {
+			printf("exitbench: thread_create failed on round %u\n", i);
+			break;
+		}
+		uint8_t status = 0;
+		if (thread_join(tid, &status) != tid || status != 7 || exit_time == 0) {
+			printf("exitbench: round %u collected the wrong thread or status\n", i);
+			break;
+		}
+		uint64_t elapsed = rdtime() - exit_time;
+		if (elapsed < min) min = elapsed;
+		if (elapsed > max) max = elapsed;
+		total += elapsed;
+		++done;
+	}
+	if (done == 0) return 1;
+
+	printf("exit to join over %u rounds (us): min %u avg %u max %u\n", done,
+		(uint32_t)(min / TICKS_PER_US), (uint32_t)(total / done / TICKS_PER_US), (uint32_t)(max / TICKS_PER_US));
+	return 0;
+}
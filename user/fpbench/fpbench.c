@@ -0,0 +1,89 @@
+#include <dev/io.h>
+#include <dev/thread.h>
+#include <dev/time.h>
+
+/* Floating point benchmark for the fpu=1 build: integrates 4/(1+x^2) over [0,1] to get pi, *
+ * first on the main thread and then split across threads that get preempted mid-loop.     *
+ * Both must agree, which checks that FP registers survive context switches.               *
+ * Usage: fpbench [threads]   (build with: scons build fpbench fpu=1)                      */
+
+#if defined(__riscv) && !defined(__riscv_flen)
+#error "fpbench needs hardware floating point, build it with fpu=1"
+#endif
+
+#define MAX_THREADS 7
+#define STEPS       2000000
+#define TICKS_PER_US (RDTIME_HZ / 1000000)
+
+typedef struct {
+	uint32_t first;
+	uint32_t count;
+	double sum;
+} part_t;
+
+static part_t parts[MAX_THREADS];
+
+static double integrate(uint32_t first, uint32_t count) {
+	double width = 1.0 / STEPS;
+	double sum = 0.0;
+	for (uint32_t i = first; i < first + count; ++i) {
+		double x = (i + 0.5) * width;
+		sum += 4.0 / (1.0 + x * x);
+	}
+	return sum * width;
+}
+
+static uint8_t run_part(void* arg) {
+	part_t* part = (part_t*)arg;
+	part->sum = integrate(part->first, part->count);
+	return 0;
+}
+
+/* printf has no %f, so print the first nine decimals */
+static void print_pi(const char* label, double pi, uint64_t ticks) {
+	uint64_t scaled = (uint64_t)(pi * 1000000000.0 + 0.5);
+	printf("%s: pi = %lu.", label, scaled / 1000000000UL);
+	for (uint64_t d = 100000000UL; d > 0; d /= 10) printf("%lu", (scaled / d) % 10);
+	printf(" in %lu us\n", ticks / TICKS_PER_US);
+}
+
+int main(int argc, char** argv) {
+	uint32_t nthreads = 4;
+	if (argc > 1) {
+		nthreads = 0;
+		for (const char* p = argv[1]; *p >= '0' && *p <= '9'; ++p) nthreads = nthreads * 10 + (uint32_t)(*p - '0');
+		if (nthreads == 0 || nthreads > MAX_THREADS) {
+			printf("fpbench: threads must be between 1 and %u\n", MAX_THREADS);
+			return 1;
+		}
+	}
+
+	uint64_t start = rdtime();
+	double serial = integrate(0, STEPS);
+	print_pi("1 thread", serial, rdtime() - start);
+
+	uint32_t per = (STEPS + nthreads - 1) / nthreads;
+	int32_t tids[MAX_THREADS];
+	start = rdtime();
+	for (uint32_t i = 0; i < nthreads; ++i) {
+		parts[i].first = i * per;
+		parts[i].count = (i + 1) * per < STEPS ? per : STEPS - i * per;
+		tids[i] = thread_create(&run_part, &parts[i]);
+		if (tids[i] < 0) run_part(&parts[i]); /* Out of threads, do it here */
+	}
+	double parallel = 0.0;
+	for (uint32_t i = 0; i < nthreads; ++i) {
+		if (tids[i] >= 0) thread_join(tids[i], NULL);
+		parallel += parts[i].sum;
+	}
+	char label[16];
+	sprintf((byte*)label, "%u threads", nthreads);
+	print_pi(label, parallel, rdtime() - start);
+
+	double diff = parallel > serial ? parallel - serial : serial - parallel;
+	if (diff > 1e-9) {
+		printf("fpbench: results differ, FP state was lost across a switch\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include <dev/io.h>
+#include <dev/ecall.h>
+#include <dev/time.h>
+#include <util/string.h>
+
+/* Shows which kernel locks threads wait on, longest total wait first.  Needs a kernel *
+ * built with lockstat=1.  With an interval the counters are zeroed, the program       *
+ * sleeps that long and shows only what happened meanwhile.  Unnamed locks show the   *
+ * kernel address they were first taken from, look it up in the kernel map.          *
+ * Usage: lockstat [interval ms] [rows]                                               */
+
+#define MAX_ENTRIES 256
+#define US_TICKS    (RDTIME_HZ / 1000000)
+
+static lock_stat_t stats[MAX_ENTRIES];
+static uint32_t order[MAX_ENTRIES];
+
+/* printf's %x only takes 32 bits, kernel addresses need all 64 */
+static void hex64(uint64_t v) {
+	char out[17];
+	for (int32_t i = 15; i >= 0; --i, v >>= 4) {
+		uint32_t d = v & 0xF;
+		out[i] = d < 10 ? '0' + d : 'a' + d - 10;
+	}
+	out[16] = '\0';
+	printf("%s", out);
+}
+
+int main(int argc, char** argv) {
+	uint64_t interval = argc > 1 ? parse_u64(argv[1]) : 0;
+	uint64_t rows = argc > 2 ? parse_u64(argv[2]) : 20;
+
+	if (interval > 0) {
+		if ((int64_t)ecall_lockstat(stats, MAX_ENTRIES, LSTAT_RESET) < 0) {
+			printf("lockstat: the kernel was built without lockstat=1\n");
+			return 1;
+		}
+		ecall_sleep((uint32_t)interval);
+	}
+	int64_t count = (int64_t)ecall_lockstat(stats, MAX_ENTRIES, 0);
+	if (count < 0) {
+		printf("lockstat: the kernel was built without lockstat=1\n");
+		return 1;
+	}
+
+	/* Insertion sort, longest total wait first, then most taken */
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t o = order[i] = i;
+		uint32_t j = i;
+		for (; j > 0; --j) {
+			const lock_stat_t* a = &stats[order[j - 1]];
+			const lock_stat_t* b = &stats[o];
+			if (a->wait_total > b->wait_total) break;
+			if (a->wait_total == b->wait_total && a->acquired >= b->acquired) break;
+			order[j] = order[j - 1];
+		}
+		order[j] = o;
+	}
+
+	printf("K    ACQUIRED  CONTENDED    WAIT(us)     MAX(us) LOCK             TOP WAITERS (tid:us)\n");
+	for (uint32_t i = 0; i < count && i < rows; ++i) {
+		const lock_stat_t* st = &stats[order[i]];
+		printf("%c ", st->kind);
+		print_column(st->acquired, 10);
+		print_column(st->contended, 10);
+		print_column(st->wait_total / US_TICKS, 11);
+		print_column(st->wait_max / US_TICKS, 11);
+		if (st->name[0] != '\0') {
+			printf("%s", st->name);
+			print_pad(strlen(st->name), 16);
+		}
+		else hex64(st->site);
+		printf(" ");
+		for (uint32_t t = 0; t < LSTAT_TOP && st->top_tid[t] >= 0; ++t)
+			printf("%d:%lu ", st->top_tid[t], st->top_wait[t] / US_TICKS);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <dev/io.h>
+#include <dev/ecall.h>
+#include <dev/ring.h>
+#include <dev/time.h>
+#include <util/string.h>
+
+/* Writes many small records to a file, first with one fwrite per record and then     *
+ * through the submission ring, which takes a whole queue of them per trap.           *
+ * Usage: ringbench [records]                                                          */
+
+#define DEFAULT_RECORDS 4096
+#define RECORD_LEN 16
+#define NS_PER_TICK (1000000000UL / RDTIME_HZ)
+#define BENCH_FILE "ringbench.tmp"
+
+static byte record[RECORD_LEN] = "0123456789abcdef";
+
+/* Returns the number of records that failed to write */
+static uint64_t drain(ring_t* ring) {
+	uint64_t failed = 0;
+	ring_cqe_t cqe;
+	while (ring_reap(ring, &cqe))
+		if (cqe.result != RECORD_LEN) ++failed;
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	uint64_t records = argc > 1 ? parse_u64(argv[1]) : DEFAULT_RECORDS;
+	if (records == 0) {
+		printf("usage: ringbench [records]\n");
+		return 1;
+	}
+	ring_t* ring = ring_setup();
+	if (ring == NULL) {
+		printf("ringbench: could not map the ring\n");
+		return 1;
+	}
+
+	FILE file;
+	fcreate(BENCH_FILE);
+	if (fopen(BENCH_FILE, &file) != 0) {
+		printf("ringbench: could not open %s\n", BENCH_FILE);
+		return 1;
+	}
+
+	uint64_t start = rdtime();
+	for (uint64_t i = 0; i < records; ++i) fwrite(&file, record, RECORD_LEN);
+	uint64_t single = (rdtime() - start) * NS_PER_TICK / records;
+
+	uint64_t traps = 0;
+	uint64_t failed = 0;
+	start = rdtime();
+	int32_t taken = 0;
+	for (uint64_t i = 0; i < records && taken >= 0; ++i) {
+		while (!ring_queue(ring, ECALL_WRITE, (uint64_t)file.fd, (uint64_t)record, RECORD_LEN, i)) {
+			if ((taken = ring_submit(ring)) < 0) break;
+			++traps;
+			failed += drain(ring);
+		}
+	}
+	while (taken >= 0 && (taken = ring_submit(ring)) > 0) {
+		++traps;
+		failed += drain(ring); /* Makes room in the completion queue for the rest */
+	}
+	if (taken < 0) {
+		printf("ringbench: ring_submit failed\n");
+		fclose(&file);
+		fdelete(BENCH_FILE);
+		return 1;
+	}
+	failed += drain(ring);
+	uint64_t batched = (rdtime() - start) * NS_PER_TICK / records;
+
+	fclose(&file);
+	fdelete(BENCH_FILE);
+
+	printf("%lu writes of %u bytes (ns per write): fwrite %lu, ring %lu\n", records, RECORD_LEN, single, batched);
+	printf("traps: fwrite %lu, ring %lu\n", records, traps);
+	if (failed > 0) printf("ringbench: %lu ring writes failed\n", failed);
+	return failed > 0;
+}
@@ -100,6 +100,38 @@ uint8_t builtin_time(char* arg) {
 	return 1;
 }
 
+/* 'builtin_nice' runs a command at another priority. The shell changes its own  *
+ * priority, spawns the command (which inherits it) and then changes it back.   */
+uint8_t builtin_nice(char* arg) {
+	uint32_t prio = 0;
+	char* p = arg;
+	if (*p < '0' || *p > '9') {
+		printf("Error - needs a priority and a command.\n");
+		return 1;
+	}
+	while (*p >= '0' && *p <= '9' && prio < 100) { prio = prio * 10 + (*p++ - '0'); }
+	while (*p == ' ') { ++p; }
+	if (*p == '\0') {
+		printf("Error - needs a priority and a command.\n");
+		return 1;
+	}
+
+	char* name = p;
+	while (*p != ' ' && *p != '\0') { ++p; }
+	if (*p != '\0') { *p++ = '\0'; }
+	while (*p == ' ') { ++p; }
+
+	int32_t old = (int32_t)ecall_setprio(-1, prio);
+	if (old < 0) {
+		printf("Error - priority must be between 0 and 39.\n");
+		return 1;
+	}
+	function_t func = get_command(name);
+	uint8_t ret = func ? func(p) : run_program(name, p, false);
+	ecall_setprio(-1, (uint32_t)old);
+	return ret;
+}
+
 /* 'builtin_shutdown' and 'builtin_reboot' both ecall to write a magic     *
  * number to QEMU's syscon linked memory address which prompts an emulator *
  * shutdown or reboot respectively. They currently execute immediately     *
@@ -37,6 +37,8 @@ command_t builtin_commands[] = {
 		"Remove the directory at the given path if it is empty." },
 	{ "time", builtin_time, "now [-s] | tz <tz>",
 		"Read the RTC for the current time or update the system timezone." },
+	{ "nice", builtin_nice, "<prio> <command> [args]",
+		"Run a command at the given priority (0 highest, 39 lowest, 20 default)." },
 	{ NULL, NULL, NULL, NULL }
 };
 
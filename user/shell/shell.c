@@ -11,6 +11,33 @@
 
 directory_t cwd;
 
+/*
+ * 'run_program' spawns a program from /bin.  In the foreground the shell waits for it
+ * and returns its return value.  In the background it only prints the job's tid, and
+ * the job is collected by 'reap_jobs' once it finishes.
+ */
+uint8_t run_program(char* name, char* args, bool background) {
+	int32_t tid = (int32_t)ecall_spawn(name, args);
+	if (tid == -2) return 0; /* The kernel already printed "command not found". */
+	if (tid < 0) return 1;
+	if (background) {
+		printf("[%d] %s\n", tid, name);
+		return 0;
+	}
+	uint8_t status = 0;
+	ecall_waitpid(tid, &status, 0);
+	return status;
+}
+
+/* Reports and collects the background jobs that finished since the last prompt. */
+static void reap_jobs(void) {
+	uint8_t status = 0;
+	int32_t tid;
+	while ((tid = (int32_t)ecall_waitpid(-1, &status, WNOHANG)) > 0) {
+		printf("[%d] done (%u)\n", tid, status);
+	}
+}
+
 /*
  * 'shell' loops forever, prompting the user for input, then calling a function based
  * on the text read in from the user.
@@ -29,10 +56,21 @@ int32_t main(void) {
 	}
 
 	while (1) {
+		reap_jobs();
 		printf("&x%s&0:&b%s&0$ ", PROMPT, cwd.path);
 		char line[LINE_SIZE];
 		gets(line, LINE_SIZE);
 
+		/* A trailing '&' runs the command in the background. */
+		bool background = false;
+		uint32_t len = (uint32_t)strlen(line);
+		while (len > 0 && line[len - 1] == ' ') { line[--len] = '\0'; }
+		if (len > 0 && line[len - 1] == '&') {
+			background = true;
+			line[--len] = '\0';
+			while (len > 0 && line[len - 1] == ' ') { line[--len] = '\0'; }
+		}
+
 		/* Extract first argument (program name). */
 		char arg0[MAX_ARG0_SIZE + 1]; /* factor in null character */
 		uint16_t ctr = 0;
@@ -69,7 +107,7 @@ int32_t main(void) {
 
 		function_t func = get_command(arg0);
 		if(func) { last_retval = func(prompt); } 
-		else { last_retval = ecall_spawn(arg0, prompt); }
+		else { last_retval = run_program(arg0, prompt, background); }
 	}
 	return 0;
 }
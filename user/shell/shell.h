@@ -26,7 +26,9 @@ uint8_t builtin_mkdir(char*);
 uint8_t builtin_rm(char*);
 uint8_t builtin_rmdir(char*);
 uint8_t builtin_time(char*);
+uint8_t builtin_nice(char*);
 function_t get_command(const char* name);
+uint8_t run_program(char*, char*, bool);
 
 extern command_t builtin_commands[];
 extern directory_t cwd;
@@ -0,0 +1,61 @@
+#include <dev/io.h>
+#include <dev/ecall.h>
+#include <dev/time.h>
+#include <util/string.h>
+
+/* Measures spawn-to-main latency: the time from the parent calling ecall_spawn to the   *
+ * child reaching main. The child is this same program run as "child <start time>". It   *
+ * can only hand back an 8-bit return value, so it returns the latency on a log scale    *
+ * (8 steps per power of two, about 12% resolution) which the parent decodes.           */
+
+#define ROUNDS 64
+#define TICKS_PER_US (RDTIME_HZ / 1000000)
+
+/* Values below 16 are exact, above that 3 mantissa bits per power of two. */
+static uint8_t encode_us(uint64_t us) {
+	if (us < 16) return (uint8_t)us;
+	uint32_t e = 4;
+	while ((us >> (e + 1)) != 0) ++e;
+	uint64_t code = 16 + (e - 4) * 8 + ((us >> (e - 3)) & 7);
+	return code > 255 ? 255 : (uint8_t)code;
+}
+
+static uint64_t decode_us(uint8_t code) {
+	if (code < 16) return code;
+	uint32_t e = 4 + (code - 16) / 8;
+	return (8UL + (code - 16) % 8) << (e - 3);
+}
+
+int main(int argc, char** argv) {
+	if (argc > 2 && !strcmp(argv[1], "child")) {
+		uint64_t elapsed = rdtime() - parse_u64(argv[2]);
+		return encode_us(elapsed / TICKS_PER_US);
+	}
+
+	uint8_t codes[ROUNDS];
+	uint32_t done = 0;
+	for (; done < ROUNDS; ++done) {
+		char args[32];
+		uint64_t start = rdtime();
+		sprintf((byte*)args, "child %lu", start);
+		int32_t tid = (int32_t)ecall_spawn("spawnbench", args);
+		if (tid < 0) {
+			printf("spawnbench: spawn failed on round %u\n", done);
+			break;
+		}
+		ecall_waitpid(tid, &codes[done], 0);
+	}
+	if (done == 0) return 1;
+
+	/* Insertion sort, the codes are monotonic in latency */
+	for (uint32_t i = 1; i < done; ++i) {
+		uint8_t c = codes[i];
+		uint32_t j = i;
+		for (; j > 0 && codes[j - 1] > c; --j) codes[j] = codes[j - 1];
+		codes[j] = c;
+	}
+	uint32_t p50 = (uint32_t)decode_us(codes[(done - 1) / 2]);
+	uint32_t p99 = (uint32_t)decode_us(codes[(done * 99 - 1) / 100]);
+	printf("spawn to main over %u spawns (us): p50 %u p99 %u max %u\n", done, p50, p99, (uint32_t)decode_us(codes[done - 1]));
+	return 0;
+}
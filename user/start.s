@@ -1,6 +1,5 @@
 	.globl _start
 _start:
 	call main
-	li a7, 93 # ECALL_EXIT
-	li a0, 0
+	li a7, 93 # ECALL_EXIT, main's return value is already in a0
 	ecall
@@ -0,0 +1,83 @@
+#include <dev/io.h>
+#include <dev/ecall.h>
+#include <dev/time.h>
+#include <util/string.h>
+
+/* Shows which threads are using the CPU. Takes a snapshot of every thread's counters *
+ * each interval and lists them by the share of one hart they used since the last.    *
+ * Usage: top [refreshes] [interval ms]                                               */
+
+#define MAX_ENTRIES 32
+#define MS_TICKS    (RDTIME_HZ / 1000)
+
+static thread_stat_t prev[MAX_ENTRIES];
+static thread_stat_t curr[MAX_ENTRIES];
+static uint32_t usage[MAX_ENTRIES];    /* Tenths of a percent of one hart, by 'curr' index */
+static uint32_t order[MAX_ENTRIES];
+
+static const thread_stat_t* find_prev(uint32_t tid, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i)
+		if (prev[i].tid == tid) return &prev[i];
+	return NULL;
+}
+
+static void show(uint32_t count, uint32_t prev_count, uint64_t wall) {
+	for (uint32_t i = 0; i < count; ++i) {
+		const thread_stat_t* p = find_prev(curr[i].tid, prev_count);
+		uint64_t used = curr[i].utime + curr[i].stime;
+		if (p != NULL && !strcmp(p->name, curr[i].name)) used -= p->utime + p->stime;
+		usage[i] = wall == 0 ? 0 : (uint32_t)(used * 1000 / wall);
+		order[i] = i;
+	}
+
+	/* Insertion sort, busiest first */
+	for (uint32_t i = 1; i < count; ++i) {
+		uint32_t o = order[i];
+		uint32_t j = i;
+		for (; j > 0 && usage[order[j - 1]] < usage[o]; --j) order[j] = order[j - 1];
+		order[j] = o;
+	}
+
+	printf("\x1b[H\x1b[2J");
+	printf("  TID PPID S P H  %%CPU    USER(ms)     SYS(ms)    WAIT(ms)    VCSW   IVCSW  FLT NAME\n");
+	for (uint32_t i = 0; i < count; ++i) {
+		const thread_stat_t* st = &curr[order[i]];
+		print_column(st->tid, 4);
+		if (st->parent < 0) printf("   - ");
+		else print_column((uint64_t)st->parent, 4);
+		printf("%c ", st->state);
+		print_column(st->priority, 1);
+		print_column(st->hart, 1);
+		print_pad(num_digits(usage[order[i]] / 10), 3);
+		printf("%u.%u ", usage[order[i]] / 10, usage[order[i]] % 10);
+		print_column(st->utime / MS_TICKS, 11);
+		print_column(st->stime / MS_TICKS, 11);
+		print_column(st->wait_time / MS_TICKS, 11);
+		print_column(st->nvcsw, 7);
+		print_column(st->nivcsw, 7);
+		print_column(st->faults, 4);
+		printf("%s\n", st->name);
+	}
+}
+
+int main(int argc, char** argv) {
+	uint64_t refreshes = argc > 1 ? parse_u64(argv[1]) : 5;
+	uint64_t interval = argc > 2 ? parse_u64(argv[2]) : 1000;
+	if (refreshes == 0 || interval == 0) {
+		printf("usage: top [refreshes] [interval ms]\n");
+		return 1;
+	}
+
+	uint32_t prev_count = (uint32_t)ecall_tstat(prev, MAX_ENTRIES);
+	uint64_t last = rdtime();
+	for (uint64_t r = 0; r < refreshes; ++r) {
+		ecall_sleep((uint32_t)interval);
+		uint32_t count = (uint32_t)ecall_tstat(curr, MAX_ENTRIES);
+		uint64_t now = rdtime();
+		show(count, prev_count, now - last);
+		memcpy(prev, curr, sizeof(thread_stat_t) * count);
+		prev_count = count;
+		last = now;
+	}
+	return 0;
+}